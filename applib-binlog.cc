@@ -0,0 +1,350 @@
+/**
+ * @file applib-binlog.cc
+ * @brief Definitions for AppLibBinLog class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include "applib-binlog.h"
+#include "applib-profiler.h"
+#include "applib-clock.h"
+#include "applib-private.h"
+
+#include <string.h>
+
+#if defined(Q_OS_UNIX)
+#   include <sys/mman.h>
+#elif defined(Q_OS_WIN)
+#   include <windows.h>
+#endif
+
+//! The file grows in steps of this many bytes.
+#define APPLIB_BINLOG_CHUNK (1024 * 1024)
+
+/* ------------------------------------------------------------------------- */
+static inline quint64 align8 (quint64 value)
+{
+    return (value + 7) & ~static_cast<quint64>(7);
+}
+/* ========================================================================= */
+
+/**
+ * @class AppLibBinLog
+ *
+ * Each message becomes a fixed size record header followed by the
+ * UTF-8 text, written straight into a memory-mapped file. Nothing is
+ * formatted: the decoder (applib-logdump) turns the records back into
+ * text or JSON.
+ *
+ * The source file, function and category of the messages are interned:
+ * the first time a string is seen a StringRecord defines its id and the
+ * messages only carry the ids. The strings that Qt places in
+ * QMessageLogContext are literals, so they are first looked up by their
+ * address and only then by their content.
+ *
+ * The header keeps the number of bytes in use, updated after each
+ * record, so a file left behind by a crash can be decoded up to the
+ * last complete record.
+ */
+
+/* ------------------------------------------------------------------------- */
+AppLibBinLog::AppLibBinLog () :
+    mutex_ (),
+    file_ (),
+    data_ (NULL),
+    capacity_ (0),
+    by_pointer_ (),
+    by_text_ ()
+{
+    APPLIB_TRACE_ENTRY;
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibBinLog::~AppLibBinLog ()
+{
+    APPLIB_TRACE_ENTRY;
+    close ();
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Encodes UTF-16 to UTF-8 without allocating. Encoding stops before the
+ * first character that does not fit. Unpaired surrogates become U+FFFD.
+ *
+ * @param src the characters
+ * @param len number of characters
+ * @param dst where the bytes go
+ * @param capacity bytes available in dst; three bytes for each input
+ *      character are always enough
+ * @return the number of bytes written
+ */
+quint32 AppLibBinLog::toUtf8 (
+        const QChar * src, int len, uchar * dst, quint32 capacity)
+{
+    uchar * out = dst;
+    uchar * out_end = dst + capacity;
+    for (int i = 0; i < len; ++i) {
+        uint c = src[i].unicode ();
+        if (c < 0x80) {
+            if (out_end - out < 1)
+                break;
+            *out++ = static_cast<uchar>(c);
+            continue;
+        }
+        if (c < 0x800) {
+            if (out_end - out < 2)
+                break;
+            *out++ = static_cast<uchar>(0xC0 | (c >> 6));
+            *out++ = static_cast<uchar>(0x80 | (c & 0x3F));
+            continue;
+        }
+        if ((c >= 0xD800) && (c < 0xDC00) && (i + 1 < len) &&
+                (src[i + 1].unicode () >= 0xDC00) &&
+                (src[i + 1].unicode () < 0xE000)) {
+            if (out_end - out < 4)
+                break;
+            c = 0x10000 + ((c - 0xD800) << 10) + (src[++i].unicode () - 0xDC00);
+            *out++ = static_cast<uchar>(0xF0 | (c >> 18));
+            *out++ = static_cast<uchar>(0x80 | ((c >> 12) & 0x3F));
+            *out++ = static_cast<uchar>(0x80 | ((c >> 6) & 0x3F));
+            *out++ = static_cast<uchar>(0x80 | (c & 0x3F));
+            continue;
+        }
+        if (out_end - out < 3)
+            break;
+        if ((c >= 0xD800) && (c < 0xE000))
+            c = 0xFFFD;
+        *out++ = static_cast<uchar>(0xE0 | (c >> 12));
+        *out++ = static_cast<uchar>(0x80 | ((c >> 6) & 0x3F));
+        *out++ = static_cast<uchar>(0x80 | (c & 0x3F));
+    }
+    return static_cast<quint32>(out - dst);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLibBinLog::map ()
+{
+    capacity_ = static_cast<quint64>(file_.size ());
+    data_ = file_.map (0, file_.size ());
+    if (data_ == NULL) {
+        APPLIB_DEBUGM("Unable to map binary log %s\n",
+                      TMP_A(file_.fileName ()));
+        return false;
+    }
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLibBinLog::open (const QString & file)
+{
+    close ();
+    std::lock_guard<std::mutex> lock (mutex_);
+    file_.setFileName (file);
+    if (!file_.open (QIODevice::ReadWrite | QIODevice::Truncate)) {
+        APPLIB_DEBUGM("Unable to create binary log %s\n", TMP_A(file));
+        return false;
+    }
+    if (!file_.resize (APPLIB_BINLOG_CHUNK) || !map ()) {
+        file_.close ();
+        return false;
+    }
+
+    AppLibBinLogHeader * header =
+            reinterpret_cast<AppLibBinLogHeader *>(data_);
+    memset (header, 0, sizeof(AppLibBinLogHeader));
+    memcpy (header->magic, APPLIB_BINLOG_MAGIC, sizeof(header->magic));
+    header->version = APPLIB_BINLOG_VERSION;
+    header->header_size = sizeof(AppLibBinLogHeader);
+    header->start_ns = AppLibClock::coarseNs ();
+    header->start_ms = AppLibClock::toWallNs (header->start_ns) / 1000000;
+    header->end = sizeof(AppLibBinLogHeader);
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibBinLog::close ()
+{
+    std::lock_guard<std::mutex> lock (mutex_);
+    if (data_ == NULL)
+        return;
+    quint64 end = reinterpret_cast<AppLibBinLogHeader *>(data_)->end;
+    file_.unmap (data_);
+    data_ = NULL;
+    file_.resize (static_cast<qint64>(end));
+    file_.close ();
+    capacity_ = 0;
+    by_pointer_.clear ();
+    by_text_.clear ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLibBinLog::isOpen () const
+{
+    std::lock_guard<std::mutex> lock (mutex_);
+    return data_ != NULL;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+quint64 AppLibBinLog::size () const
+{
+    std::lock_guard<std::mutex> lock (mutex_);
+    if (data_ == NULL)
+        return 0;
+    return reinterpret_cast<const AppLibBinLogHeader *>(data_)->end;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Must be called with the mutex held; the mapping may change.
+ */
+bool AppLibBinLog::reserve (quint64 bytes)
+{
+    quint64 end = reinterpret_cast<AppLibBinLogHeader *>(data_)->end;
+    if (end + bytes <= capacity_)
+        return true;
+
+    quint64 new_size = capacity_;
+    while (new_size < end + bytes)
+        new_size += APPLIB_BINLOG_CHUNK;
+    file_.unmap (data_);
+    data_ = NULL;
+    if (!file_.resize (static_cast<qint64>(new_size)) || !map ()) {
+        // keep what we have so that close() still works
+        map ();
+        return false;
+    }
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Must be called with the mutex held.
+ *
+ * The strings of QMessageLogContext are usually literals, but some are
+ * built at run time (QML and JavaScript console messages, dynamic
+ * categories) and their address can be reused by another string; the
+ * pointer is only trusted when the text still matches.
+ *
+ * @return the id of the string; 0 for NULL
+ */
+quint32 AppLibBinLog::intern (
+        const char * text, qint64 time_ns, quint32 thread)
+{
+    if (text == NULL)
+        return 0;
+    QHash<const char *, Interned>::const_iterator known =
+            by_pointer_.constFind (text);
+    if ((known != by_pointer_.constEnd ()) &&
+            (qstrcmp (known.value ().text.constData (), text) == 0))
+        return known.value ().id;
+
+    QByteArray key (text);
+    QHash<QByteArray, quint32>::const_iterator by_text =
+            by_text_.constFind (key);
+    quint32 id = 0;
+    if (by_text != by_text_.constEnd ()) {
+        id = by_text.value ();
+        key = by_text.key ();
+    }
+    if (id == 0) {
+        const quint64 bytes = align8 (sizeof(AppLibBinLogRecord) + key.size ());
+        if ((data_ == NULL) || !reserve (bytes))
+            return 0;
+        id = static_cast<quint32>(by_text_.count () + 1);
+
+        AppLibBinLogHeader * header =
+                reinterpret_cast<AppLibBinLogHeader *>(data_);
+        AppLibBinLogRecord * rec =
+                reinterpret_cast<AppLibBinLogRecord *>(data_ + header->end);
+        memset (rec, 0, sizeof(AppLibBinLogRecord));
+        rec->kind = StringRecord;
+        rec->time_ns = time_ns;
+        rec->thread = thread;
+        rec->category = id;
+        rec->length = static_cast<quint32>(key.size ());
+        memcpy (rec + 1, key.constData (), key.size ());
+        rec->size = static_cast<quint32>(bytes);
+        header->end += bytes;
+        by_text_.insert (key, id);
+    }
+    Interned interned;
+    interned.id = id;
+    interned.text = key;
+    by_pointer_.insert (text, interned);
+    return id;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLibBinLog::append (
+        QtMsgType type, const QMessageLogContext & context,
+        const QString & msg)
+{
+    const qint64 now = AppLibClock::coarseNs ();
+    const quint32 thread = static_cast<quint32>(AppLibProfiler::currentThread ());
+
+    std::lock_guard<std::mutex> lock (mutex_);
+    if (data_ == NULL)
+        return false;
+
+    const qint64 time_ns =
+            now - reinterpret_cast<AppLibBinLogHeader *>(data_)->start_ns;
+    const quint32 category = intern (context.category, time_ns, thread);
+    const quint32 file = intern (context.file, time_ns, thread);
+    const quint32 function = intern (context.function, time_ns, thread);
+
+    // the worst case for the text; the unused part is reclaimed below
+    if (!reserve (align8 (sizeof(AppLibBinLogRecord) + msg.size () * 3)))
+        return false;
+
+    AppLibBinLogHeader * header = reinterpret_cast<AppLibBinLogHeader *>(data_);
+    AppLibBinLogRecord * rec =
+            reinterpret_cast<AppLibBinLogRecord *>(data_ + header->end);
+    rec->kind = MessageRecord;
+    rec->type = static_cast<quint16>(type);
+    rec->time_ns = time_ns;
+    rec->thread = thread;
+    rec->category = category;
+    rec->file = file;
+    rec->line = static_cast<quint32>(context.line);
+    rec->function = function;
+    rec->length = toUtf8 (msg.constData (), msg.size (),
+                          reinterpret_cast<uchar *>(rec + 1),
+                          static_cast<quint32>(msg.size () * 3));
+    const quint64 bytes = align8 (sizeof(AppLibBinLogRecord) + rec->length);
+    rec->size = static_cast<quint32>(bytes);
+    header->end += bytes;
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibBinLog::sync ()
+{
+    std::lock_guard<std::mutex> lock (mutex_);
+    if (data_ == NULL)
+        return;
+    size_t used = static_cast<size_t>(
+                reinterpret_cast<AppLibBinLogHeader *>(data_)->end);
+#if defined(Q_OS_UNIX)
+    msync (data_, used, MS_SYNC);
+#elif defined(Q_OS_WIN)
+    FlushViewOfFile (data_, used);
+#else
+    Q_UNUSED(used);
+#endif
+}
+/* ========================================================================= */
@@ -0,0 +1,142 @@
+/**
+ * @file applib-binlog.h
+ * @brief Declarations for AppLibBinLog class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_APPLIB_BINLOG_H_INCLUDE
+#define GUARD_APPLIB_BINLOG_H_INCLUDE
+
+#include <applib/applib-config.h>
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QFile>
+#include <QtGlobal>
+
+#include <mutex>
+
+//! Magic bytes at the start of a binary log file.
+#define APPLIB_BINLOG_MAGIC "APBINLG1"
+
+//! Version of the binary log format.
+#define APPLIB_BINLOG_VERSION 1
+
+//! The header at the start of a binary log file (64 bytes).
+struct AppLibBinLogHeader {
+    char magic[8]; /**< APPLIB_BINLOG_MAGIC, without the terminator */
+    quint32 version; /**< APPLIB_BINLOG_VERSION */
+    quint32 header_size; /**< sizeof(AppLibBinLogHeader) */
+    qint64 start_ns; /**< monotonic time the record times are relative to */
+    qint64 start_ms; /**< wall clock at start_ns, ms since the epoch */
+    quint64 end; /**< bytes in use, including this header */
+    quint64 reserved[3]; /**< zero */
+};
+
+//! The fixed part of each record (40 bytes); the payload follows.
+struct AppLibBinLogRecord {
+    quint32 size; /**< header, payload and padding to 8 bytes */
+    quint16 kind; /**< AppLibBinLog::Kind */
+    quint16 type; /**< QtMsgType for messages */
+    qint64 time_ns; /**< nanoseconds since AppLibBinLogHeader::start_ns */
+    quint32 thread; /**< small integer identifying the thread */
+    quint32 category; /**< interned category; the id for string records */
+    quint32 file; /**< interned source file */
+    quint32 line; /**< source line */
+    quint32 function; /**< interned function name */
+    quint32 length; /**< bytes of UTF-8 payload */
+};
+
+//! Qt messages appended as binary records to a memory-mapped file.
+class APPLIB_EXPORT AppLibBinLog {
+
+public:
+
+    //! The kinds of records.
+    enum Kind {
+        MessageRecord = 1, /**< a message; the payload is the text */
+        StringRecord = 2 /**< defines an interned string (the payload) */
+    };
+
+    //! Default constructor.
+    AppLibBinLog ();
+
+    //! Destructor; closes the file.
+    ~AppLibBinLog ();
+
+    //! Create (or truncate) the file and map it.
+    bool
+    open (
+            const QString & file);
+
+    //! Trim the file to the records and release it.
+    void
+    close ();
+
+    //! Is there a file being written?
+    bool
+    isOpen () const;
+
+    //! Append a message.
+    bool
+    append (
+            QtMsgType type,
+            const QMessageLogContext & context,
+            const QString & msg);
+
+    //! Ask the system to write the mapped pages to the disk.
+    void
+    sync ();
+
+    //! Number of bytes in use.
+    quint64
+    size () const;
+
+    //! Encode UTF-16 as UTF-8 in a buffer; returns the bytes used.
+    static quint32
+    toUtf8 (
+            const QChar * src,
+            int len,
+            uchar * dst,
+            quint32 capacity);
+
+private:
+
+    //! A string seen at an address; the address may be reused later.
+    struct Interned {
+        quint32 id; /**< the id written in the log */
+        QByteArray text; /**< shares the key of by_text_ */
+    };
+
+    //! Make room for this many more bytes, growing the file.
+    bool
+    reserve (
+            quint64 bytes);
+
+    //! Id of a string, writing its definition the first time.
+    quint32
+    intern (
+            const char * text,
+            qint64 time_ns,
+            quint32 thread);
+
+    //! Map the file as it is now.
+    bool
+    map ();
+
+    AppLibBinLog (const AppLibBinLog &);
+    AppLibBinLog& operator=( const AppLibBinLog& );
+
+private:
+    mutable std::mutex mutex_; /**< serializes the appends */
+    QFile file_; /**< the log file */
+    uchar * data_; /**< the mapping; NULL if not open */
+    quint64 capacity_; /**< size of the file / mapping */
+    QHash<const char *, Interned> by_pointer_; /**< fast path of intern() */
+    QHash<QByteArray, quint32> by_text_; /**< all the interned strings */
+};
+
+#endif // GUARD_APPLIB_BINLOG_H_INCLUDE
@@ -0,0 +1,208 @@
+/**
+ * @file applib-clock.cc
+ * @brief Definitions for AppLibClock class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include "applib-clock.h"
+#include "applib-private.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/**
+ * @class AppLibClock
+ *
+ * nowNs() reads std::chrono::steady_clock (CLOCK_MONOTONIC through the
+ * vDSO on Linux); it is the clock of the profiler, the trace zones and
+ * the message handler. Where a timestamp is needed for every message or
+ * event and a resolution of a tick is enough, coarseNs() returns the
+ * value stored by a ticker thread with a single relaxed load. Without a
+ * ticker it falls back to nowNs(), so callers don't have to care
+ * whether one was started.
+ *
+ * Monotonic times are turned into wall time with an offset measured
+ * between two reads of the monotonic clock around a read of the wall
+ * clock. The offset is measured again every second by the ticker, or
+ * by the conversions when it is older than that, so adjustments of
+ * the system time are followed. Only toDateTime() deals with the time
+ * zone, and only when a date is actually needed.
+ */
+
+std::atomic<qint64> AppLibClock::coarse_ns_ (0);
+
+//! wall time minus monotonic time; valid when clock_synced_ns_ is not 0
+static std::atomic<qint64> clock_offset_ns_ (0);
+
+//! monotonic time of the last resync()
+static std::atomic<qint64> clock_synced_ns_ (0);
+
+//! how often the offset is measured again
+static const qint64 clock_resync_ns_ = Q_INT64_C(1000000000);
+
+//! serializes startTicker() and stopTicker(); outlives clock_ticker_
+static std::mutex clock_ticker_control_;
+
+//! The thread that updates the coarse clock.
+struct ClockTicker {
+    std::mutex mutex; /**< used by the thread */
+    std::condition_variable cv; /**< wakes the thread */
+    bool stop; /**< ask the thread to exit */
+    std::thread thread; /**< the ticker */
+
+    //! Constructor.
+    ClockTicker () : mutex (), cv (), stop (false), thread () {}
+
+    //! Destructor; a running thread is stopped at exit.
+    ~ClockTicker () {
+        AppLibClock::stopTicker ();
+    }
+};
+
+//! the ticker of the process
+static ClockTicker clock_ticker_;
+
+/* ------------------------------------------------------------------------- */
+qint64 AppLibClock::nowNs ()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+qint64 AppLibClock::wallNs ()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now ().time_since_epoch ()).count ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The wall clock is read between two reads of the monotonic clock and
+ * is matched with their midpoint; the shortest of a few attempts wins,
+ * so a preemption in the middle does not skew the offset.
+ */
+void AppLibClock::resync ()
+{
+    qint64 best_span = -1;
+    qint64 best_offset = 0;
+    qint64 mono_after = 0;
+    for (int i = 0; i < 3; ++i) {
+        const qint64 mono_before = nowNs ();
+        const qint64 wall = wallNs ();
+        mono_after = nowNs ();
+        const qint64 span = mono_after - mono_before;
+        if ((best_span == -1) || (span < best_span)) {
+            best_span = span;
+            best_offset = wall - (mono_before + span / 2);
+        }
+    }
+    clock_offset_ns_.store (best_offset, std::memory_order_relaxed);
+    clock_synced_ns_.store (mono_after, std::memory_order_release);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! The offset between the clocks, measured again if it is too old.
+static qint64 clockOffset ()
+{
+    const qint64 synced = clock_synced_ns_.load (std::memory_order_acquire);
+    if ((synced == 0) ||
+            (AppLibClock::nowNs () - synced >= clock_resync_ns_))
+        AppLibClock::resync ();
+    return clock_offset_ns_.load (std::memory_order_relaxed);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+qint64 AppLibClock::toWallNs (qint64 monotonic_ns)
+{
+    return monotonic_ns + clockOffset ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+qint64 AppLibClock::toMonotonicNs (qint64 wall_ns)
+{
+    return wall_ns - clockOffset ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+QDateTime AppLibClock::toDateTime (qint64 monotonic_ns)
+{
+    return QDateTime::fromMSecsSinceEpoch (
+                toWallNs (monotonic_ns) / 1000000);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibClock::tickerLoop (int resolution_us)
+{
+    qint64 next_resync = 0;
+    std::unique_lock<std::mutex> lock (clock_ticker_.mutex);
+    for (;;) {
+        const qint64 now = nowNs ();
+        coarse_ns_.store (now, std::memory_order_relaxed);
+        if (now >= next_resync) {
+            resync ();
+            next_resync = now + clock_resync_ns_;
+        }
+        if (clock_ticker_.cv.wait_for (
+                    lock, std::chrono::microseconds (resolution_us),
+                    [] { return clock_ticker_.stop; }))
+            return;
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * A running ticker is restarted with the new resolution. The thread
+ * wakes up once per tick, so a resolution much below a millisecond
+ * costs more than it saves.
+ *
+ * @param resolution_us time between updates of coarseNs(), in microseconds
+ * @return false if the thread could not be started
+ */
+bool AppLibClock::startTicker (int resolution_us)
+{
+    std::lock_guard<std::mutex> control (clock_ticker_control_);
+    stopTickerLocked ();
+    coarse_ns_.store (nowNs (), std::memory_order_relaxed);
+    clock_ticker_.stop = false;
+    clock_ticker_.thread = std::thread (
+                &AppLibClock::tickerLoop, qMax (resolution_us, 50));
+    return clock_ticker_.thread.joinable ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibClock::stopTicker ()
+{
+    std::lock_guard<std::mutex> control (clock_ticker_control_);
+    stopTickerLocked ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibClock::stopTickerLocked ()
+{
+    if (clock_ticker_.thread.joinable ()) {
+        {
+            std::lock_guard<std::mutex> lock (clock_ticker_.mutex);
+            clock_ticker_.stop = true;
+        }
+        clock_ticker_.cv.notify_all ();
+        clock_ticker_.thread.join ();
+    }
+    coarse_ns_.store (0, std::memory_order_relaxed);
+}
+/* ========================================================================= */
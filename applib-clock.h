@@ -0,0 +1,89 @@
+/**
+ * @file applib-clock.h
+ * @brief Declarations for AppLibClock class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_APPLIB_CLOCK_H_INCLUDE
+#define GUARD_APPLIB_CLOCK_H_INCLUDE
+
+#include <applib/applib-config.h>
+#include <QDateTime>
+
+#include <atomic>
+
+//! Process-wide clocks: precise and coarse monotonic time, wall time.
+class APPLIB_EXPORT AppLibClock {
+
+public:
+
+    //! Monotonic time in nanoseconds (arbitrary origin).
+    static qint64
+    nowNs ();
+
+    //! Monotonic time as of the last tick; a single load while ticking.
+    static inline qint64
+    coarseNs () {
+        const qint64 result = coarse_ns_.load (std::memory_order_relaxed);
+        return (result != 0 ? result : nowNs ());
+    }
+
+    //! Wall time in nanoseconds since the Unix epoch.
+    static qint64
+    wallNs ();
+
+    //! Update coarseNs() every resolution_us from a background thread.
+    static bool
+    startTicker (
+            int resolution_us = 1000);
+
+    //! Stop the ticker; coarseNs() becomes precise again.
+    static void
+    stopTicker ();
+
+    //! Is the ticker running?
+    static bool
+    isTicking () {
+        return coarse_ns_.load (std::memory_order_relaxed) != 0;
+    }
+
+    //! The wall time of a monotonic time, in nanoseconds since the epoch.
+    static qint64
+    toWallNs (
+            qint64 monotonic_ns);
+
+    //! The monotonic time of a wall time given in nanoseconds.
+    static qint64
+    toMonotonicNs (
+            qint64 wall_ns);
+
+    //! The local date and time of a monotonic time.
+    static QDateTime
+    toDateTime (
+            qint64 monotonic_ns);
+
+    //! Measure again the offset between the monotonic and the wall clock.
+    static void
+    resync ();
+
+private:
+
+    //! Body of the ticker thread.
+    static void
+    tickerLoop (
+            int resolution_us);
+
+    //! Stop the ticker; the control mutex is held.
+    static void
+    stopTickerLocked ();
+
+    AppLibClock ();
+
+private:
+    static std::atomic<qint64> coarse_ns_; /**< 0 while not ticking */
+};
+
+#endif // GUARD_APPLIB_CLOCK_H_INCLUDE
@@ -0,0 +1,337 @@
+/**
+ * @file applib-coro.h
+ * @brief Declarations for AppLibCoro class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ *
+ * C++20 coroutines on top of the lifecycle and the executor of AppLib.
+ * The header is empty (and APPLIB_HAS_COROUTINES is not defined) when
+ * the compiler does not implement coroutines or Qt is older than 5.10.
+ *
+ * Once the library terminates the executor refuses new work and the
+ * awaitables continue on the calling thread instead. A coroutine that
+ * is still queued on the executor (inBackground(), or switchTo() and
+ * untilState() with ThreadPool) when AppLib::finish() misses its drain
+ * deadline is dropped with the other queued tasks: it never resumes and
+ * its frame is leaked. Keep such work short, or raise the deadline with
+ * AppLib::setExecutorDrainDeadline().
+ *
+ * @code
+ * AppLibCoro::Task MyLib::startUp ()
+ * {
+ *     QByteArray data = co_await AppLibCoro::inBackground (
+ *                 this, [] () { return readSettingsFile (); });
+ *     // back on the thread of the library
+ *     applySettings (data);
+ *     if (co_await AppLibCoro::untilState (this, AppLib::RunningGuiState))
+ *         restoreWindows ();
+ * }
+ * @endcode
+ */
+
+#ifndef GUARD_APPLIB_CORO_H_INCLUDE
+#define GUARD_APPLIB_CORO_H_INCLUDE
+
+#include <applib/applib-config.h>
+#include <applib/applib.h>
+#include <applib/applib-executor.h>
+#include <QObject>
+
+#if defined(__cpp_impl_coroutine) && \
+    (QT_VERSION >= QT_VERSION_CHECK(5, 10, 0))
+#define APPLIB_HAS_COROUTINES 1
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <utility>
+
+//! Awaitables for the lifecycle of AppLib and for background work.
+class AppLibCoro {
+
+public:
+
+    //! Where a coroutine continues after it was suspended.
+    enum Resume {
+        EventLoop, /**< queued to the thread of the library */
+        ThreadPool, /**< a worker of AppLib::executor() */
+        Inline /**< the thread that ended the wait */
+    };
+
+    //! Fire-and-forget coroutine; starts at once, frees itself at the end.
+    class Task {
+    public:
+        //! Required by the compiler.
+        struct promise_type {
+            Task
+            get_return_object () {
+                return Task ();
+            }
+
+            std::suspend_never
+            initial_suspend () noexcept {
+                return std::suspend_never ();
+            }
+
+            std::suspend_never
+            final_suspend () noexcept {
+                return std::suspend_never ();
+            }
+
+            void
+            return_void () {}
+
+            void
+            unhandled_exception () {
+                std::terminate ();
+            }
+        };
+    };
+
+    //! Continue a suspended coroutine in the requested place.
+    static void
+    resume (
+            AppLib * lib,
+            Resume where,
+            AppLibExecutor::Priority priority,
+            std::coroutine_handle<> handle) {
+        switch (where) {
+        case EventLoop:
+            if (QMetaObject::invokeMethod (
+                        lib, [handle] () { handle.resume (); },
+                        Qt::QueuedConnection))
+                return;
+            break;
+        case ThreadPool:
+            // rejected once the library terminates
+            if (lib->executor ()->submit (
+                        [handle] () { handle.resume (); }, priority))
+                return;
+            break;
+        case Inline:
+            break;
+        }
+        handle.resume ();
+    }
+
+    //! co_await yields true when the state is reached, false if it can't be.
+    class StateAwaiter : private AppLib::StateWaiter {
+    public:
+        //! Constructor.
+        StateAwaiter (
+                AppLib * lib,
+                AppLib::State value,
+                Resume where) :
+            lib_ (lib),
+            where_ (where),
+            b_reached_ (false),
+            handle_ () {
+            state = value;
+            wake = &StateAwaiter::onWake;
+            next = NULL;
+        }
+
+        //! Required by the compiler.
+        bool
+        await_ready () const {
+            return AppLib::isStateReached (lib_->state (), state);
+        }
+
+        //! Required by the compiler; false continues without suspending.
+        bool
+        await_suspend (
+                std::coroutine_handle<> handle) {
+            handle_ = handle;
+            if (where_ == ThreadPool) {
+                // created now, not from inside setState()
+                lib_->executor ();
+            }
+            return lib_->addStateWaiter (this);
+        }
+
+        //! Required by the compiler.
+        bool
+        await_resume () const {
+            return b_reached_ ||
+                    AppLib::isStateReached (lib_->state (), state);
+        }
+
+    private:
+        //! Called by AppLib::setState(); the awaiter dies when resumed.
+        static void
+        onWake (
+                AppLib::StateWaiter * waiter,
+                bool b_reached) {
+            StateAwaiter * self = static_cast<StateAwaiter *>(waiter);
+            self->b_reached_ = b_reached;
+            resume (self->lib_, self->where_,
+                    AppLibExecutor::HighPriority, self->handle_);
+        }
+
+        AppLib * lib_; /**< the library being watched */
+        Resume where_; /**< where the coroutine continues */
+        bool b_reached_; /**< the outcome of the wait */
+        std::coroutine_handle<> handle_; /**< the suspended coroutine */
+    };
+
+    //! co_await runs a function on the executor and yields its result.
+    template <typename R>
+    class WorkAwaiter {
+    public:
+        //! Constructor.
+        WorkAwaiter (
+                AppLib * lib,
+                std::function<R ()> fn,
+                Resume where,
+                AppLibExecutor::Priority priority) :
+            lib_ (lib),
+            fn_ (std::move (fn)),
+            where_ (where),
+            priority_ (priority),
+            result_ () {}
+
+        //! Required by the compiler.
+        bool
+        await_ready () const {
+            return false;
+        }
+
+        //! Required by the compiler; false continues without suspending.
+        bool
+        await_suspend (
+                std::coroutine_handle<> handle) {
+            AppLib * lib = lib_;
+            Resume where = (where_ == ThreadPool ? Inline : where_);
+            AppLibExecutor::Priority priority = priority_;
+            if (lib->executor ()->submit ([this, lib, where,
+                                          priority, handle] () {
+                result_.run (fn_);
+                resume (lib, where, priority, handle);
+            }, priority_))
+                return true;
+            // the pool is closed; do the work here
+            result_.run (fn_);
+            return false;
+        }
+
+        //! Required by the compiler.
+        R
+        await_resume () {
+            return result_.take ();
+        }
+
+    private:
+        //! Holds the value returned by the function.
+        template <typename T, typename Dummy = void>
+        struct Result {
+            std::optional<T> value; /**< empty until the function ran */
+
+            void
+            run (
+                    std::function<T ()> & fn) {
+                value.emplace (fn ());
+            }
+
+            T
+            take () {
+                return std::move (*value);
+            }
+        };
+
+        //! A function that returns nothing.
+        template <typename Dummy>
+        struct Result<void, Dummy> {
+            void
+            run (
+                    std::function<void ()> & fn) {
+                fn ();
+            }
+
+            void
+            take () {}
+        };
+
+        AppLib * lib_; /**< owns the executor */
+        std::function<R ()> fn_; /**< the work */
+        Resume where_; /**< where the coroutine continues */
+        AppLibExecutor::Priority priority_; /**< lane of the executor */
+        Result<R> result_; /**< what fn_ returned */
+    };
+
+    //! co_await moves the coroutine to another thread.
+    class SwitchAwaiter {
+    public:
+        //! Constructor.
+        SwitchAwaiter (
+                AppLib * lib,
+                Resume where,
+                AppLibExecutor::Priority priority) :
+            lib_ (lib),
+            where_ (where),
+            priority_ (priority) {}
+
+        //! Required by the compiler.
+        bool
+        await_ready () const {
+            return where_ == Inline;
+        }
+
+        //! Required by the compiler.
+        void
+        await_suspend (
+                std::coroutine_handle<> handle) {
+            resume (lib_, where_, priority_, handle);
+        }
+
+        //! Required by the compiler.
+        void
+        await_resume () const {}
+
+    private:
+        AppLib * lib_; /**< the library */
+        Resume where_; /**< where the coroutine continues */
+        AppLibExecutor::Priority priority_; /**< lane of the executor */
+    };
+
+    //! Wait for the library to reach a state, without blocking.
+    static StateAwaiter
+    untilState (
+            AppLib * lib,
+            AppLib::State value,
+            Resume where = EventLoop) {
+        return StateAwaiter (lib, value, where);
+    }
+
+    //! Run a function on the executor of the library.
+    template <typename Fn>
+    static WorkAwaiter<decltype (std::declval<Fn> () ())>
+    inBackground (
+            AppLib * lib,
+            Fn fn,
+            Resume where = EventLoop,
+            AppLibExecutor::Priority priority =
+                AppLibExecutor::NormalPriority) {
+        return WorkAwaiter<decltype (std::declval<Fn> () ())> (
+                    lib, std::move (fn), where, priority);
+    }
+
+    //! Continue on the event loop of the library or on the executor.
+    static SwitchAwaiter
+    switchTo (
+            AppLib * lib,
+            Resume where,
+            AppLibExecutor::Priority priority =
+                AppLibExecutor::NormalPriority) {
+        return SwitchAwaiter (lib, where, priority);
+    }
+
+private:
+    AppLibCoro ();
+};
+
+#endif // __cpp_impl_coroutine
+
+#endif // GUARD_APPLIB_CORO_H_INCLUDE
@@ -0,0 +1,339 @@
+/**
+ * @file applib-executor.cc
+ * @brief Definitions for AppLibExecutor class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include "applib-executor.h"
+#include "applib-profiler.h"
+#include "applib-private.h"
+
+#include <chrono>
+
+#if defined(__linux__)
+#   include <pthread.h>
+#   include <sched.h>
+#endif
+
+/**
+ * @class AppLibExecutor
+ *
+ * Each worker owns a queue. Tasks submitted from a worker go to its own
+ * queue and are taken back in last-in first-out order, which keeps
+ * related work on the same core; tasks submitted from other threads are
+ * spread round-robin. A worker that runs out of work steals the oldest
+ * task from the other queues before going to sleep.
+ *
+ * Each queue has a lane per Priority. Workers look at the high lanes of
+ * all the queues (their own first) before the lower ones, so background
+ * work never delays a latency sensitive task that is waiting.
+ *
+ * AppLib owns one pool for the library and its plug-ins: it accepts
+ * tasks from InitializingState on and is drained, with a deadline,
+ * when the library enters TerminatingState.
+ */
+
+//! the executor the calling thread works for
+static thread_local const AppLibExecutor * tls_executor_ = NULL;
+
+//! the index of the calling thread in tls_executor_
+static thread_local int tls_worker_ = -1;
+
+/* ------------------------------------------------------------------------- */
+AppLibExecutor::AppLibExecutor (int workers) :
+    queued_ (0),
+    running_ (0),
+    next_ (0),
+    stop_ (false),
+    accepting_ (true),
+    rejected_ (0),
+    dropped_ (0),
+    created_ns_ (AppLibProfiler::nowNs ())
+{
+    APPLIB_TRACE_ENTRY;
+    for (int p = 0; p < PriorityCount; ++p)
+        submitted_[p].store (0, std::memory_order_relaxed);
+    if (workers <= 0) {
+        workers = static_cast<int>(std::thread::hardware_concurrency ());
+        if (workers <= 0)
+            workers = 2;
+    }
+    workers_.reserve (workers);
+    for (int i = 0; i < workers; ++i) {
+        Worker * w = new Worker ();
+        w->completed.store (0, std::memory_order_relaxed);
+        w->stolen.store (0, std::memory_order_relaxed);
+        w->busy_ns.store (0, std::memory_order_relaxed);
+        workers_.push_back (w);
+    }
+    for (int i = 0; i < workers; ++i) {
+        workers_[i]->thread = std::thread (&AppLibExecutor::workerLoop, this, i);
+    }
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibExecutor::~AppLibExecutor ()
+{
+    APPLIB_TRACE_ENTRY;
+    waitIdle ();
+    {
+        std::lock_guard<std::mutex> lock (idle_mutex_);
+        stop_.store (true);
+        work_cv_.notify_all ();
+    }
+    for (size_t i = 0; i < workers_.size (); ++i) {
+        if (workers_[i]->thread.joinable ())
+            workers_[i]->thread.join ();
+    }
+    // only now, as the workers steal from each other until they exit
+    for (size_t i = 0; i < workers_.size (); ++i) {
+        delete workers_[i];
+    }
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int AppLibExecutor::currentWorker ()
+{
+    return tls_worker_;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLibExecutor::submit (Task task, Priority priority)
+{
+    if (!accepting_.load (std::memory_order_acquire)) {
+        rejected_.fetch_add (1, std::memory_order_relaxed);
+        return false;
+    }
+    if ((priority < HighPriority) || (priority >= PriorityCount))
+        priority = NormalPriority;
+
+    int index;
+    if (tls_executor_ == this) {
+        index = tls_worker_;
+    } else {
+        index = static_cast<int>(
+                    next_.fetch_add (1, std::memory_order_relaxed) %
+                    workers_.size ());
+    }
+
+    Worker * w = workers_[index];
+    {
+        std::lock_guard<std::mutex> lock (w->mutex);
+        w->tasks[priority].push_back (task);
+    }
+    queued_.fetch_add (1);
+    submitted_[priority].fetch_add (1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock (idle_mutex_);
+    work_cv_.notify_one ();
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLibExecutor::takeTask (int self, Task & task, bool & b_stolen)
+{
+    size_t count = workers_.size ();
+    for (int p = 0; p < PriorityCount; ++p) {
+        {
+            Worker * w = workers_[self];
+            std::lock_guard<std::mutex> lock (w->mutex);
+            if (!w->tasks[p].empty ()) {
+                task = w->tasks[p].back ();
+                w->tasks[p].pop_back ();
+                b_stolen = false;
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < count; ++i) {
+            Worker * victim = workers_[(self + i) % count];
+            std::lock_guard<std::mutex> lock (victim->mutex);
+            if (!victim->tasks[p].empty ()) {
+                task = victim->tasks[p].front ();
+                victim->tasks[p].pop_front ();
+                b_stolen = true;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibExecutor::workerLoop (int index)
+{
+    tls_executor_ = this;
+    tls_worker_ = index;
+
+    Worker * self = workers_[index];
+    Task task;
+    bool b_stolen = false;
+    for (;;) {
+        // running_ goes up before queued_ goes down so that
+        // waitIdle() never sees both at zero while a task is in flight
+        running_.fetch_add (1);
+        if (takeTask (index, task, b_stolen)) {
+            queued_.fetch_sub (1);
+            const qint64 start_ns = AppLibProfiler::nowNs ();
+            task ();
+            task = Task ();
+            self->busy_ns.fetch_add (AppLibProfiler::nowNs () - start_ns,
+                                     std::memory_order_relaxed);
+            self->completed.fetch_add (1, std::memory_order_relaxed);
+            if (b_stolen)
+                self->stolen.fetch_add (1, std::memory_order_relaxed);
+            if (running_.fetch_sub (1) == 1) {
+                std::lock_guard<std::mutex> lock (idle_mutex_);
+                idle_cv_.notify_all ();
+            }
+            continue;
+        }
+        running_.fetch_sub (1);
+
+        std::unique_lock<std::mutex> lock (idle_mutex_);
+        if (queued_.load () == 0) {
+            idle_cv_.notify_all ();
+            if (stop_.load ())
+                break;
+            work_cv_.wait (lock);
+        }
+    }
+
+    tls_executor_ = NULL;
+    tls_worker_ = -1;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Must not be called from one of the workers of this executor.
+ */
+void AppLibExecutor::waitIdle ()
+{
+    std::unique_lock<std::mutex> lock (idle_mutex_);
+    while ((queued_.load () != 0) || (running_.load () != 0)) {
+        idle_cv_.wait (lock);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The pool stops accepting tasks. If the queued and running tasks do
+ * not end before the deadline, the ones that did not start are
+ * discarded (and counted as dropped); the running ones can't be
+ * interrupted, so the destructor still waits for them.
+ *
+ * Must not be called from one of the workers of this executor.
+ *
+ * @param deadline_ms how long to wait; negative means forever
+ * @return true if all the work ended in time
+ */
+bool AppLibExecutor::drain (int deadline_ms)
+{
+    setAccepting (false);
+    {
+        std::unique_lock<std::mutex> lock (idle_mutex_);
+        std::function<bool ()> idle = [this] () {
+            return (queued_.load () == 0) && (running_.load () == 0);
+        };
+        if (deadline_ms < 0) {
+            idle_cv_.wait (lock, idle);
+            return true;
+        }
+        if (idle_cv_.wait_for (lock, std::chrono::milliseconds (deadline_ms),
+                               idle))
+            return true;
+    }
+
+    int dropped = 0;
+    for (size_t i = 0; i < workers_.size (); ++i) {
+        Worker * w = workers_[i];
+        std::lock_guard<std::mutex> lock (w->mutex);
+        for (int p = 0; p < PriorityCount; ++p) {
+            dropped += static_cast<int>(w->tasks[p].size ());
+            w->tasks[p].clear ();
+        }
+    }
+    if (dropped > 0) {
+        queued_.fetch_sub (dropped);
+        dropped_.fetch_add (static_cast<quint64>(dropped),
+                            std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock (idle_mutex_);
+        idle_cv_.notify_all ();
+    }
+    APPLIB_DEBUGM("Executor drain missed the %d ms deadline; "
+                  "%d tasks dropped, %d running\n",
+                  deadline_ms, dropped, running_.load ());
+    return false;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Only supported on Linux; elsewhere the function returns false and
+ * the scheduler places the workers.
+ *
+ * @param cpus the processors to use; empty removes the restriction
+ */
+bool AppLibExecutor::setAffinity (const std::vector<int> & cpus)
+{
+#if defined(__linux__)
+    bool b_ok = true;
+    for (size_t i = 0; i < workers_.size (); ++i) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (cpus.empty ()) {
+            const int all = static_cast<int>(
+                        std::thread::hardware_concurrency ());
+            for (int c = 0; c < all; ++c)
+                CPU_SET(c, &set);
+        } else {
+            CPU_SET(cpus[i % cpus.size ()], &set);
+        }
+        if (pthread_setaffinity_np (workers_[i]->thread.native_handle (),
+                                    sizeof(set), &set) != 0)
+            b_ok = false;
+    }
+    return b_ok;
+#else
+    VAR_UNUSED(cpus);
+    return false;
+#endif
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibExecutor::Stats AppLibExecutor::stats () const
+{
+    Stats result;
+    result.workers = static_cast<int>(workers_.size ());
+    result.queued = queued_.load ();
+    result.running = running_.load ();
+    for (int p = 0; p < PriorityCount; ++p)
+        result.submitted[p] = submitted_[p].load (std::memory_order_relaxed);
+    result.completed = 0;
+    result.stolen = 0;
+    result.busy_ns = 0;
+    for (size_t i = 0; i < workers_.size (); ++i) {
+        const Worker * w = workers_[i];
+        result.completed += w->completed.load (std::memory_order_relaxed);
+        result.stolen += w->stolen.load (std::memory_order_relaxed);
+        result.busy_ns += w->busy_ns.load (std::memory_order_relaxed);
+    }
+    result.rejected = rejected_.load (std::memory_order_relaxed);
+    result.dropped = dropped_.load (std::memory_order_relaxed);
+    result.uptime_ns = AppLibProfiler::nowNs () - created_ns_;
+    return result;
+}
+/* ========================================================================= */
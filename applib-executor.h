@@ -0,0 +1,160 @@
+/**
+ * @file applib-executor.h
+ * @brief Declarations for AppLibExecutor class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_APPLIB_EXECUTOR_H_INCLUDE
+#define GUARD_APPLIB_EXECUTOR_H_INCLUDE
+
+#include <applib/applib-config.h>
+#include <QtGlobal>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//! A pool of threads with one task queue per thread and work stealing.
+class APPLIB_EXPORT AppLibExecutor {
+
+public:
+
+    //! The type of the work items.
+    typedef std::function<void ()> Task;
+
+    //! The lanes of the queues; a worker takes from the first lane with work.
+    enum Priority {
+        HighPriority = 0, /**< latency sensitive */
+        NormalPriority, /**< the default */
+        BackgroundPriority, /**< runs when nothing else is waiting */
+
+        PriorityCount
+    };
+
+    //! How the pool was used since it was created.
+    struct Stats {
+        int workers; /**< number of worker threads */
+        int queued; /**< tasks waiting now */
+        int running; /**< tasks being executed now */
+        quint64 submitted[PriorityCount]; /**< accepted, by priority */
+        quint64 completed; /**< tasks that ended */
+        quint64 stolen; /**< tasks taken from another worker */
+        quint64 rejected; /**< submitted while not accepting */
+        quint64 dropped; /**< discarded by drain() */
+        qint64 busy_ns; /**< time spent in tasks, all workers */
+        qint64 uptime_ns; /**< since the pool was created */
+
+        //! Fraction of the capacity of the pool that was used (0 to 1).
+        double
+        utilisation () const {
+            return (uptime_ns <= 0) || (workers <= 0) ? 0.0 :
+                static_cast<double>(busy_ns) /
+                        (static_cast<double>(uptime_ns) * workers);
+        }
+    };
+
+    //! Constructor; zero workers means one per hardware thread.
+    explicit AppLibExecutor (
+            int workers = 0);
+
+    //! Destructor; runs the tasks already queued, then stops the workers.
+    ~AppLibExecutor ();
+
+    //! Queue a task; false if the pool does not accept work.
+    bool
+    submit (
+            Task task,
+            Priority priority = NormalPriority);
+
+    //! Accept new tasks or reject them.
+    void
+    setAccepting (
+            bool b_accept) {
+        accepting_.store (b_accept, std::memory_order_release);
+    }
+
+    //! Are new tasks accepted?
+    bool
+    isAccepting () const {
+        return accepting_.load (std::memory_order_acquire);
+    }
+
+    //! Stop accepting work and wait for the queued tasks, up to a deadline.
+    bool
+    drain (
+            int deadline_ms);
+
+    //! Pin the workers to processors (worker i to cpus[i % size]).
+    bool
+    setAffinity (
+            const std::vector<int> & cpus);
+
+    //! How the pool was used.
+    Stats
+    stats () const;
+
+    //! Block until no task is queued or running.
+    void
+    waitIdle ();
+
+    //! Number of worker threads.
+    int
+    workerCount () const {
+        return static_cast<int>(workers_.size ());
+    }
+
+    //! Index of the calling worker in its executor; -1 for other threads.
+    static int
+    currentWorker ();
+
+private:
+
+    //! A worker thread and its queues.
+    struct Worker {
+        std::mutex mutex; /**< protects tasks */
+        std::deque<Task> tasks[PriorityCount]; /**< one per lane */
+        std::thread thread; /**< the thread itself */
+        std::atomic<quint64> completed; /**< tasks run by this worker */
+        std::atomic<quint64> stolen; /**< of them, taken from others */
+        std::atomic<qint64> busy_ns; /**< time spent in tasks */
+    };
+
+    //! Worker thread entry point.
+    void
+    workerLoop (
+            int index);
+
+    //! Take a task from own queue or steal one from the others.
+    bool
+    takeTask (
+            int self,
+            Task & task,
+            bool & b_stolen);
+
+    AppLibExecutor (const AppLibExecutor &);
+    AppLibExecutor& operator=( const AppLibExecutor& );
+
+private:
+    std::vector<Worker*> workers_; /**< the workers */
+    std::atomic<int> queued_; /**< tasks waiting in queues */
+    std::atomic<int> running_; /**< tasks being executed */
+    std::atomic<unsigned> next_; /**< round-robin for external submits */
+    std::atomic<bool> stop_; /**< ask the workers to exit */
+    std::atomic<bool> accepting_; /**< does submit() take tasks */
+    std::atomic<quint64> submitted_[PriorityCount]; /**< accepted tasks */
+    std::atomic<quint64> rejected_; /**< refused tasks */
+    std::atomic<quint64> dropped_; /**< discarded by drain() */
+    qint64 created_ns_; /**< when the pool was created */
+    std::mutex idle_mutex_; /**< protects the condition variables */
+    std::condition_variable work_cv_; /**< wakes the workers */
+    std::condition_variable idle_cv_; /**< wakes waitIdle() */
+};
+
+#endif // GUARD_APPLIB_EXECUTOR_H_INCLUDE
@@ -0,0 +1,254 @@
+/**
+ * @file applib-flightrec.cc
+ * @brief Definitions for AppLibFlightRecorder class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include "applib-flightrec.h"
+#include "applib-binlog.h"
+#include "applib-profiler.h"
+#include "applib-clock.h"
+#include "applib-private.h"
+
+#include <signal.h>
+#include <string.h>
+
+#if defined(Q_OS_UNIX)
+#   include <sys/mman.h>
+#elif defined(Q_OS_WIN)
+#   include <windows.h>
+#endif
+
+//! the recorder synced by the signal handlers
+static std::atomic<AppLibFlightRecorder *> crash_recorder_ (NULL);
+
+//! the signals that are caught
+static const int crash_signals_[] = {
+    SIGSEGV, SIGABRT, SIGFPE, SIGILL
+#if defined(Q_OS_UNIX)
+    , SIGBUS
+#endif
+};
+
+/* ------------------------------------------------------------------------- */
+//! The position of the next record, kept in the mapping itself.
+static inline std::atomic<quint64> * nextCounter (AppLibFlightHeader * header)
+{
+    return reinterpret_cast<std::atomic<quint64> *>(&header->next);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static inline std::atomic<quint64> * recordSeq (AppLibFlightRecord * rec)
+{
+    return reinterpret_cast<std::atomic<quint64> *>(&rec->seq);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static void crashHandler (int sig)
+{
+    AppLibFlightRecorder * recorder = crash_recorder_.load ();
+    if (recorder != NULL)
+        recorder->syncFromSignal ();
+    // the handler was reset to the default one when it was called
+    raise (sig);
+}
+/* ========================================================================= */
+
+/**
+ * @class AppLibFlightRecorder
+ *
+ * The file holds a small header followed by a ring of fixed size
+ * records. A record is claimed by incrementing a counter that lives
+ * in the header, so recording is an atomic increment, a copy of the
+ * text and two stores, and it never blocks. The sequence number in the
+ * record is written last; the decoder uses it to order the records and
+ * to skip the one that was being written when the process died.
+ *
+ * The mapping is shared with the file, so the data reaches the page
+ * cache as it is written and survives the crash of the process;
+ * sync() and the crash handlers also push it to the disk, which
+ * matters if the whole system goes down.
+ *
+ * A recorder should stay open while messages may be recorded; AppLib
+ * keeps its recorder until the process exits.
+ */
+
+/* ------------------------------------------------------------------------- */
+AppLibFlightRecorder::AppLibFlightRecorder () :
+    file_ (),
+    header_ (NULL),
+    records_ (NULL),
+    count_ (0),
+    size_ (0)
+{
+    APPLIB_TRACE_ENTRY;
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibFlightRecorder::~AppLibFlightRecorder ()
+{
+    APPLIB_TRACE_ENTRY;
+    close ();
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param file the path of the file; it is truncated
+ * @param records the number of records kept
+ * @return false if the file could not be created or mapped
+ */
+bool AppLibFlightRecorder::open (const QString & file, int records)
+{
+    close ();
+    count_ = static_cast<quint32>(qMax (16, records));
+    size_ = sizeof(AppLibFlightHeader) + count_ * sizeof(AppLibFlightRecord);
+
+    file_.setFileName (file);
+    if (!file_.open (QIODevice::ReadWrite | QIODevice::Truncate)) {
+        APPLIB_DEBUGM("Unable to create flight recorder %s\n", TMP_A(file));
+        return false;
+    }
+    uchar * data = NULL;
+    if (file_.resize (static_cast<qint64>(size_)))
+        data = file_.map (0, static_cast<qint64>(size_));
+    if (data == NULL) {
+        APPLIB_DEBUGM("Unable to map flight recorder %s\n", TMP_A(file));
+        file_.close ();
+        return false;
+    }
+
+    AppLibFlightHeader * header = reinterpret_cast<AppLibFlightHeader *>(data);
+    memset (header, 0, sizeof(AppLibFlightHeader));
+    memcpy (header->magic, APPLIB_FLIGHTREC_MAGIC, sizeof(header->magic));
+    header->version = APPLIB_FLIGHTREC_VERSION;
+    header->header_size = sizeof(AppLibFlightHeader);
+    header->record_size = sizeof(AppLibFlightRecord);
+    header->record_count = count_;
+    header->start_ns = AppLibClock::coarseNs ();
+    header->start_ms = AppLibClock::toWallNs (header->start_ns) / 1000000;
+    records_ = reinterpret_cast<AppLibFlightRecord *>(header + 1);
+    header_.store (header, std::memory_order_release);
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibFlightRecorder::close ()
+{
+    AppLibFlightHeader * header = header_.exchange (NULL);
+    if (header == NULL)
+        return;
+    AppLibFlightRecorder * self = this;
+    crash_recorder_.compare_exchange_strong (self, NULL);
+    file_.unmap (reinterpret_cast<uchar *>(header));
+    file_.close ();
+    records_ = NULL;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibFlightRecorder::record (
+        Kind kind, int type, int from, int to, const QString * text)
+{
+    AppLibFlightHeader * header = header_.load (std::memory_order_acquire);
+    if (header == NULL)
+        return;
+
+    const quint64 seq = nextCounter (header)->fetch_add (
+                1, std::memory_order_relaxed);
+    AppLibFlightRecord * rec = &records_[seq % count_];
+    recordSeq (rec)->store (0, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+
+    rec->time_ns = AppLibClock::coarseNs () - header->start_ns;
+    rec->thread = static_cast<quint32>(AppLibProfiler::currentThread ());
+    rec->kind = static_cast<quint16>(kind);
+    rec->type = static_cast<quint16>(type);
+    rec->from = from;
+    rec->to = to;
+    rec->reserved = 0;
+    if (text == NULL) {
+        rec->length = 0;
+    } else {
+        rec->length = AppLibBinLog::toUtf8 (
+                    text->constData (), text->size (),
+                    reinterpret_cast<uchar *>(rec->text), sizeof(rec->text));
+    }
+    recordSeq (rec)->store (seq + 1, std::memory_order_release);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibFlightRecorder::message (QtMsgType type, const QString & msg)
+{
+    record (MessageRecord, type, 0, 0, &msg);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibFlightRecorder::transition (int from, int to)
+{
+    record (TransitionRecord, 0, from, to, NULL);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibFlightRecorder::breadcrumb (const QString & text)
+{
+    record (BreadcrumbRecord, 0, 0, 0, &text);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibFlightRecorder::sync ()
+{
+    syncFromSignal ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibFlightRecorder::syncFromSignal ()
+{
+    AppLibFlightHeader * header = header_.load (std::memory_order_acquire);
+    if (header == NULL)
+        return;
+#if defined(Q_OS_UNIX)
+    msync (header, size_, MS_SYNC);
+#elif defined(Q_OS_WIN)
+    FlushViewOfFile (header, size_);
+#endif
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The handlers sync the recorder and then let the signal take its
+ * default action, so core dumps and exit codes are not affected.
+ * Handlers that were installed before are replaced.
+ */
+void AppLibFlightRecorder::installCrashHandlers ()
+{
+    crash_recorder_.store (this);
+    for (unsigned i = 0; i < sizeof(crash_signals_) / sizeof(crash_signals_[0]); ++i) {
+#if defined(Q_OS_UNIX)
+        struct sigaction action;
+        memset (&action, 0, sizeof(action));
+        action.sa_handler = crashHandler;
+        sigemptyset (&action.sa_mask);
+        action.sa_flags = SA_RESETHAND;
+        sigaction (crash_signals_[i], &action, NULL);
+#else
+        signal (crash_signals_[i], crashHandler);
+#endif
+    }
+}
+/* ========================================================================= */
@@ -0,0 +1,138 @@
+/**
+ * @file applib-flightrec.h
+ * @brief Declarations for AppLibFlightRecorder class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_APPLIB_FLIGHTREC_H_INCLUDE
+#define GUARD_APPLIB_FLIGHTREC_H_INCLUDE
+
+#include <applib/applib-config.h>
+#include <QString>
+#include <QFile>
+#include <QtGlobal>
+
+#include <atomic>
+
+//! Magic bytes at the start of a flight recorder file.
+#define APPLIB_FLIGHTREC_MAGIC "APFLREC1"
+
+//! Version of the flight recorder format.
+#define APPLIB_FLIGHTREC_VERSION 1
+
+//! The header at the start of a flight recorder file (64 bytes).
+struct AppLibFlightHeader {
+    char magic[8]; /**< APPLIB_FLIGHTREC_MAGIC, without the terminator */
+    quint32 version; /**< APPLIB_FLIGHTREC_VERSION */
+    quint32 header_size; /**< sizeof(AppLibFlightHeader) */
+    quint32 record_size; /**< sizeof(AppLibFlightRecord) */
+    quint32 record_count; /**< number of records in the ring */
+    qint64 start_ns; /**< monotonic time the record times are relative to */
+    qint64 start_ms; /**< wall clock at start_ns, ms since the epoch */
+    quint64 next; /**< sequence number of the next record */
+    quint64 reserved[2]; /**< zero */
+};
+
+//! One record in the ring (256 bytes).
+struct AppLibFlightRecord {
+    quint64 seq; /**< sequence number + 1 once complete; 0 if not */
+    qint64 time_ns; /**< nanoseconds since AppLibFlightHeader::start_ns */
+    quint32 thread; /**< small integer identifying the thread */
+    quint16 kind; /**< AppLibFlightRecorder::Kind */
+    quint16 type; /**< QtMsgType for messages */
+    qint32 from; /**< previous state for transitions */
+    qint32 to; /**< new state for transitions */
+    quint32 length; /**< bytes of UTF-8 text */
+    quint32 reserved; /**< zero */
+    char text[216]; /**< the text, truncated to fit */
+};
+
+//! Ring of recent events in a memory-mapped file that survives a crash.
+class APPLIB_EXPORT AppLibFlightRecorder {
+
+public:
+
+    //! The kinds of records.
+    enum Kind {
+        MessageRecord = 1, /**< a message from Qt */
+        TransitionRecord = 2, /**< a change of the state of the library */
+        BreadcrumbRecord = 3 /**< a note left by the application */
+    };
+
+    //! Default constructor.
+    AppLibFlightRecorder ();
+
+    //! Destructor; the file is left in place.
+    ~AppLibFlightRecorder ();
+
+    //! Create (or truncate) the file and map it.
+    bool
+    open (
+            const QString & file,
+            int records = 4096);
+
+    //! Release the file.
+    void
+    close ();
+
+    //! Is there a file being written?
+    bool
+    isOpen () const {
+        return header_.load (std::memory_order_acquire) != NULL;
+    }
+
+    //! Record a message from Qt.
+    void
+    message (
+            QtMsgType type,
+            const QString & msg);
+
+    //! Record a change of state.
+    void
+    transition (
+            int from,
+            int to);
+
+    //! Record a note from the application.
+    void
+    breadcrumb (
+            const QString & text);
+
+    //! Ask the system to write the mapped pages to the disk.
+    void
+    sync ();
+
+    //! Write the mapped pages from a signal handler (async-signal-safe).
+    void
+    syncFromSignal ();
+
+    //! Sync this recorder when the process receives a fatal signal.
+    void
+    installCrashHandlers ();
+
+private:
+
+    //! Claim the next record, fill the common part and the text.
+    void
+    record (
+            Kind kind,
+            int type,
+            int from,
+            int to,
+            const QString * text);
+
+    AppLibFlightRecorder (const AppLibFlightRecorder &);
+    AppLibFlightRecorder& operator=( const AppLibFlightRecorder& );
+
+private:
+    QFile file_; /**< the file */
+    std::atomic<AppLibFlightHeader *> header_; /**< the mapping; NULL if closed */
+    AppLibFlightRecord * records_; /**< the ring, right after the header */
+    quint32 count_; /**< number of records in the ring */
+    size_t size_; /**< bytes in the mapping */
+};
+
+#endif // GUARD_APPLIB_FLIGHTREC_H_INCLUDE
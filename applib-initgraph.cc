@@ -0,0 +1,327 @@
+/**
+ * @file applib-initgraph.cc
+ * @brief Definitions for AppLibInitGraph class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include "applib-initgraph.h"
+#include "applib-executor.h"
+#include "applib-profiler.h"
+#include "applib-private.h"
+
+#include <QCoreApplication>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+/**
+ * @class AppLibInitGraph
+ *
+ * Tasks are added with a unique name, the names of the tasks that must
+ * succeed before them and an affinity. run() starts every task whose
+ * dependencies are satisfied: tasks that may run anywhere go to the
+ * executor, tasks bound to the main thread are run by the thread that
+ * called run(), which otherwise waits for the graph to complete.
+ *
+ * When a task fails no new task is started; the ones in flight are
+ * allowed to finish and the rest are marked as Skipped.
+ */
+
+//! Book-keeping for one call to AppLibInitGraph::run().
+struct InitGraphRun {
+    std::mutex mutex; /**< protects everything here and the task infos */
+    std::condition_variable cv; /**< wakes the main thread */
+    std::deque<int> main_ready; /**< tasks waiting for the main thread */
+    std::vector<int> remaining; /**< unfinished dependencies per task */
+    std::vector< std::vector<int> > dependents; /**< reverse edges */
+    int outstanding; /**< tasks scheduled but not finished */
+    bool failed; /**< a task has failed */
+    QString first_error; /**< the message of the first failure */
+};
+
+/* ------------------------------------------------------------------------- */
+AppLibInitGraph::AppLibInitGraph ()
+{
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibInitGraph::~AppLibInitGraph ()
+{
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Dependencies may name tasks that are added later; they are only
+ * resolved when the graph is run.
+ *
+ * @param name unique name of the task
+ * @param depends_on names of the tasks that must succeed first
+ * @param affinity where may the task run
+ * @param fn the work
+ * @return false if the name is already in use
+ */
+bool AppLibInitGraph::addTask (
+        const QString & name, const QStringList & depends_on,
+        Affinity affinity, Function fn)
+{
+    for (size_t i = 0; i < tasks_.size (); ++i) {
+        if (tasks_[i].name == name) {
+            APPLIB_DEBUGM("Init task %s already exists\n", TMP_A(name));
+            return false;
+        }
+    }
+
+    TaskInfo info;
+    info.name = name;
+    info.depends_on = depends_on;
+    info.affinity = affinity;
+    info.status = Pending;
+    info.duration_ns = 0;
+    tasks_.push_back (info);
+    functions_.push_back (fn);
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLibInitGraph::hasPending () const
+{
+    for (size_t i = 0; i < tasks_.size (); ++i) {
+        if (tasks_[i].status == Pending)
+            return true;
+    }
+    return false;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+QList<AppLibInitGraph::TaskInfo> AppLibInitGraph::tasks () const
+{
+    QList<TaskInfo> result;
+    for (size_t i = 0; i < tasks_.size (); ++i) {
+        result.append (tasks_[i]);
+    }
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibInitGraph::clear ()
+{
+    tasks_.clear ();
+    functions_.clear ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int findTask (const std::vector<AppLibInitGraph::TaskInfo> & tasks,
+                     const QString & name)
+{
+    for (size_t i = 0; i < tasks.size (); ++i) {
+        if (tasks[i].name == name)
+            return static_cast<int>(i);
+    }
+    return -1;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLibInitGraph::validate (QString * error) const
+{
+    int count = static_cast<int>(tasks_.size ());
+    std::vector<int> in_degree (count, 0);
+    std::vector< std::vector<int> > dependents (count);
+    for (int i = 0; i < count; ++i) {
+        const TaskInfo & info = tasks_[i];
+        for (int d = 0; d < info.depends_on.count (); ++d) {
+            int dep = findTask (tasks_, info.depends_on.at (d));
+            if (dep == -1) {
+                if (error != NULL) {
+                    *error = QCoreApplication::translate (
+                                "AppLib", "Init task %1 depends on "
+                                "unknown task %2")
+                            .arg (info.name)
+                            .arg (info.depends_on.at (d));
+                }
+                return false;
+            }
+            dependents[dep].push_back (i);
+            ++in_degree[i];
+        }
+    }
+
+    // Kahn's algorithm; whatever is not reached is part of a cycle
+    std::vector<int> ready;
+    for (int i = 0; i < count; ++i) {
+        if (in_degree[i] == 0)
+            ready.push_back (i);
+    }
+    int visited = 0;
+    while (!ready.empty ()) {
+        int i = ready.back ();
+        ready.pop_back ();
+        ++visited;
+        for (size_t k = 0; k < dependents[i].size (); ++k) {
+            if (--in_degree[dependents[i][k]] == 0)
+                ready.push_back (dependents[i][k]);
+        }
+    }
+    if (visited != count) {
+        if (error != NULL) {
+            QStringList cycle;
+            for (int i = 0; i < count; ++i) {
+                if (in_degree[i] != 0)
+                    cycle.append (tasks_[i].name);
+            }
+            *error = QCoreApplication::translate (
+                        "AppLib", "Init tasks have circular dependencies: %1")
+                    .arg (cycle.join (QLatin1String (", ")));
+        }
+        return false;
+    }
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Only the tasks that are still Pending are run; dependencies on tasks
+ * that succeeded in a previous run are considered satisfied.
+ *
+ * Without an executor all the tasks run on the calling thread,
+ * in dependency order.
+ *
+ * @param executor where the AnyThread tasks are run (may be NULL)
+ * @param profiler records a span for each task (may be NULL)
+ * @param error receives the message of the first failure
+ * @return true if all tasks succeeded
+ */
+bool AppLibInitGraph::run (
+        AppLibExecutor * executor, AppLibProfiler * profiler, QString * error)
+{
+    if (!validate (error))
+        return false;
+
+    int count = static_cast<int>(tasks_.size ());
+    InitGraphRun st;
+    st.remaining.assign (count, 0);
+    st.dependents.resize (count);
+    st.outstanding = 0;
+    st.failed = false;
+
+    for (int i = 0; i < count; ++i) {
+        TaskInfo & info = tasks_[i];
+        if (info.status != Pending)
+            continue;
+        for (int d = 0; d < info.depends_on.count (); ++d) {
+            int dep = findTask (tasks_, info.depends_on.at (d));
+            switch (tasks_[dep].status) {
+            case Succeeded:
+                break;
+            case Pending:
+                st.dependents[dep].push_back (i);
+                ++st.remaining[i];
+                break;
+            default:
+                info.status = Skipped;
+            }
+        }
+    }
+
+    // runs the task on the calling thread and schedules its dependents
+    std::function<void (int)> execute;
+    std::function<void (int)> schedule = [&] (int i) {
+        ++st.outstanding;
+        if ((executor == NULL) || (tasks_[i].affinity == MainThread) ||
+                !executor->submit ([&execute, i] () { execute (i); })) {
+            st.main_ready.push_back (i);
+            st.cv.notify_all ();
+        }
+    };
+    execute = [&] (int i) {
+        {
+            // tasks already queued on the executor when another one failed
+            std::lock_guard<std::mutex> lock (st.mutex);
+            if (st.failed) {
+                tasks_[i].status = Skipped;
+                --st.outstanding;
+                st.cv.notify_all ();
+                return;
+            }
+        }
+        QString task_error;
+        bool b_ok;
+        qint64 start = AppLibProfiler::nowNs ();
+        {
+            AppLibPhase phase (profiler, tasks_[i].name);
+            b_ok = functions_[i] (task_error);
+        }
+        qint64 duration = AppLibProfiler::nowNs () - start;
+
+        std::lock_guard<std::mutex> lock (st.mutex);
+        TaskInfo & info = tasks_[i];
+        info.duration_ns = duration;
+        info.error = task_error;
+        info.status = (b_ok ? Succeeded : Failed);
+        APPLIB_DEBUGM("Init task %s %s in %lld ns\n", TMP_A(info.name),
+                      b_ok ? "succeeded" : "failed",
+                      static_cast<long long>(duration));
+        if (!b_ok && !st.failed) {
+            st.failed = true;
+            st.first_error = QCoreApplication::translate (
+                        "AppLib", "Init task %1 failed: %2")
+                    .arg (info.name)
+                    .arg (task_error);
+        }
+        if (!st.failed) {
+            const std::vector<int> & next = st.dependents[i];
+            for (size_t k = 0; k < next.size (); ++k) {
+                if (--st.remaining[next[k]] == 0)
+                    schedule (next[k]);
+            }
+        }
+        --st.outstanding;
+        st.cv.notify_all ();
+    };
+
+    std::unique_lock<std::mutex> lock (st.mutex);
+    for (int i = 0; i < count; ++i) {
+        if ((tasks_[i].status == Pending) && (st.remaining[i] == 0))
+            schedule (i);
+    }
+    while (st.outstanding > 0) {
+        if (!st.main_ready.empty ()) {
+            int i = st.main_ready.front ();
+            st.main_ready.pop_front ();
+            if (st.failed) {
+                --st.outstanding;
+                continue;
+            }
+            lock.unlock ();
+            execute (i);
+            lock.lock ();
+            continue;
+        }
+        st.cv.wait (lock);
+    }
+
+    bool b_ret = !st.failed;
+    for (int i = 0; i < count; ++i) {
+        if (tasks_[i].status == Pending) {
+            tasks_[i].status = Skipped;
+        } else if (tasks_[i].status == Skipped) {
+            b_ret = false;
+        }
+    }
+    if ((error != NULL) && st.failed)
+        *error = st.first_error;
+    return b_ret;
+}
+/* ========================================================================= */
@@ -0,0 +1,104 @@
+/**
+ * @file applib-initgraph.h
+ * @brief Declarations for AppLibInitGraph class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_APPLIB_INITGRAPH_H_INCLUDE
+#define GUARD_APPLIB_INITGRAPH_H_INCLUDE
+
+#include <applib/applib-config.h>
+#include <QString>
+#include <QStringList>
+#include <QList>
+
+#include <functional>
+#include <vector>
+
+class AppLibExecutor;
+class AppLibProfiler;
+
+//! A set of named initialization tasks with dependencies between them.
+class APPLIB_EXPORT AppLibInitGraph {
+
+public:
+
+    //! Where a task may run.
+    enum Affinity {
+        MainThread, /**< the thread that runs the graph */
+        AnyThread /**< main thread or one of the workers */
+    };
+
+    //! The state of a task.
+    enum Status {
+        Pending, /**< not started yet */
+        Succeeded, /**< the function returned true */
+        Failed, /**< the function returned false */
+        Skipped /**< not started because something else failed */
+    };
+
+    //! The work; return false and (optionally) set the error to fail.
+    typedef std::function<bool (QString & error)> Function;
+
+    //! Information about a task.
+    struct TaskInfo {
+        QString name; /**< the unique name of the task */
+        QStringList depends_on; /**< tasks that must succeed first */
+        Affinity affinity; /**< where it may run */
+        Status status; /**< the outcome */
+        QString error; /**< message set by a failed task */
+        qint64 duration_ns; /**< how long the function took */
+    };
+
+    //! Default constructor.
+    AppLibInitGraph ();
+
+    //! Destructor.
+    ~AppLibInitGraph ();
+
+    //! Add a task; fails if the name is already in use.
+    bool
+    addTask (
+            const QString & name,
+            const QStringList & depends_on,
+            Affinity affinity,
+            Function fn);
+
+    //! Run all the tasks; returns false if any of them failed.
+    bool
+    run (
+            AppLibExecutor * executor,
+            AppLibProfiler * profiler,
+            QString * error = NULL);
+
+    //! Is there any task that was not run yet?
+    bool
+    hasPending () const;
+
+    //! Information about the tasks, in the order they were added.
+    QList<TaskInfo>
+    tasks () const;
+
+    //! Remove all tasks.
+    void
+    clear ();
+
+private:
+
+    //! Check that dependencies exist and that there are no cycles.
+    bool
+    validate (
+            QString * error) const;
+
+    AppLibInitGraph (const AppLibInitGraph &);
+    AppLibInitGraph& operator=( const AppLibInitGraph& );
+
+private:
+    std::vector<TaskInfo> tasks_; /**< the tasks */
+    std::vector<Function> functions_; /**< the work, same index as tasks_ */
+};
+
+#endif // GUARD_APPLIB_INITGRAPH_H_INCLUDE
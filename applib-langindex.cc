@@ -0,0 +1,480 @@
+/**
+ * @file applib-langindex.cc
+ * @brief Definitions for AppLibLangIndex class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include "applib-langindex.h"
+#include "applib-private.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QSaveFile>
+#include <QByteArray>
+
+#include <string.h>
+#include <vector>
+
+/**
+ * @class AppLibLangIndex
+ *
+ * Each translation root contains one directory per language with the
+ * compiled translation (.qm), metadata.ini and icon.png. Instead of
+ * scanning this tree on every start the index records, for each language,
+ * its name, directory and .qm file in a compact file that is mapped in
+ * memory with a single call. Names are found through an open addressing
+ * hash table stored in the same file.
+ *
+ * The index is keyed by APPLIB_VERSION, the list of roots and the
+ * modification times of the roots and of the language directories;
+ * when any of them differs the tree is scanned and the file rewritten.
+ */
+
+//! identifies the file format
+#define LANGINDEX_MAGIC "APLANGX1"
+
+//! The header of the index file.
+struct LangIndexHeader {
+    char magic[8]; /**< LANGINDEX_MAGIC */
+    quint32 version; /**< APPLIB_VERSION of the writer */
+    quint32 root_count; /**< number of roots */
+    quint32 lang_count; /**< number of languages */
+    quint32 table_size; /**< slots in the hash table (power of two) */
+};
+
+//! A directory and its modification time.
+struct LangIndexStamp {
+    quint32 path_offset; /**< UTF-8 path in the string area */
+    quint32 path_length; /**< length of the path in bytes */
+    qint64 mtime; /**< modification time, ms since epoch */
+};
+
+//! One language.
+struct LangIndexEntry {
+    quint32 name_offset; /**< UTF-8 name in the string area */
+    quint32 name_length; /**< length of the name */
+    quint32 qm_offset; /**< UTF-8 path of the .qm file */
+    quint32 qm_length; /**< length of the path */
+    LangIndexStamp dir; /**< the directory of the language */
+};
+
+// file layout:
+//   LangIndexHeader
+//   LangIndexStamp [root_count]
+//   LangIndexEntry [lang_count]
+//   quint32 table [table_size]   (entry index + 1, 0 for empty slots)
+//   strings
+
+/* ------------------------------------------------------------------------- */
+static quint32 nameHash (const QByteArray & name)
+{
+    // FNV-1a on the lower case name
+    quint32 hash = 2166136261u;
+    for (int i = 0; i < name.size (); ++i) {
+        char c = name.at (i);
+        if ((c >= 'A') && (c <= 'Z'))
+            c = c - 'A' + 'a';
+        hash = (hash ^ static_cast<uchar>(c)) * 16777619u;
+    }
+    return hash;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static bool sameName (const char * stored, quint32 len, const QByteArray & name)
+{
+    if (static_cast<int>(len) != name.size ())
+        return false;
+    for (quint32 i = 0; i < len; ++i) {
+        char a = stored[i];
+        char b = name.at (i);
+        if ((a >= 'A') && (a <= 'Z'))
+            a = a - 'A' + 'a';
+        if ((b >= 'A') && (b <= 'Z'))
+            b = b - 'A' + 'a';
+        if (a != b)
+            return false;
+    }
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static qint64 dirTime (const QString & path)
+{
+    QFileInfo fi (path);
+    if (!fi.exists ())
+        return -1;
+    return fi.lastModified ().toMSecsSinceEpoch ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibLangIndex::AppLibLangIndex () :
+    file_ (),
+    data_ (NULL),
+    size_ (0),
+    roots_ (),
+    rebuilt_ (false)
+{
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibLangIndex::~AppLibLangIndex ()
+{
+    close ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibLangIndex::close ()
+{
+    if (data_ != NULL) {
+        file_.unmap (const_cast<uchar *>(data_));
+        data_ = NULL;
+        size_ = 0;
+    }
+    if (file_.isOpen ())
+        file_.close ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLibLangIndex::map (const QString & index_file)
+{
+    close ();
+    file_.setFileName (index_file);
+    if (!file_.open (QIODevice::ReadOnly))
+        return false;
+    size_ = file_.size ();
+    if (size_ < static_cast<qint64>(sizeof(LangIndexHeader))) {
+        file_.close ();
+        return false;
+    }
+    data_ = file_.map (0, size_);
+    if (data_ == NULL) {
+        file_.close ();
+        return false;
+    }
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+QString AppLibLangIndex::string (quint32 offset, quint32 length) const
+{
+    return QString::fromUtf8 (
+                reinterpret_cast<const char *>(data_) + offset, length);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Does the range lie inside a file of this size? Computed without overflow.
+static bool insideFile (quint32 offset, quint32 length, qint64 size)
+{
+    const quint64 limit = static_cast<quint64>(size);
+    return (offset <= limit) && (length <= limit - offset);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Everything that find() and the accessors read is checked here, so a
+ * damaged or hostile index is rebuilt instead of being read past the
+ * end of the mapping.
+ */
+bool AppLibLangIndex::isCurrent () const
+{
+    const LangIndexHeader * hdr =
+            reinterpret_cast<const LangIndexHeader *>(data_);
+    if ((memcmp (hdr->magic, LANGINDEX_MAGIC, 8) != 0) ||
+            (hdr->version != APPLIB_VERSION) ||
+            (hdr->root_count != static_cast<quint32>(roots_.count ())) ||
+            ((hdr->table_size & (hdr->table_size - 1)) != 0) ||
+            (hdr->table_size <= hdr->lang_count))
+        return false;
+
+    quint64 expected = sizeof(LangIndexHeader) +
+            static_cast<quint64>(hdr->root_count) * sizeof(LangIndexStamp) +
+            static_cast<quint64>(hdr->lang_count) * sizeof(LangIndexEntry) +
+            static_cast<quint64>(hdr->table_size) * sizeof(quint32);
+    if (expected > static_cast<quint64>(size_))
+        return false;
+
+    const LangIndexStamp * roots =
+            reinterpret_cast<const LangIndexStamp *>(hdr + 1);
+    for (quint32 i = 0; i < hdr->root_count; ++i) {
+        if (!insideFile (roots[i].path_offset, roots[i].path_length, size_))
+            return false;
+        if (string (roots[i].path_offset, roots[i].path_length) !=
+                roots_.at (i))
+            return false;
+        if (dirTime (roots_.at (i)) != roots[i].mtime)
+            return false;
+    }
+
+    const LangIndexEntry * langs =
+            reinterpret_cast<const LangIndexEntry *>(roots + hdr->root_count);
+    for (quint32 i = 0; i < hdr->lang_count; ++i) {
+        const LangIndexEntry & e = langs[i];
+        if (!insideFile (e.name_offset, e.name_length, size_) ||
+                !insideFile (e.qm_offset, e.qm_length, size_) ||
+                !insideFile (e.dir.path_offset, e.dir.path_length, size_))
+            return false;
+        if (dirTime (string (e.dir.path_offset, e.dir.path_length)) !=
+                e.dir.mtime)
+            return false;
+    }
+
+    // find() indexes langs with these values
+    const quint32 * table =
+            reinterpret_cast<const quint32 *>(langs + hdr->lang_count);
+    for (quint32 i = 0; i < hdr->table_size; ++i) {
+        if (table[i] > hdr->lang_count)
+            return false;
+    }
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The index is used as it is if it was written by this version of the
+ * library for the same roots and none of the directories changed since;
+ * otherwise it is rebuilt.
+ *
+ * @param index_file where the index is stored
+ * @param roots the directories that contain one directory per language
+ * @return true if a valid index is available
+ */
+bool AppLibLangIndex::open (
+        const QString & index_file, const QStringList & roots)
+{
+    rebuilt_ = false;
+    roots_.clear ();
+    for (int i = 0; i < roots.count (); ++i) {
+        roots_.append (QDir (roots.at (i)).absolutePath ());
+    }
+
+    if (map (index_file) && isCurrent ())
+        return true;
+    close ();
+
+    APPLIB_DEBUGM("Rebuilding translation index %s\n", TMP_A(index_file));
+    if (!rebuild (index_file, roots_))
+        return false;
+    rebuilt_ = true;
+    if (map (index_file) && isCurrent ())
+        return true;
+    close ();
+    return false;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLibLangIndex::rebuild (
+        const QString & index_file, const QStringList & roots)
+{
+    QByteArray strings;
+    std::vector<LangIndexStamp> stamps;
+    std::vector<LangIndexEntry> langs;
+    std::vector<QByteArray> names;
+
+    for (int r = 0; r < roots.count (); ++r) {
+        QByteArray path = roots.at (r).toUtf8 ();
+        LangIndexStamp stamp;
+        stamp.path_offset = strings.size ();
+        stamp.path_length = path.size ();
+        stamp.mtime = dirTime (roots.at (r));
+        strings.append (path);
+        stamps.push_back (stamp);
+
+        QDir root (roots.at (r));
+        QFileInfoList dirs = root.entryInfoList (
+                    QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+        for (int d = 0; d < dirs.count (); ++d) {
+            QDir lang_dir (dirs.at (d).absoluteFilePath ());
+            QStringList qms = lang_dir.entryList (
+                        QStringList (QLatin1String ("*.qm")),
+                        QDir::Files, QDir::Name);
+            if (qms.isEmpty ())
+                continue;
+
+            LangIndexEntry e;
+            QByteArray name = dirs.at (d).fileName ().toUtf8 ();
+            QByteArray dir = lang_dir.absolutePath ().toUtf8 ();
+            QByteArray qm = lang_dir.absoluteFilePath (qms.at (0)).toUtf8 ();
+            e.name_offset = strings.size ();
+            e.name_length = name.size ();
+            strings.append (name);
+            e.dir.path_offset = strings.size ();
+            e.dir.path_length = dir.size ();
+            e.dir.mtime = dirTime (lang_dir.absolutePath ());
+            strings.append (dir);
+            e.qm_offset = strings.size ();
+            e.qm_length = qm.size ();
+            strings.append (qm);
+            langs.push_back (e);
+            names.push_back (name);
+        }
+    }
+
+    LangIndexHeader hdr;
+    memcpy (hdr.magic, LANGINDEX_MAGIC, 8);
+    hdr.version = APPLIB_VERSION;
+    hdr.root_count = static_cast<quint32>(stamps.size ());
+    hdr.lang_count = static_cast<quint32>(langs.size ());
+    hdr.table_size = 8;
+    while (hdr.table_size < hdr.lang_count * 2)
+        hdr.table_size <<= 1;
+
+    std::vector<quint32> table (hdr.table_size, 0);
+    quint32 mask = hdr.table_size - 1;
+    for (quint32 i = 0; i < hdr.lang_count; ++i) {
+        quint32 slot = nameHash (names[i]) & mask;
+        while (table[slot] != 0)
+            slot = (slot + 1) & mask;
+        table[slot] = i + 1;
+    }
+
+    // string offsets are relative to the string area; make them absolute
+    quint32 base = sizeof(LangIndexHeader) +
+            hdr.root_count * sizeof(LangIndexStamp) +
+            hdr.lang_count * sizeof(LangIndexEntry) +
+            hdr.table_size * sizeof(quint32);
+    for (size_t i = 0; i < stamps.size (); ++i) {
+        stamps[i].path_offset += base;
+    }
+    for (size_t i = 0; i < langs.size (); ++i) {
+        langs[i].name_offset += base;
+        langs[i].qm_offset += base;
+        langs[i].dir.path_offset += base;
+    }
+
+    QSaveFile out (index_file);
+    if (!out.open (QIODevice::WriteOnly)) {
+        APPLIB_DEBUGM("Cannot write translation index %s\n", TMP_A(index_file));
+        return false;
+    }
+    out.write (reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+    if (!stamps.empty ())
+        out.write (reinterpret_cast<const char *>(&stamps[0]),
+                   stamps.size () * sizeof(LangIndexStamp));
+    if (!langs.empty ())
+        out.write (reinterpret_cast<const char *>(&langs[0]),
+                   langs.size () * sizeof(LangIndexEntry));
+    out.write (reinterpret_cast<const char *>(&table[0]),
+               table.size () * sizeof(quint32));
+    out.write (strings);
+    return out.commit ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int AppLibLangIndex::count () const
+{
+    if (data_ == NULL)
+        return 0;
+    return static_cast<int>(
+                reinterpret_cast<const LangIndexHeader *>(data_)->lang_count);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The comparison is case-insensitive (ASCII).
+ *
+ * @param name the name of the language directory (ro_RO, en, ...)
+ * @return the index of the language or -1
+ */
+int AppLibLangIndex::find (const QString & name) const
+{
+    if (data_ == NULL)
+        return -1;
+    const LangIndexHeader * hdr =
+            reinterpret_cast<const LangIndexHeader *>(data_);
+    const LangIndexStamp * roots =
+            reinterpret_cast<const LangIndexStamp *>(hdr + 1);
+    const LangIndexEntry * langs =
+            reinterpret_cast<const LangIndexEntry *>(roots + hdr->root_count);
+    const quint32 * table =
+            reinterpret_cast<const quint32 *>(langs + hdr->lang_count);
+
+    QByteArray key = name.toUtf8 ();
+    quint32 mask = hdr->table_size - 1;
+    quint32 slot = nameHash (key) & mask;
+    for (quint32 probes = 0;
+         (probes < hdr->table_size) && (table[slot] != 0); ++probes) {
+        const LangIndexEntry & e = langs[table[slot] - 1];
+        if (sameName (reinterpret_cast<const char *>(data_) + e.name_offset,
+                      e.name_length, key))
+            return static_cast<int>(table[slot] - 1);
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param locale a locale name like ro_RO; if there is no such
+ *      language, the language part (ro) is tried
+ * @return the index of the language or -1
+ */
+int AppLibLangIndex::findLocale (const QString & locale) const
+{
+    int result = find (locale);
+    if (result == -1) {
+        int sep = locale.indexOf (QChar ('_'));
+        if (sep > 0)
+            result = find (locale.left (sep));
+    }
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static const LangIndexEntry * entryAt (const uchar * data, int index)
+{
+    if ((data == NULL) || (index < 0))
+        return NULL;
+    const LangIndexHeader * hdr =
+            reinterpret_cast<const LangIndexHeader *>(data);
+    if (index >= static_cast<int>(hdr->lang_count))
+        return NULL;
+    const LangIndexStamp * roots =
+            reinterpret_cast<const LangIndexStamp *>(hdr + 1);
+    return reinterpret_cast<const LangIndexEntry *>(
+                roots + hdr->root_count) + index;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+QString AppLibLangIndex::name (int index) const
+{
+    const LangIndexEntry * e = entryAt (data_, index);
+    return e == NULL ? QString () : string (e->name_offset, e->name_length);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+QString AppLibLangIndex::directory (int index) const
+{
+    const LangIndexEntry * e = entryAt (data_, index);
+    return e == NULL ? QString () :
+                       string (e->dir.path_offset, e->dir.path_length);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+QString AppLibLangIndex::qmFile (int index) const
+{
+    const LangIndexEntry * e = entryAt (data_, index);
+    return e == NULL ? QString () : string (e->qm_offset, e->qm_length);
+}
+/* ========================================================================= */
@@ -0,0 +1,114 @@
+/**
+ * @file applib-langindex.h
+ * @brief Declarations for AppLibLangIndex class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_APPLIB_LANGINDEX_H_INCLUDE
+#define GUARD_APPLIB_LANGINDEX_H_INCLUDE
+
+#include <applib/applib-config.h>
+#include <QString>
+#include <QStringList>
+#include <QFile>
+
+//! On-disk index of the available translations.
+class APPLIB_EXPORT AppLibLangIndex {
+
+public:
+
+    //! Default constructor.
+    AppLibLangIndex ();
+
+    //! Destructor.
+    ~AppLibLangIndex ();
+
+    //! Map the index file, rebuilding it if the translations changed.
+    bool
+    open (
+            const QString & index_file,
+            const QStringList & roots);
+
+    //! Release the mapping.
+    void
+    close ();
+
+    //! Is there a valid index loaded?
+    bool
+    isValid () const {
+        return data_ != NULL;
+    }
+
+    //! Was the index rebuilt by the last open()?
+    bool
+    wasRebuilt () const {
+        return rebuilt_;
+    }
+
+    //! Number of languages in the index.
+    int
+    count () const;
+
+    //! Find a language by its name (the name of its directory); -1 if none.
+    int
+    find (
+            const QString & name) const;
+
+    //! Find a language by a locale name, falling back to the language part.
+    int
+    findLocale (
+            const QString & locale) const;
+
+    //! The name of a language.
+    QString
+    name (
+            int index) const;
+
+    //! The directory of a language.
+    QString
+    directory (
+            int index) const;
+
+    //! The path of the compiled translation (.qm) of a language.
+    QString
+    qmFile (
+            int index) const;
+
+private:
+
+    //! Check the header and the time stamps of the mapped file.
+    bool
+    isCurrent () const;
+
+    //! Scan the roots and write a new index file.
+    static bool
+    rebuild (
+            const QString & index_file,
+            const QStringList & roots);
+
+    //! Map the file.
+    bool
+    map (
+            const QString & index_file);
+
+    //! String stored in the file.
+    QString
+    string (
+            quint32 offset,
+            quint32 length) const;
+
+    AppLibLangIndex (const AppLibLangIndex &);
+    AppLibLangIndex& operator=( const AppLibLangIndex& );
+
+private:
+    QFile file_; /**< the index file */
+    const uchar * data_; /**< the mapping; NULL if not valid */
+    qint64 size_; /**< size of the mapping */
+    QStringList roots_; /**< the directories that were indexed */
+    bool rebuilt_; /**< the last open() had to rebuild the file */
+};
+
+#endif // GUARD_APPLIB_LANGINDEX_H_INCLUDE
@@ -0,0 +1,221 @@
+/**
+ * @file applib-log.cc
+ * @brief Definitions for AppLibLog class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include "applib-log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <atomic>
+#include <mutex>
+
+#ifdef _MSC_VER
+#   define strncasecmp _strnicmp
+#endif
+
+//! Longest name for a category.
+#define APPLIB_LOG_NAME_LEN 24
+
+//! Longest message printed; the rest is truncated.
+#define APPLIB_LOG_LINE_LEN 1024
+
+/**
+ * @class AppLibLog
+ *
+ * Each category has an independent level stored in an atomic integer.
+ * The APPLIB_LOG macro compares the level of the message against
+ * APPLIB_LOG_MAX_LEVEL (a compile time constant) and against the level
+ * of the category; the arguments are only evaluated when both pass.
+ *
+ * All categories start Off. The levels can be changed from code or,
+ * without rebuilding, through the APPLIB_LOG environment variable
+ * that is read when the AppLib instance is constructed:
+ * @code
+ * APPLIB_LOG=APPLIB=debug,LIBMAKEINST=info ./app
+ * APPLIB_LOG=debug ./app
+ * @endcode
+ */
+
+std::atomic<int> AppLibLog::levels_[AppLibLog::MaxCategories];
+
+//! serializes registerCategory()
+static std::mutex names_mutex_;
+
+//! the names of the categories; a slot is not changed once published
+static char names_[AppLibLog::MaxCategories][APPLIB_LOG_NAME_LEN] = {
+    "APPLIB",
+    "LIBMAKEINST"
+};
+
+//! number of categories in use; released after the name is written
+static std::atomic<int> names_count_ (AppLibLog::FirstFreeCat);
+
+//! the names for the levels, in order
+static const char * level_names_[] = {
+    "off", "error", "warning", "info", "debug", "trace"
+};
+
+/* ------------------------------------------------------------------------- */
+void AppLibLog::setLevel (int category, Level level)
+{
+    if ((category < 0) || (category >= MaxCategories))
+        return;
+    levels_[category].store (level, std::memory_order_relaxed);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibLog::setLevel (Level level)
+{
+    for (int i = 0; i < MaxCategories; ++i) {
+        levels_[i].store (level, std::memory_order_relaxed);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Names are compared case-insensitive and are truncated to
+ * 23 characters.
+ *
+ * @param name the name of the category (APPLIB, LIBMAKEINST, ...)
+ * @return the index of the category or -1 if the table is full
+ */
+int AppLibLog::registerCategory (const char * name)
+{
+    std::lock_guard<std::mutex> lock (names_mutex_);
+    const int count = names_count_.load (std::memory_order_relaxed);
+    for (int i = 0; i < count; ++i) {
+        if (strncasecmp (names_[i], name, APPLIB_LOG_NAME_LEN - 1) == 0)
+            return i;
+    }
+    if (count >= MaxCategories)
+        return -1;
+
+    strncpy (names_[count], name, APPLIB_LOG_NAME_LEN - 1);
+    names_[count][APPLIB_LOG_NAME_LEN - 1] = 0;
+    names_count_.store (count + 1, std::memory_order_release);
+    return count;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * No lock is taken: the slot of a category is written before the count
+ * that makes it visible is published and it is never changed after that.
+ *
+ * @param category the index returned by registerCategory()
+ * @return the name or an empty string for an unknown index
+ */
+const char * AppLibLog::categoryName (int category)
+{
+    if ((category < 0) ||
+            (category >= names_count_.load (std::memory_order_acquire)))
+        return "";
+    return names_[category];
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static bool levelFromName (const char * name, size_t len, AppLibLog::Level * out)
+{
+    for (int i = 0; i <= AppLibLog::Trace; ++i) {
+        if ((strlen (level_names_[i]) == len) &&
+                (strncasecmp (level_names_[i], name, len) == 0)) {
+            *out = static_cast<AppLibLog::Level>(i);
+            return true;
+        }
+    }
+    if ((len == 1) && isdigit (name[0]) && (name[0] - '0' <= AppLibLog::Trace)) {
+        *out = static_cast<AppLibLog::Level>(name[0] - '0');
+        return true;
+    }
+    return false;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The specification is a comma separated list of entries. An entry
+ * is either `CATEGORY=level`, which changes a single category
+ * (creating it if needed), or `level`, which changes all of them.
+ * Entries are applied in order.
+ *
+ * @param spec the specification
+ * @return false if some entries could not be understood
+ */
+bool AppLibLog::configure (const char * spec)
+{
+    if (spec == NULL)
+        return false;
+
+    bool b_ret = true;
+    const char * p = spec;
+    while (*p != 0) {
+        const char * end = strchr (p, ',');
+        if (end == NULL)
+            end = p + strlen (p);
+        const char * eq = static_cast<const char *>(memchr (p, '=', end - p));
+
+        Level lvl;
+        if (eq == NULL) {
+            if (levelFromName (p, end - p, &lvl)) {
+                setLevel (lvl);
+            } else if (end != p) {
+                b_ret = false;
+            }
+        } else {
+            char name[APPLIB_LOG_NAME_LEN];
+            size_t name_len = eq - p;
+            if (name_len >= APPLIB_LOG_NAME_LEN)
+                name_len = APPLIB_LOG_NAME_LEN - 1;
+            memcpy (name, p, name_len);
+            name[name_len] = 0;
+
+            int cat = registerCategory (name);
+            if ((cat != -1) && levelFromName (eq + 1, end - eq - 1, &lvl)) {
+                setLevel (cat, lvl);
+            } else {
+                b_ret = false;
+            }
+        }
+
+        p = (*end == 0 ? end : end + 1);
+    }
+    return b_ret;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibLog::configureFromEnv (const char * env_var)
+{
+    const char * spec = getenv (env_var);
+    if (spec != NULL) {
+        configure (spec);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibLog::write (int category, Level level, const char * format, ...)
+{
+    char buffer[APPLIB_LOG_LINE_LEN];
+    int prefix = snprintf (buffer, sizeof(buffer), "%s: ",
+                           categoryName (category));
+
+    va_list args;
+    va_start (args, format);
+    vsnprintf (buffer + prefix, sizeof(buffer) - prefix, format, args);
+    va_end (args);
+
+    fputs (buffer, level <= Warning ? stderr : stdout);
+}
+/* ========================================================================= */
@@ -0,0 +1,138 @@
+/**
+ * @file applib-log.h
+ * @brief Declarations for AppLibLog class and logging macros
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_APPLIB_LOG_H_INCLUDE
+#define GUARD_APPLIB_LOG_H_INCLUDE
+
+#include <applib/applib-config.h>
+
+#include <atomic>
+
+//! Levelled, per-module debug log.
+class APPLIB_EXPORT AppLibLog {
+
+public:
+
+    //! How important a message is; lower values are more important.
+    enum Level {
+        Off = 0,
+        Error,
+        Warning,
+        Info,
+        Debug,
+        Trace
+    };
+
+    //! Predefined categories; piles add their own with registerCategory().
+    enum Category {
+        AppLibCat = 0,
+        LibMakeInstCat,
+        FirstFreeCat,
+
+        MaxCategories = 32
+    };
+
+    //! Is a message of this level in this category going to be printed?
+    static inline bool
+    isEnabled (
+            int category,
+            Level level) {
+        // also rejects -1 from a full registerCategory()
+        if (static_cast<unsigned>(category) >= MaxCategories)
+            return false;
+        return levels_[category].load (std::memory_order_relaxed) >= level;
+    }
+
+    //! Change the level for a category.
+    static void
+    setLevel (
+            int category,
+            Level level);
+
+    //! Change the level for all categories.
+    static void
+    setLevel (
+            Level level);
+
+    //! Current level for a category.
+    static Level
+    level (
+            int category) {
+        if (static_cast<unsigned>(category) >= MaxCategories)
+            return Off;
+        return static_cast<Level>(
+                    levels_[category].load (std::memory_order_relaxed));
+    }
+
+    //! Get the index of a category, creating it if needed; -1 if full.
+    static int
+    registerCategory (
+            const char * name);
+
+    //! The name of a category; empty if it was not registered.
+    static const char *
+    categoryName (
+            int category);
+
+    //! Apply a specification like "APPLIB=debug,LIBMAKEINST=info".
+    static bool
+    configure (
+            const char * spec);
+
+    //! Apply the specification in APPLIB_LOG environment variable.
+    static void
+    configureFromEnv (
+            const char * env_var = "APPLIB_LOG");
+
+    //! Print a message (use the APPLIB_LOG macro instead).
+    static void
+    write (
+            int category,
+            Level level,
+            const char * format, ...)
+#if defined(__GNUC__)
+        __attribute__((format(printf, 3, 4)))
+#endif
+    ;
+
+private:
+    static std::atomic<int> levels_[MaxCategories]; /**< level per category */
+};
+
+
+/**
+ * @def APPLIB_LOG_MAX_LEVEL
+ * @brief Messages above this level are removed at compile time.
+ *
+ * Define it to AppLibLog::Off or AppLibLog::Info in builds where the
+ * debug messages should not be present at all. The default keeps
+ * everything so that the output can be enabled at run time.
+ */
+#ifndef APPLIB_LOG_MAX_LEVEL
+#   define APPLIB_LOG_MAX_LEVEL AppLibLog::Trace
+#endif
+
+
+/**
+ * @def APPLIB_LOG
+ * @brief Print a message in a category if its level is enabled.
+ *
+ * The arguments are only evaluated when the message is printed.
+ * A disabled message costs a relaxed atomic load and a branch;
+ * a message above APPLIB_LOG_MAX_LEVEL costs nothing.
+ */
+#define APPLIB_LOG(__cat__, __lvl__, ...) \
+    do { \
+        if (((__lvl__) <= APPLIB_LOG_MAX_LEVEL) && \
+                AppLibLog::isEnabled ((__cat__), (__lvl__))) { \
+            AppLibLog::write ((__cat__), (__lvl__), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#endif // GUARD_APPLIB_LOG_H_INCLUDE
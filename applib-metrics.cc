@@ -0,0 +1,540 @@
+/**
+ * @file applib-metrics.cc
+ * @brief Definitions for AppLibMetrics class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include "applib-metrics.h"
+#include "applib-profiler.h"
+#include "applib-private.h"
+
+#include <QSaveFile>
+
+#include <chrono>
+
+/**
+ * @class AppLibMetrics
+ *
+ * Metrics are created by name (and an optional set of labels) and live
+ * as long as the registry; the pointers handed out may be kept and
+ * used from any thread. Only creation takes a lock.
+ *
+ * Counters and histograms are spread over a few cache-line sized
+ * shards picked by the calling thread, so threads that update the same
+ * metric rarely touch the same line; reading a value adds the shards.
+ *
+ * Histograms have log-linear buckets: exact up to 7, then eight
+ * buckets for each power of two, so a recorded value is at most 12.5%
+ * away from the bound of its bucket. Durations are usually recorded in
+ * nanoseconds with a scale of 1e-9, so they are exported in seconds.
+ */
+
+/* ------------------------------------------------------------------------- */
+static int shardOf (int shards)
+{
+    static thread_local int thread = AppLibProfiler::currentThread ();
+    return thread % shards;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int highestBit (quint64 value)
+{
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll (value);
+#else
+    int bit = 0;
+    while (value >>= 1)
+        ++bit;
+    return bit;
+#endif
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibMetrics::Counter::Counter ()
+{
+    for (int i = 0; i < Shards; ++i)
+        shards_[i].value.store (0, std::memory_order_relaxed);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibMetrics::Counter::add (quint64 amount)
+{
+    shards_[shardOf (Shards)].value.fetch_add (
+                amount, std::memory_order_relaxed);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+quint64 AppLibMetrics::Counter::value () const
+{
+    quint64 result = 0;
+    for (int i = 0; i < Shards; ++i)
+        result += shards_[i].value.load (std::memory_order_relaxed);
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibMetrics::Gauge::Gauge () :
+    value_ (0.0)
+{
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibMetrics::Gauge::add (double amount)
+{
+    double current = value_.load (std::memory_order_relaxed);
+    while (!value_.compare_exchange_weak (
+               current, current + amount, std::memory_order_relaxed)) {}
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param q between 0 and 1 (0.5 is the median)
+ * @return 0 if the histogram is empty
+ */
+quint64 AppLibMetrics::HistogramData::percentile (double q) const
+{
+    if (count == 0)
+        return 0;
+    quint64 rank = static_cast<quint64>(q * static_cast<double>(count));
+    if (rank >= count)
+        rank = count - 1;
+    quint64 seen = 0;
+    for (size_t i = 0; i < buckets.size (); ++i) {
+        seen += buckets[i];
+        if (seen > rank)
+            return Histogram::upperBound (static_cast<int>(i));
+    }
+    return Histogram::upperBound (static_cast<int>(buckets.size ()) - 1);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibMetrics::Histogram::Histogram ()
+{
+    for (int s = 0; s < HistogramShards; ++s) {
+        shards_[s].sum.store (0, std::memory_order_relaxed);
+        for (int i = 0; i < Buckets; ++i)
+            shards_[s].buckets[i].store (0, std::memory_order_relaxed);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int AppLibMetrics::Histogram::bucketOf (quint64 value)
+{
+    if (value < (1 << SubBits))
+        return static_cast<int>(value);
+    const int exponent = highestBit (value);
+    const int sub = static_cast<int>(
+                (value >> (exponent - SubBits)) & ((1 << SubBits) - 1));
+    return (1 << SubBits) + (exponent - SubBits) * (1 << SubBits) + sub;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+quint64 AppLibMetrics::Histogram::upperBound (int bucket)
+{
+    if (bucket < (1 << SubBits))
+        return static_cast<quint64>(bucket);
+    const int exponent = (bucket - (1 << SubBits)) / (1 << SubBits) + SubBits;
+    const quint64 sub = static_cast<quint64>(
+                (bucket - (1 << SubBits)) % (1 << SubBits));
+    const quint64 width = Q_UINT64_C(1) << (exponent - SubBits);
+    return ((Q_UINT64_C(1) << SubBits) + sub) * width + (width - 1);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibMetrics::Histogram::record (quint64 value)
+{
+    Shard & shard = shards_[shardOf (HistogramShards)];
+    shard.buckets[bucketOf (value)].fetch_add (1, std::memory_order_relaxed);
+    shard.sum.fetch_add (value, std::memory_order_relaxed);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The shards are read one after the other, so a value recorded meanwhile
+ * may be counted in the buckets but not in the sum (or the reverse);
+ * the count always matches the buckets.
+ */
+AppLibMetrics::HistogramData AppLibMetrics::Histogram::data () const
+{
+    HistogramData result;
+    result.buckets.assign (Buckets, 0);
+    for (int s = 0; s < HistogramShards; ++s) {
+        result.sum += shards_[s].sum.load (std::memory_order_relaxed);
+        for (int i = 0; i < Buckets; ++i) {
+            const quint64 n = shards_[s].buckets[i].load (
+                        std::memory_order_relaxed);
+            result.buckets[i] += n;
+            result.count += n;
+        }
+    }
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibMetrics::AppLibMetrics () :
+    mutex_ (),
+    families_ (),
+    exporter_mutex_ (),
+    exporter_cv_ (),
+    exporter_stop_ (false),
+    exporter_ ()
+{
+    APPLIB_TRACE_ENTRY;
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibMetrics::~AppLibMetrics ()
+{
+    APPLIB_TRACE_ENTRY;
+    stopExporter ();
+    for (size_t f = 0; f < families_.size (); ++f) {
+        Family * family = families_[f];
+        for (size_t m = 0; m < family->members.size (); ++m) {
+            if (!family->members[m].owned)
+                continue;
+            void * metric = family->members[m].metric;
+            switch (family->type) {
+            case CounterType:
+                delete static_cast<Counter *>(metric);
+                break;
+            case GaugeType:
+                delete static_cast<Gauge *>(metric);
+                break;
+            case HistogramType:
+                delete static_cast<Histogram *>(metric);
+                break;
+            }
+        }
+        delete family;
+    }
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void * AppLibMetrics::lookup (
+        const QString & name, const QString & help, const QString & labels,
+        Type type, double scale)
+{
+    std::lock_guard<std::mutex> lock (mutex_);
+    Family * family = NULL;
+    for (size_t f = 0; f < families_.size (); ++f) {
+        if (families_[f]->name == name) {
+            family = families_[f];
+            break;
+        }
+    }
+    if (family == NULL) {
+        family = new Family;
+        family->name = name;
+        family->help = help;
+        family->type = type;
+        family->scale = scale;
+        families_.push_back (family);
+    } else if (family->type != type) {
+        APPLIB_DEBUGM("Metric %s was registered with another type\n",
+                      TMP_A(name));
+        return NULL;
+    }
+
+    for (size_t m = 0; m < family->members.size (); ++m) {
+        if (family->members[m].labels == labels)
+            return family->members[m].metric;
+    }
+    Member member;
+    member.labels = labels;
+    member.owned = true;
+    switch (type) {
+    case CounterType:
+        member.metric = new Counter ();
+        break;
+    case GaugeType:
+        member.metric = new Gauge ();
+        break;
+    default:
+        member.metric = new Histogram ();
+    }
+    family->members.push_back (member);
+    return member.metric;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * For counters that outlive any registry, like the process-wide ones
+ * updated by the Qt message handler.
+ *
+ * @return false if the name and labels are already taken
+ */
+bool AppLibMetrics::addCounter (
+        const QString & name, const QString & help, const QString & labels,
+        Counter * counter)
+{
+    std::lock_guard<std::mutex> lock (mutex_);
+    Family * family = NULL;
+    for (size_t f = 0; f < families_.size (); ++f) {
+        if (families_[f]->name == name) {
+            family = families_[f];
+            break;
+        }
+    }
+    if (family == NULL) {
+        family = new Family;
+        family->name = name;
+        family->help = help;
+        family->type = CounterType;
+        family->scale = 1.0;
+        families_.push_back (family);
+    } else if (family->type != CounterType) {
+        return false;
+    }
+    for (size_t m = 0; m < family->members.size (); ++m) {
+        if (family->members[m].labels == labels)
+            return false;
+    }
+    Member member;
+    member.labels = labels;
+    member.metric = counter;
+    member.owned = false;
+    family->members.push_back (member);
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param name the name of the family, like applib_qt_messages_total
+ * @param help the description written in the export
+ * @param labels distinguishes the members of a family, like type="warning"
+ * @return NULL if the name is used by a metric of another type
+ */
+AppLibMetrics::Counter * AppLibMetrics::counter (
+        const QString & name, const QString & help, const QString & labels)
+{
+    return static_cast<Counter *>(
+                lookup (name, help, labels, CounterType, 1.0));
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibMetrics::Gauge * AppLibMetrics::gauge (
+        const QString & name, const QString & help, const QString & labels)
+{
+    return static_cast<Gauge *>(
+                lookup (name, help, labels, GaugeType, 1.0));
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param scale multiplies the recorded values in the export; all the
+ *      members of a family share the scale of the first one
+ */
+AppLibMetrics::Histogram * AppLibMetrics::histogram (
+        const QString & name, const QString & help, const QString & labels,
+        double scale)
+{
+    return static_cast<Histogram *>(
+                lookup (name, help, labels, HistogramType, scale));
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+QList<AppLibMetrics::Sample> AppLibMetrics::snapshot () const
+{
+    QList<Sample> result;
+    std::lock_guard<std::mutex> lock (mutex_);
+    for (size_t f = 0; f < families_.size (); ++f) {
+        const Family * family = families_[f];
+        for (size_t m = 0; m < family->members.size (); ++m) {
+            const void * metric = family->members[m].metric;
+            Sample sample;
+            sample.name = family->name;
+            sample.help = family->help;
+            sample.labels = family->members[m].labels;
+            sample.type = family->type;
+            sample.scale = family->scale;
+            sample.value = 0.0;
+            switch (family->type) {
+            case CounterType:
+                sample.value = static_cast<double>(
+                            static_cast<const Counter *>(metric)->value ());
+                break;
+            case GaugeType:
+                sample.value = static_cast<const Gauge *>(metric)->value ();
+                break;
+            case HistogramType:
+                sample.histogram =
+                        static_cast<const Histogram *>(metric)->data ();
+                break;
+            }
+            result.append (sample);
+        }
+    }
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static QByteArray promNumber (double value)
+{
+    return QByteArray::number (value, 'g', 17);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static QByteArray promLabels (const QString & labels, const QByteArray & extra)
+{
+    if (labels.isEmpty () && extra.isEmpty ())
+        return QByteArray ();
+    QByteArray result ("{");
+    result.append (labels.toUtf8 ());
+    if (!labels.isEmpty () && !extra.isEmpty ())
+        result.append (',');
+    result.append (extra);
+    result.append ('}');
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Histograms list only the buckets that hold values (cumulative, as
+ * Prometheus expects) followed by +Inf, the sum and the count.
+ */
+QByteArray AppLibMetrics::toPrometheus () const
+{
+    static const char * type_names[] = { "counter", "gauge", "histogram" };
+    QList<Sample> all = snapshot ();
+    QByteArray result;
+    QString family;
+    for (int i = 0; i < all.count (); ++i) {
+        const Sample & sample = all.at (i);
+        const QByteArray name = sample.name.toUtf8 ();
+        if (sample.name != family) {
+            family = sample.name;
+            result.append ("# HELP " + name + ' ' +
+                           sample.help.toUtf8 () + '\n');
+            result.append ("# TYPE " + name + ' ' +
+                           type_names[sample.type] + '\n');
+        }
+
+        if (sample.type != HistogramType) {
+            result.append (name + promLabels (sample.labels, QByteArray ()) +
+                           ' ' + promNumber (sample.value) + '\n');
+            continue;
+        }
+
+        const HistogramData & h = sample.histogram;
+        quint64 cumulative = 0;
+        for (size_t b = 0; b < h.buckets.size (); ++b) {
+            if (h.buckets[b] == 0)
+                continue;
+            cumulative += h.buckets[b];
+            const double bound = static_cast<double>(
+                        Histogram::upperBound (static_cast<int>(b))) *
+                    sample.scale;
+            result.append (name + "_bucket" +
+                           promLabels (sample.labels,
+                                       "le=\"" + promNumber (bound) + '"') +
+                           ' ' + QByteArray::number (cumulative) + '\n');
+        }
+        result.append (name + "_bucket" +
+                       promLabels (sample.labels, "le=\"+Inf\"") + ' ' +
+                       QByteArray::number (h.count) + '\n');
+        result.append (name + "_sum" + promLabels (sample.labels, QByteArray ()) +
+                       ' ' + promNumber (static_cast<double>(h.sum) *
+                                         sample.scale) + '\n');
+        result.append (name + "_count" +
+                       promLabels (sample.labels, QByteArray ()) +
+                       ' ' + QByteArray::number (h.count) + '\n');
+    }
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The file is replaced atomically, so a collector (node_exporter's
+ * textfile collector, for example) never reads a partial file.
+ */
+bool AppLibMetrics::writeFile (const QString & file) const
+{
+    QSaveFile out (file);
+    if (!out.open (QIODevice::WriteOnly)) {
+        APPLIB_DEBUGM("Cannot write metrics to %s\n", TMP_A(file));
+        return false;
+    }
+    out.write (toPrometheus ());
+    return out.commit ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * A running exporter is replaced.
+ *
+ * @param file where the metrics are written
+ * @param interval_ms time between writes
+ * @return false if the file could not be written
+ */
+bool AppLibMetrics::startExporter (const QString & file, int interval_ms)
+{
+    stopExporter ();
+    if (!writeFile (file))
+        return false;
+    exporter_stop_ = false;
+    exporter_ = std::thread (&AppLibMetrics::exporterLoop, this,
+                             file, qMax (interval_ms, 10));
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibMetrics::stopExporter ()
+{
+    if (!exporter_.joinable ())
+        return;
+    {
+        std::lock_guard<std::mutex> lock (exporter_mutex_);
+        exporter_stop_ = true;
+    }
+    exporter_cv_.notify_all ();
+    exporter_.join ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibMetrics::exporterLoop (QString file, int interval_ms)
+{
+    std::unique_lock<std::mutex> lock (exporter_mutex_);
+    for (;;) {
+        exporter_cv_.wait_for (lock, std::chrono::milliseconds (interval_ms),
+                               [this] { return exporter_stop_; });
+        const bool b_stop = exporter_stop_;
+        lock.unlock ();
+        writeFile (file);
+        if (b_stop)
+            return;
+        lock.lock ();
+    }
+}
+/* ========================================================================= */
@@ -0,0 +1,271 @@
+/**
+ * @file applib-metrics.h
+ * @brief Declarations for AppLibMetrics class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_APPLIB_METRICS_H_INCLUDE
+#define GUARD_APPLIB_METRICS_H_INCLUDE
+
+#include <applib/applib-config.h>
+#include <QString>
+#include <QByteArray>
+#include <QList>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//! A registry of counters, gauges and histograms.
+class APPLIB_EXPORT AppLibMetrics {
+
+public:
+
+    //! The kind of a metric.
+    enum Type {
+        CounterType,
+        GaugeType,
+        HistogramType
+    };
+
+    //! Number of slots a counter or histogram is spread over.
+    enum {
+        Shards = 16,
+        HistogramShards = 4
+    };
+
+    //! A value that only grows.
+    class APPLIB_EXPORT Counter {
+    public:
+        //! Constructor.
+        Counter ();
+
+        //! Increase the value.
+        void
+        add (
+                quint64 amount = 1);
+
+        //! The sum of all the shards.
+        quint64
+        value () const;
+
+    private:
+        Counter (const Counter &);
+        Counter& operator=( const Counter& );
+
+        //! One slot, on its own cache line.
+        struct alignas(64) Shard {
+            std::atomic<quint64> value; /**< the part of the total */
+        };
+        Shard shards_[Shards]; /**< the slots */
+    };
+
+    //! A value that goes up and down.
+    class APPLIB_EXPORT Gauge {
+    public:
+        //! Constructor.
+        Gauge ();
+
+        //! Change the value.
+        void
+        set (
+                double value) {
+            value_.store (value, std::memory_order_relaxed);
+        }
+
+        //! Add to the value (may be negative).
+        void
+        add (
+                double amount);
+
+        //! The current value.
+        double
+        value () const {
+            return value_.load (std::memory_order_relaxed);
+        }
+
+    private:
+        Gauge (const Gauge &);
+        Gauge& operator=( const Gauge& );
+
+        std::atomic<double> value_; /**< the value */
+    };
+
+    //! The content of a histogram at some moment.
+    struct HistogramData {
+        std::vector<quint64> buckets; /**< count in each bucket */
+        quint64 count; /**< number of values */
+        quint64 sum; /**< sum of the values */
+
+        HistogramData () : buckets (), count (0), sum (0) {}
+
+        //! Upper bound of the bucket that holds the q-th quantile.
+        quint64
+        percentile (
+                double q) const;
+    };
+
+    //! Distribution of non-negative integer values (durations in ns, sizes).
+    class APPLIB_EXPORT Histogram {
+    public:
+        //! Buckets: exact below 8, then 8 per power of two.
+        enum {
+            SubBits = 3,
+            Buckets = 8 + (64 - SubBits) * 8
+        };
+
+        //! Constructor.
+        Histogram ();
+
+        //! Add a value.
+        void
+        record (
+                quint64 value);
+
+        //! The sum of all the shards.
+        HistogramData
+        data () const;
+
+        //! The bucket of a value.
+        static int
+        bucketOf (
+                quint64 value);
+
+        //! The largest value in a bucket.
+        static quint64
+        upperBound (
+                int bucket);
+
+    private:
+        Histogram (const Histogram &);
+        Histogram& operator=( const Histogram& );
+
+        //! One slot; the counts are not padded, the shards are aligned.
+        struct alignas(64) Shard {
+            std::atomic<quint64> sum; /**< sum of the values */
+            std::atomic<quint64> buckets[Buckets]; /**< the counts */
+        };
+        Shard shards_[HistogramShards]; /**< the slots */
+    };
+
+    //! The value of one metric at some moment.
+    struct Sample {
+        QString name; /**< the name of the family */
+        QString help; /**< the description of the family */
+        QString labels; /**< like: state="running" */
+        Type type; /**< the kind of metric */
+        double value; /**< for counters and gauges */
+        HistogramData histogram; /**< for histograms */
+        double scale; /**< multiplies histogram values when exported */
+    };
+
+    //! Default constructor.
+    AppLibMetrics ();
+
+    //! Destructor; stops the exporter.
+    ~AppLibMetrics ();
+
+    //! Find or create a counter.
+    Counter *
+    counter (
+            const QString & name,
+            const QString & help,
+            const QString & labels = QString ());
+
+    //! Find or create a gauge.
+    Gauge *
+    gauge (
+            const QString & name,
+            const QString & help,
+            const QString & labels = QString ());
+
+    //! Find or create a histogram.
+    Histogram *
+    histogram (
+            const QString & name,
+            const QString & help,
+            const QString & labels = QString (),
+            double scale = 1.0);
+
+    //! Add a counter owned by the caller; it must outlive the registry.
+    bool
+    addCounter (
+            const QString & name,
+            const QString & help,
+            const QString & labels,
+            Counter * counter);
+
+    //! The values of all the metrics.
+    QList<Sample>
+    snapshot () const;
+
+    //! All the metrics in Prometheus text exposition format.
+    QByteArray
+    toPrometheus () const;
+
+    //! Write toPrometheus() to a file, replacing it atomically.
+    bool
+    writeFile (
+            const QString & file) const;
+
+    //! Write the metrics to a file periodically, from a background thread.
+    bool
+    startExporter (
+            const QString & file,
+            int interval_ms = 10000);
+
+    //! Stop the background exporter (the file is written one last time).
+    void
+    stopExporter ();
+
+private:
+
+    //! A member of a family.
+    struct Member {
+        QString labels; /**< distinguishes the members */
+        void * metric; /**< Counter, Gauge or Histogram */
+        bool owned; /**< deleted with the registry */
+    };
+
+    //! Metrics that share a name.
+    struct Family {
+        QString name; /**< the name */
+        QString help; /**< the description */
+        Type type; /**< the kind of the members */
+        double scale; /**< for histograms */
+        std::vector<Member> members; /**< in order of creation */
+    };
+
+    //! Find or create a metric; NULL if the name has another type.
+    void *
+    lookup (
+            const QString & name,
+            const QString & help,
+            const QString & labels,
+            Type type,
+            double scale);
+
+    //! Body of the exporter thread.
+    void
+    exporterLoop (
+            QString file,
+            int interval_ms);
+
+    AppLibMetrics (const AppLibMetrics &);
+    AppLibMetrics& operator=( const AppLibMetrics& );
+
+private:
+    mutable std::mutex mutex_; /**< protects the families */
+    std::vector<Family *> families_; /**< in order of creation */
+    std::mutex exporter_mutex_; /**< used by the exporter */
+    std::condition_variable exporter_cv_; /**< wakes the exporter */
+    bool exporter_stop_; /**< ask the exporter to exit */
+    std::thread exporter_; /**< writes the file periodically */
+};
+
+#endif // GUARD_APPLIB_METRICS_H_INCLUDE
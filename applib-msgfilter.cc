@@ -0,0 +1,295 @@
+/**
+ * @file applib-msgfilter.cc
+ * @brief Definitions for AppLibMsgFilter class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include "applib-msgfilter.h"
+#include "applib-profiler.h"
+#include "applib-private.h"
+
+#include <stdint.h>
+#include <thread>
+
+/**
+ * @class AppLibMsgFilter
+ *
+ * The rules map category names to the types of messages that are
+ * rejected. Qt identifies a category by a pointer to its name that does
+ * not change for the life of the category, so the names are interned
+ * once, when the category is registered, in a flat open-addressing table
+ * keyed by that pointer. Deciding on a message is then a hash of the
+ * pointer and a comparison with the copy of the name the table owns.
+ *
+ * Categories created at run time may go away and their address may be
+ * reused by another one, so the pointer is only a hint: the table is
+ * rebuilt from the owned names, and a pointer whose name does not match
+ * (or was never registered) is decided by looking the name up in the
+ * rules.
+ *
+ * The table is never changed in place. A change builds a new table
+ * and swaps the pointer; readers keep using the version they loaded.
+ * Readers announce themselves in a per-thread shard of counters tagged
+ * with an epoch; a change flips the epoch, waits for the readers of the
+ * previous one (they only do a lookup) and frees the replaced tables.
+ */
+
+//! Spread the readers over the shards.
+static int readerShard ()
+{
+    static thread_local int thread = AppLibProfiler::currentThread ();
+    return thread;
+}
+
+/* ------------------------------------------------------------------------- */
+AppLibMsgFilter::AppLibMsgFilter () :
+    writer_mutex_ (),
+    table_ (NULL),
+    retired_ (NULL),
+    epoch_ (0)
+{
+    APPLIB_TRACE_ENTRY;
+    for (int i = 0; i < ReaderShards; ++i) {
+        shards_[i].readers[0].store (0, std::memory_order_relaxed);
+        shards_[i].readers[1].store (0, std::memory_order_relaxed);
+    }
+    Table * table = new Table ();
+    table->default_mask = 0;
+    table->retired_next = NULL;
+    build (table);
+    table_.store (table, std::memory_order_release);
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibMsgFilter::~AppLibMsgFilter ()
+{
+    APPLIB_TRACE_ENTRY;
+    delete table_.load ();
+    while (retired_ != NULL) {
+        Table * next = retired_->retired_next;
+        delete retired_;
+        retired_ = next;
+    }
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+size_t AppLibMsgFilter::slotIndex (const char * key, size_t slot_mask)
+{
+    quint64 value = static_cast<quint64>(reinterpret_cast<uintptr_t>(key));
+    value *= Q_UINT64_C(0x9E3779B97F4A7C15);
+    return static_cast<size_t>(value >> 32) & slot_mask;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibMsgFilter::build (Table * table)
+{
+    size_t count = 16;
+    while (count < table->known.size () * 2)
+        count <<= 1;
+    table->slot_mask = count - 1;
+    Slot empty;
+    empty.key = NULL;
+    empty.name = NULL;
+    empty.mask = 0;
+    table->entries.assign (count, empty);
+
+    // only the owned names are read; the hints may be stale
+    for (size_t i = 0; i < table->known.size (); ++i) {
+        const Known & known = table->known[i];
+        if (known.hint == NULL)
+            continue;
+        size_t index = slotIndex (known.hint, table->slot_mask);
+        while (table->entries[index].key != NULL)
+            index = (index + 1) & table->slot_mask;
+        table->entries[index].key = known.hint;
+        table->entries[index].name = known.name.constData ();
+        table->entries[index].mask = table->rules.value (
+                    known.name, table->default_mask);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibMsgFilter::publish (Table * table)
+{
+    build (table);
+    Table * old = table_.exchange (table, std::memory_order_seq_cst);
+    old->retired_next = retired_;
+    retired_ = old;
+
+    // the readers of the previous epoch were waited for by the last
+    // change, so only those of the current one may still see old
+    const int epoch = epoch_.load (std::memory_order_relaxed);
+    epoch_.store (epoch + 1, std::memory_order_seq_cst);
+    for (int i = 0; i < ReaderShards; ++i) {
+        while (shards_[i].readers[epoch & 1].load (
+                   std::memory_order_acquire) != 0)
+            std::this_thread::yield ();
+    }
+    while (retired_ != NULL) {
+        Table * next = retired_->retired_next;
+        delete retired_;
+        retired_ = next;
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param mask the types to reject, built with typeBit()
+ */
+void AppLibMsgFilter::setDefaultMask (int mask)
+{
+    std::lock_guard<std::mutex> lock (writer_mutex_);
+    Table * table = new Table (*table_.load (std::memory_order_acquire));
+    table->default_mask = mask;
+    publish (table);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int AppLibMsgFilter::defaultMask () const
+{
+    const int token = enterRead ();
+    const int result = table_.load (std::memory_order_seq_cst)->default_mask;
+    leaveRead (token);
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param category the name of the category
+ * @param mask the types to reject, built with typeBit()
+ */
+void AppLibMsgFilter::setRule (const QByteArray & category, int mask)
+{
+    std::lock_guard<std::mutex> lock (writer_mutex_);
+    Table * table = new Table (*table_.load (std::memory_order_acquire));
+    table->rules.insert (category, mask);
+    publish (table);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLibMsgFilter::removeRule (const QByteArray & category)
+{
+    std::lock_guard<std::mutex> lock (writer_mutex_);
+    const Table * current = table_.load (std::memory_order_acquire);
+    if (!current->rules.contains (category))
+        return false;
+    Table * table = new Table (*current);
+    table->rules.remove (category);
+    publish (table);
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Categories that are never registered get the default mask.
+ *
+ * A category that is created again (at the same or at another
+ * address) only updates the hint of its name, so the table grows with
+ * the number of distinct names.
+ *
+ * @param name the name of the category as it appears in
+ *      QMessageLogContext::category; it is copied
+ */
+void AppLibMsgFilter::registerCategory (const char * name)
+{
+    if (name == NULL)
+        return;
+    std::lock_guard<std::mutex> lock (writer_mutex_);
+    const Table * current = table_.load (std::memory_order_acquire);
+    int same_name = -1;
+    for (size_t i = 0; i < current->known.size (); ++i) {
+        if (current->known[i].name == name) {
+            if (current->known[i].hint == name)
+                return;
+            same_name = static_cast<int>(i);
+        }
+    }
+    Table * table = new Table (*current);
+    // the address may have belonged to a category that is gone
+    for (size_t i = 0; i < table->known.size (); ++i) {
+        if (table->known[i].hint == name)
+            table->known[i].hint = NULL;
+    }
+    if (same_name == -1) {
+        Known known;
+        known.name = QByteArray (name);
+        known.hint = name;
+        table->known.push_back (known);
+    } else {
+        table->known[same_name].hint = name;
+    }
+    publish (table);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int AppLibMsgFilter::enterRead () const
+{
+    ReaderShard & shard = shards_[readerShard () % ReaderShards];
+    for (;;) {
+        const int epoch = epoch_.load (std::memory_order_seq_cst);
+        shard.readers[epoch & 1].fetch_add (1, std::memory_order_seq_cst);
+        // publish() may have flipped the epoch in the meantime
+        if (epoch_.load (std::memory_order_seq_cst) == epoch)
+            return epoch & 1;
+        shard.readers[epoch & 1].fetch_sub (1, std::memory_order_release);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibMsgFilter::leaveRead (int token) const
+{
+    shards_[readerShard () % ReaderShards].readers[token].fetch_sub (
+                1, std::memory_order_release);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int AppLibMsgFilter::lookup (const Table * table, const char * category)
+{
+    if (category == NULL)
+        return table->default_mask;
+    size_t index = slotIndex (category, table->slot_mask);
+    for (;;) {
+        const Slot & slot = table->entries[index];
+        if (slot.key == category) {
+            if (qstrcmp (slot.name, category) == 0)
+                return slot.mask;
+            break;
+        }
+        if (slot.key == NULL)
+            break;
+        index = (index + 1) & table->slot_mask;
+    }
+    // not registered, or the address now holds another category
+    return table->rules.value (
+                QByteArray::fromRawData (category, qstrlen (category)),
+                table->default_mask);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int AppLibMsgFilter::rejectedMask (const char * category) const
+{
+    const int token = enterRead ();
+    const int result = lookup (
+                table_.load (std::memory_order_seq_cst), category);
+    leaveRead (token);
+    return result;
+}
+/* ========================================================================= */
@@ -0,0 +1,156 @@
+/**
+ * @file applib-msgfilter.h
+ * @brief Declarations for AppLibMsgFilter class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_APPLIB_MSGFILTER_H_INCLUDE
+#define GUARD_APPLIB_MSGFILTER_H_INCLUDE
+
+#include <applib/applib-config.h>
+#include <QByteArray>
+#include <QHash>
+#include <QtGlobal>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+//! Decides, by category and type, which messages from Qt are rejected.
+class APPLIB_EXPORT AppLibMsgFilter {
+
+public:
+
+    //! Default constructor; everything is accepted.
+    AppLibMsgFilter ();
+
+    //! Destructor.
+    ~AppLibMsgFilter ();
+
+    //! The bit of a message type in a mask.
+    static int
+    typeBit (
+            QtMsgType type) {
+        return 1 << static_cast<int>(type);
+    }
+
+    //! Set the types rejected for the categories that have no rule.
+    void
+    setDefaultMask (
+            int mask);
+
+    //! The types rejected for the categories that have no rule.
+    int
+    defaultMask () const;
+
+    //! Set the types rejected for a category.
+    void
+    setRule (
+            const QByteArray & category,
+            int mask);
+
+    //! Remove the rule of a category.
+    bool
+    removeRule (
+            const QByteArray & category);
+
+    //! Make the name of a category known; the pointer is a lookup hint.
+    void
+    registerCategory (
+            const char * name);
+
+    //! The types rejected for a category.
+    int
+    rejectedMask (
+            const char * category) const;
+
+    //! Is a message accepted? Does not lock or allocate.
+    bool
+    accepts (
+            const char * category,
+            QtMsgType type) const {
+        return (rejectedMask (category) & typeBit (type)) == 0;
+    }
+
+private:
+
+    //! One interned category.
+    struct Slot {
+        const char * key; /**< the pointer given by Qt; NULL if free */
+        const char * name; /**< the name, owned by the table */
+        int mask; /**< the rejected types */
+    };
+
+    //! A registered category.
+    struct Known {
+        QByteArray name; /**< owned copy of the name */
+        const char * hint; /**< the last pointer seen for it or NULL */
+    };
+
+    //! An immutable version of the filter.
+    struct Table {
+        int default_mask; /**< for the categories without a rule */
+        size_t slot_mask; /**< number of slots - 1 */
+        std::vector<Slot> entries; /**< open addressing, by pointer */
+        QHash<QByteArray, int> rules; /**< category name to mask */
+        std::vector<Known> known; /**< all registered names */
+        Table * retired_next; /**< chain of replaced tables */
+    };
+
+    //! Readers of the tables, by epoch parity; one cache line each.
+    struct alignas(64) ReaderShard {
+        std::atomic<int> readers[2]; /**< readers inside each epoch */
+    };
+
+    //! Number of reader shards.
+    enum {
+        ReaderShards = 16
+    };
+
+    //! Announce a reader; returns what leaveRead() needs.
+    int
+    enterRead () const;
+
+    //! A reader is done with the table it loaded.
+    void
+    leaveRead (
+            int token) const;
+
+    //! The mask of a category, given the table; the reader is announced.
+    static int
+    lookup (
+            const Table * table,
+            const char * category);
+
+    //! The slot for a pointer.
+    static size_t
+    slotIndex (
+            const char * key,
+            size_t slot_mask);
+
+    //! Lay out the slots of a table from its rules and known names.
+    static void
+    build (
+            Table * table);
+
+    //! Replace the current table and free the replaced ones once no
+    //! reader uses them; the caller holds the writer mutex.
+    void
+    publish (
+            Table * table);
+
+    AppLibMsgFilter (const AppLibMsgFilter &);
+    AppLibMsgFilter& operator=( const AppLibMsgFilter& );
+
+private:
+    std::mutex writer_mutex_; /**< serializes the changes */
+    std::atomic<Table *> table_; /**< the current version */
+    Table * retired_; /**< versions that were replaced (writer only) */
+    std::atomic<int> epoch_; /**< flipped by each publish() */
+    mutable ReaderShard shards_[ReaderShards]; /**< announced readers */
+};
+
+#endif // GUARD_APPLIB_MSGFILTER_H_INCLUDE
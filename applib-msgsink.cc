@@ -0,0 +1,242 @@
+/**
+ * @file applib-msgsink.cc
+ * @brief Definitions for AppLibMsgSink class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include "applib-msgsink.h"
+#include "applib-private.h"
+
+#include <QByteArray>
+#include <string.h>
+#include <chrono>
+
+//! Messages written with a single call, at most.
+#define APPLIB_SINK_BATCH 256
+
+//! How long the writer sleeps when nothing wakes it (milliseconds).
+#define APPLIB_SINK_IDLE_MS 50
+
+/* ------------------------------------------------------------------------- */
+static size_t roundUpPow2 (int value)
+{
+    size_t result = 16;
+    while (result < static_cast<size_t>(value))
+        result <<= 1;
+    return result;
+}
+/* ========================================================================= */
+
+/**
+ * @class AppLibMsgSink
+ *
+ * The producers (the threads that log through Qt) only claim a slot
+ * in a bounded multi-producer ring buffer and copy the raw UTF-16
+ * text in it. A single writer thread picks up the slots in order,
+ * converts and formats them and writes a whole batch with one call.
+ *
+ * When the ring is full the behaviour depends on the OverflowPolicy.
+ * flush() is used when the output must reach the stream before
+ * the caller continues, for example right before a fatal exit.
+ */
+
+/* ------------------------------------------------------------------------- */
+AppLibMsgSink::AppLibMsgSink (
+        int capacity, OverflowPolicy policy, FILE * output) :
+    slots_ (NULL),
+    mask_ (roundUpPow2 (capacity) - 1),
+    output_ (output),
+    policy_ (policy),
+    enqueue_pos_ (0),
+    dequeue_pos_ (0),
+    written_pos_ (0),
+    dropped_ (0),
+    reported_drops_ (0),
+    stop_ (false),
+    sleeping_ (false)
+{
+    APPLIB_TRACE_ENTRY;
+    slots_ = new Slot[mask_ + 1];
+    for (size_t i = 0; i <= mask_; ++i) {
+        slots_[i].seq.store (i, std::memory_order_relaxed);
+    }
+    writer_ = std::thread (&AppLibMsgSink::writerLoop, this);
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibMsgSink::~AppLibMsgSink ()
+{
+    APPLIB_TRACE_ENTRY;
+    stop_.store (true, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock (mutex_);
+        wake_cv_.notify_one ();
+    }
+    if (writer_.joinable ())
+        writer_.join ();
+    delete [] slots_;
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The prefix is expected to be a string literal; only the pointer is
+ * stored. Messages longer than SlotChars are truncated.
+ *
+ * @param prefix static text written in front of the message
+ * @param msg the text of the message
+ * @return false if the message was discarded
+ */
+bool AppLibMsgSink::post (const char * prefix, const QString & msg)
+{
+    Slot * slot;
+    size_t pos = enqueue_pos_.load (std::memory_order_relaxed);
+    for (;;) {
+        slot = &slots_[pos & mask_];
+        size_t seq = slot->seq.load (std::memory_order_acquire);
+        intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (dif == 0) {
+            if (enqueue_pos_.compare_exchange_weak (
+                        pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            // the ring is full
+            if (overflowPolicy () != BlockOnOverflow) {
+                dropped_.fetch_add (1, std::memory_order_relaxed);
+                return false;
+            }
+            wakeWriter ();
+            std::this_thread::yield ();
+            pos = enqueue_pos_.load (std::memory_order_relaxed);
+        } else {
+            pos = enqueue_pos_.load (std::memory_order_relaxed);
+        }
+    }
+
+    int len = msg.length ();
+    slot->truncated = len > SlotChars;
+    if (slot->truncated)
+        len = SlotChars;
+    slot->prefix = prefix;
+    slot->len = len;
+    memcpy (slot->text, msg.utf16 (), len * sizeof(ushort));
+    slot->seq.store (pos + 1, std::memory_order_release);
+
+    wakeWriter ();
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibMsgSink::flush ()
+{
+    size_t target = enqueue_pos_.load (std::memory_order_acquire);
+    if (writer_.get_id () == std::this_thread::get_id ()) {
+        drain ();
+        return;
+    }
+    std::unique_lock<std::mutex> lock (mutex_);
+    wake_cv_.notify_one ();
+    while (written_pos_.load (std::memory_order_acquire) < target) {
+        flush_cv_.wait_for (
+                    lock, std::chrono::milliseconds (APPLIB_SINK_IDLE_MS));
+        wake_cv_.notify_one ();
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibMsgSink::wakeWriter ()
+{
+    // pairs with the fence in writerLoop(); either we see the writer
+    // sleeping or the writer sees our slot before going to sleep
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    if (sleeping_.load (std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock (mutex_);
+        wake_cv_.notify_one ();
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int AppLibMsgSink::drain ()
+{
+    QByteArray batch;
+    int total = 0;
+    for (;;) {
+        int count = 0;
+        batch.clear ();
+        while (count < APPLIB_SINK_BATCH) {
+            Slot & slot = slots_[dequeue_pos_ & mask_];
+            size_t seq = slot.seq.load (std::memory_order_acquire);
+            if (seq != dequeue_pos_ + 1)
+                break;
+
+            batch.append (slot.prefix);
+            batch.append (QString::fromRawData (
+                              reinterpret_cast<const QChar*>(slot.text),
+                              slot.len).toLatin1 ());
+            if (slot.truncated)
+                batch.append ("...");
+            batch.append ('\n');
+
+            slot.seq.store (dequeue_pos_ + mask_ + 1,
+                            std::memory_order_release);
+            ++dequeue_pos_;
+            ++count;
+        }
+
+        quint64 drops = dropped_.load (std::memory_order_relaxed);
+        if ((drops != reported_drops_) &&
+                (overflowPolicy () == CountOnOverflow)) {
+            batch.append (QByteArray ("Q T: ") +
+                          QByteArray::number (drops - reported_drops_) +
+                          QByteArray (" messages dropped\n"));
+            reported_drops_ = drops;
+        }
+
+        if (batch.isEmpty ())
+            break;
+        fwrite (batch.constData (), 1, batch.size (), output_);
+        fflush (output_);
+        total += count;
+
+        written_pos_.store (dequeue_pos_, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock (mutex_);
+            flush_cv_.notify_all ();
+        }
+    }
+    return total;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibMsgSink::writerLoop ()
+{
+    for (;;) {
+        if (drain () > 0)
+            continue;
+        if (stop_.load (std::memory_order_acquire))
+            break;
+
+        std::unique_lock<std::mutex> lock (mutex_);
+        sleeping_.store (true, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_seq_cst);
+        Slot & slot = slots_[dequeue_pos_ & mask_];
+        if ((slot.seq.load (std::memory_order_acquire) != dequeue_pos_ + 1) &&
+                !stop_.load (std::memory_order_acquire)) {
+            wake_cv_.wait_for (
+                        lock, std::chrono::milliseconds (APPLIB_SINK_IDLE_MS));
+        }
+        sleeping_.store (false, std::memory_order_relaxed);
+    }
+    drain ();
+}
+/* ========================================================================= */
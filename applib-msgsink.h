@@ -0,0 +1,129 @@
+/**
+ * @file applib-msgsink.h
+ * @brief Declarations for AppLibMsgSink class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_APPLIB_MSGSINK_H_INCLUDE
+#define GUARD_APPLIB_MSGSINK_H_INCLUDE
+
+#include <applib/applib-config.h>
+#include <QString>
+
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+//! Asynchronous output for the messages comming from Qt.
+class APPLIB_EXPORT AppLibMsgSink {
+
+public:
+
+    //! What to do when the ring buffer is full.
+    enum OverflowPolicy {
+        DropOnOverflow, /**< silently discard the message */
+        BlockOnOverflow, /**< wait for the writer to make room */
+        CountOnOverflow /**< discard the message and report the count */
+    };
+
+    //! Number of characters stored for a message; the rest is truncated.
+    enum { SlotChars = 496 };
+
+    //! Constructor; the capacity is rounded up to a power of two.
+    AppLibMsgSink (
+            int capacity = 1024,
+            OverflowPolicy policy = CountOnOverflow,
+            FILE * output = stdout);
+
+    //! Destructor; writes pending messages and stops the writer.
+    ~AppLibMsgSink ();
+
+    //! Copy the message in the ring buffer; never formats or writes.
+    bool
+    post (
+            const char * prefix,
+            const QString & msg);
+
+    //! Wait until all messages posted so far have been written.
+    void
+    flush ();
+
+    //! The policy applied when the buffer is full.
+    OverflowPolicy
+    overflowPolicy () const {
+        return static_cast<OverflowPolicy>(
+                    policy_.load (std::memory_order_relaxed));
+    }
+
+    //! Change the policy applied when the buffer is full.
+    void
+    setOverflowPolicy (
+            OverflowPolicy value) {
+        policy_.store (value, std::memory_order_relaxed);
+    }
+
+    //! Number of messages that were discarded because of overflow.
+    quint64
+    dropped () const {
+        return dropped_.load (std::memory_order_relaxed);
+    }
+
+    //! Number of slots in the ring buffer.
+    int
+    capacity () const {
+        return static_cast<int>(mask_ + 1);
+    }
+
+private:
+
+    //! One entry in the ring.
+    struct Slot {
+        std::atomic<size_t> seq; /**< sequence used to hand over the slot */
+        const char * prefix; /**< static text printed in front */
+        int len; /**< number of characters in text */
+        bool truncated; /**< the message did not fit */
+        ushort text[SlotChars]; /**< raw UTF-16 copy of the message */
+    };
+
+    //! Writer thread entry point.
+    void
+    writerLoop ();
+
+    //! Write everything that is available; returns number of messages.
+    int
+    drain ();
+
+    //! Wake the writer if it is sleeping.
+    void
+    wakeWriter ();
+
+    AppLibMsgSink (const AppLibMsgSink &);
+    AppLibMsgSink& operator=( const AppLibMsgSink& );
+
+private:
+    Slot * slots_; /**< the ring buffer */
+    size_t mask_; /**< capacity - 1 */
+    FILE * output_; /**< where the messages end up */
+    std::atomic<int> policy_; /**< the OverflowPolicy in use */
+
+    std::atomic<size_t> enqueue_pos_; /**< next slot for producers */
+    size_t dequeue_pos_; /**< next slot for the writer (writer only) */
+    std::atomic<size_t> written_pos_; /**< everything before was written */
+
+    std::atomic<quint64> dropped_; /**< messages lost to overflow */
+    quint64 reported_drops_; /**< drops already reported (writer only) */
+
+    std::atomic<bool> stop_; /**< ask the writer to exit */
+    std::atomic<bool> sleeping_; /**< the writer waits for messages */
+    std::mutex mutex_; /**< protects the condition variables */
+    std::condition_variable wake_cv_; /**< wakes the writer */
+    std::condition_variable flush_cv_; /**< wakes those that flush */
+    std::thread writer_; /**< the thread doing the output */
+};
+
+#endif // GUARD_APPLIB_MSGSINK_H_INCLUDE
@@ -0,0 +1,221 @@
+/**
+ * @file applib-msgthrottle.cc
+ * @brief Definitions for AppLibMsgThrottle class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include "applib-msgthrottle.h"
+#include "applib-clock.h"
+#include "applib-private.h"
+
+#include <QCoreApplication>
+#include <string.h>
+
+//! Number of slots a fingerprint may occupy in the cache.
+#define APPLIB_THROTTLE_WAYS 4
+
+/* ------------------------------------------------------------------------- */
+static inline quint64 fnvBytes (quint64 hash, const void * data, size_t size)
+{
+    const uchar * p = static_cast<const uchar *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= p[i];
+        hash *= Q_UINT64_C(1099511628211);
+    }
+    return hash;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static inline quint64 fnvString (quint64 hash, const char * text)
+{
+    if (text == NULL)
+        return fnvBytes (hash, "", 1);
+    return fnvBytes (hash, text, strlen (text) + 1);
+}
+/* ========================================================================= */
+
+/**
+ * @class AppLibMsgThrottle
+ *
+ * Each message gets a fingerprint computed from its type, its text and
+ * the place in the source where it was generated. The fingerprints that
+ * were seen recently are kept in a small set-associative cache; each
+ * one has a token bucket that allows a burst of identical messages and
+ * then a steady rate. Messages for which there is no token are only
+ * counted.
+ *
+ * The counts are turned into "repeated N times" summaries every few
+ * seconds, when the fingerprint is evicted from the cache and when
+ * collect() is called. The cost of a message is thus bounded by the hash
+ * and one lookup, no matter how often it is generated.
+ */
+
+/* ------------------------------------------------------------------------- */
+AppLibMsgThrottle::AppLibMsgThrottle (
+        int burst, int per_second, int summary_ms) :
+    mutex_ (),
+    burst_ (0),
+    per_ns_ (0),
+    summary_ns_ (0),
+    last_summary_ns_ (AppLibClock::coarseNs ()),
+    total_suppressed_ (0)
+{
+    APPLIB_TRACE_ENTRY;
+    for (int i = 0; i < CacheSlots; ++i) {
+        cache_[i].fingerprint = 0;
+        cache_[i].type = QtDebugMsg;
+        cache_[i].tokens = 0;
+        cache_[i].refill_ns = 0;
+        cache_[i].suppressed = 0;
+    }
+    configure (burst, per_second, summary_ms);
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibMsgThrottle::~AppLibMsgThrottle ()
+{
+    APPLIB_TRACE_ENTRY;
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param burst identical messages that may be written back to back
+ * @param per_second identical messages written each second after the burst
+ * @param summary_ms how often the summaries are produced
+ */
+void AppLibMsgThrottle::configure (int burst, int per_second, int summary_ms)
+{
+    std::lock_guard<std::mutex> lock (mutex_);
+    burst_ = qMax (1, burst);
+    per_ns_ = qMax (0, per_second) / 1e9;
+    summary_ns_ = static_cast<qint64>(qMax (1, summary_ms)) * 1000000;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+quint64 AppLibMsgThrottle::fingerprint (
+        QtMsgType type, const QMessageLogContext & context,
+        const QString & msg)
+{
+    quint64 hash = Q_UINT64_C(14695981039346656037);
+    int value = type;
+    hash = fnvBytes (hash, &value, sizeof(value));
+    value = context.line;
+    hash = fnvBytes (hash, &value, sizeof(value));
+    hash = fnvString (hash, context.file);
+    hash = fnvString (hash, context.function);
+    hash = fnvBytes (hash, msg.constData (), msg.size () * sizeof(QChar));
+    // 0 marks the free slots
+    return (hash == 0 ? 1 : hash);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibMsgThrottle::summarize (Entry & entry, QList<Summary> & summaries)
+{
+    if (entry.suppressed == 0)
+        return;
+    Summary s;
+    s.type = entry.type;
+    s.text = QCoreApplication::translate (
+                "AppLib", "%1 (repeated %2 more times)")
+            .arg (entry.text)
+            .arg (entry.suppressed);
+    summaries.append (s);
+    entry.suppressed = 0;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param type the type of the message
+ * @param context where the message was generated
+ * @param msg the text of the message
+ * @param summaries (out) receives the summaries that are due; they
+ *      should be written before the message
+ * @return true if the message should be written
+ */
+bool AppLibMsgThrottle::admit (
+        QtMsgType type, const QMessageLogContext & context,
+        const QString & msg, QList<Summary> & summaries)
+{
+    const quint64 fp = fingerprint (type, context, msg);
+    const int set = static_cast<int>(
+                fp % (CacheSlots / APPLIB_THROTTLE_WAYS)) * APPLIB_THROTTLE_WAYS;
+
+    std::lock_guard<std::mutex> lock (mutex_);
+    const qint64 now = AppLibClock::coarseNs ();
+
+    if (now - last_summary_ns_ >= summary_ns_) {
+        last_summary_ns_ = now;
+        for (int i = 0; i < CacheSlots; ++i) {
+            summarize (cache_[i], summaries);
+        }
+    }
+
+    // look for the fingerprint or for the slot that was idle the longest
+    Entry * entry = NULL;
+    Entry * victim = &cache_[set];
+    for (int i = set; i < set + APPLIB_THROTTLE_WAYS; ++i) {
+        if (cache_[i].fingerprint == fp) {
+            entry = &cache_[i];
+            break;
+        }
+        if ((victim->fingerprint != 0) &&
+                ((cache_[i].fingerprint == 0) ||
+                 (cache_[i].refill_ns < victim->refill_ns))) {
+            victim = &cache_[i];
+        }
+    }
+
+    if (entry == NULL) {
+        summarize (*victim, summaries);
+        entry = victim;
+        entry->fingerprint = fp;
+        entry->type = type;
+        entry->tokens = burst_;
+        entry->refill_ns = now;
+        entry->suppressed = 0;
+        entry->text = msg.left (SummaryChars);
+    } else {
+        entry->tokens = qMin (
+                    burst_, entry->tokens + (now - entry->refill_ns) * per_ns_);
+        entry->refill_ns = now;
+    }
+
+    if (entry->tokens >= 1.0) {
+        entry->tokens -= 1.0;
+        return true;
+    }
+    ++entry->suppressed;
+    ++total_suppressed_;
+    return false;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibMsgThrottle::collect (QList<Summary> & summaries)
+{
+    std::lock_guard<std::mutex> lock (mutex_);
+    last_summary_ns_ = AppLibClock::coarseNs ();
+    for (int i = 0; i < CacheSlots; ++i) {
+        summarize (cache_[i], summaries);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+quint64 AppLibMsgThrottle::suppressed () const
+{
+    std::lock_guard<std::mutex> lock (mutex_);
+    return total_suppressed_;
+}
+/* ========================================================================= */
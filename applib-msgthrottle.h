@@ -0,0 +1,108 @@
+/**
+ * @file applib-msgthrottle.h
+ * @brief Declarations for AppLibMsgThrottle class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_APPLIB_MSGTHROTTLE_H_INCLUDE
+#define GUARD_APPLIB_MSGTHROTTLE_H_INCLUDE
+
+#include <applib/applib-config.h>
+#include <QString>
+#include <QList>
+#include <QtGlobal>
+
+#include <mutex>
+
+//! Suppresses the messages from Qt that repeat too often.
+class APPLIB_EXPORT AppLibMsgThrottle {
+
+public:
+
+    //! Number of distinct messages that are tracked at the same time.
+    enum { CacheSlots = 64 };
+
+    //! Number of characters of the message kept for the summary.
+    enum { SummaryChars = 120 };
+
+    //! A report about the copies of a message that were not written.
+    struct Summary {
+        QtMsgType type; /**< the type of the message */
+        QString text; /**< ready to be written, without the prefix */
+    };
+
+    //! Constructor.
+    AppLibMsgThrottle (
+            int burst = 10,
+            int per_second = 2,
+            int summary_ms = 5000);
+
+    //! Destructor.
+    ~AppLibMsgThrottle ();
+
+    //! Change the limits.
+    void
+    configure (
+            int burst,
+            int per_second,
+            int summary_ms);
+
+    //! Decide if a message is written; may produce summaries to write first.
+    bool
+    admit (
+            QtMsgType type,
+            const QMessageLogContext & context,
+            const QString & msg,
+            QList<Summary> & summaries);
+
+    //! Take the summaries for all the messages suppressed so far.
+    void
+    collect (
+            QList<Summary> & summaries);
+
+    //! Total number of messages that were suppressed.
+    quint64
+    suppressed () const;
+
+    //! The identity of a message: its type, text and source location.
+    static quint64
+    fingerprint (
+            QtMsgType type,
+            const QMessageLogContext & context,
+            const QString & msg);
+
+private:
+
+    //! A message that was seen recently.
+    struct Entry {
+        quint64 fingerprint; /**< 0 for a free slot */
+        QtMsgType type; /**< the type of the message */
+        double tokens; /**< messages that may still be written */
+        qint64 refill_ns; /**< when the tokens were last refilled */
+        quint64 suppressed; /**< copies not written since last summary */
+        QString text; /**< start of the message, for the summary */
+    };
+
+    //! Turn the suppressed count of an entry into a summary.
+    static void
+    summarize (
+            Entry & entry,
+            QList<Summary> & summaries);
+
+    AppLibMsgThrottle (const AppLibMsgThrottle &);
+    AppLibMsgThrottle& operator=( const AppLibMsgThrottle& );
+
+private:
+    mutable std::mutex mutex_; /**< protects everything below */
+    Entry cache_[CacheSlots]; /**< recent messages, by fingerprint */
+    double burst_; /**< capacity of each bucket */
+    double per_ns_; /**< tokens added each nanosecond */
+    qint64 summary_ns_; /**< interval between summaries */
+    qint64 last_summary_ns_; /**< when the summaries were last produced */
+    quint64 total_suppressed_; /**< over the life of the throttle */
+};
+
+#endif // GUARD_APPLIB_MSGTHROTTLE_H_INCLUDE
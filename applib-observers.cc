@@ -0,0 +1,239 @@
+/**
+ * @file applib-observers.cc
+ * @brief Definitions for AppLibObservers class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include "applib-observers.h"
+#include "applib-profiler.h"
+#include "applib-private.h"
+
+#include <QThread>
+#include <QMetaObject>
+
+/**
+ * @class AppLibObservers
+ *
+ * The observers are kept in an immutable, sorted snapshot that is
+ * replaced as a whole by add() and remove(). notify() only loads the
+ * current snapshot and walks it, so a transition never waits for a
+ * registration and observers may add or remove observers (the change
+ * is visible from the next event on).
+ *
+ * Readers announce themselves in a per-thread shard of counters tagged
+ * with an epoch, as AppLibMsgFilter does. A replaced snapshot is kept in
+ * the bucket of the epoch it was replaced in and is freed once the
+ * readers of that epoch and of the one before it are gone. Unlike the
+ * message filter the writers never wait for the readers: notify() runs
+ * arbitrary code and may itself change the observers. Snapshots that
+ * are still in use are freed by a later change or by the destructor.
+ *
+ * Observers with the same priority are called in the order they were
+ * added; higher priorities are called first.
+ */
+
+//! Spread the readers over the shards.
+static int readerShard ()
+{
+    static thread_local int thread = AppLibProfiler::currentThread ();
+    return thread;
+}
+
+/* ------------------------------------------------------------------------- */
+AppLibObservers::AppLibObservers () :
+    writer_mutex_ (),
+    list_ (new List ()),
+    epoch_ (0),
+    next_id_ (1)
+{
+    retired_[0] = NULL;
+    retired_[1] = NULL;
+    for (int i = 0; i < ReaderShards; ++i) {
+        shards_[i].readers[0].store (0, std::memory_order_relaxed);
+        shards_[i].readers[1].store (0, std::memory_order_relaxed);
+    }
+    list_.load ()->retired_next = NULL;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibObservers::~AppLibObservers ()
+{
+    delete list_.load ();
+    freeChain (retired_[0]);
+    freeChain (retired_[1]);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibObservers::freeChain (List * list)
+{
+    while (list != NULL) {
+        List * next = list->retired_next;
+        delete list;
+        list = next;
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int AppLibObservers::enterRead () const
+{
+    ReaderShard & shard = shards_[readerShard () % ReaderShards];
+    for (;;) {
+        const int epoch = epoch_.load (std::memory_order_seq_cst);
+        shard.readers[epoch & 1].fetch_add (1, std::memory_order_seq_cst);
+        // reclaim() may have advanced the epoch in the meantime
+        if (epoch_.load (std::memory_order_seq_cst) == epoch)
+            return epoch & 1;
+        shard.readers[epoch & 1].fetch_sub (1, std::memory_order_release);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibObservers::leaveRead (int token) const
+{
+    shards_[readerShard () % ReaderShards].readers[token].fetch_sub (
+                1, std::memory_order_release);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibObservers::publish (List * list)
+{
+    List * old = list_.exchange (list, std::memory_order_seq_cst);
+    const int parity = epoch_.load (std::memory_order_relaxed) & 1;
+    old->retired_next = retired_[parity];
+    retired_[parity] = old;
+    reclaim ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * A snapshot replaced in epoch e may be walked by the readers of e and
+ * of e - 1. When the readers of e - 1 are gone the epoch moves to e + 1
+ * and the bucket of e - 1 (the same parity) is freed; this is tried
+ * twice, so without readers everything replaced so far is freed.
+ */
+void AppLibObservers::reclaim ()
+{
+    for (int step = 0; step < 2; ++step) {
+        const int epoch = epoch_.load (std::memory_order_relaxed);
+        const int previous = (epoch - 1) & 1;
+        for (int i = 0; i < ReaderShards; ++i) {
+            if (shards_[i].readers[previous].load (
+                        std::memory_order_acquire) != 0)
+                return;
+        }
+        epoch_.store (epoch + 1, std::memory_order_seq_cst);
+        freeChain (retired_[previous]);
+        retired_[previous] = NULL;
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param callback the function to call
+ * @param priority observers with higher priority are called first
+ * @param affinity call directly or in the thread of the context
+ * @param context for ContextThread, the object whose thread is used;
+ *      the observer is no longer called once the context is destroyed
+ * @return the identifier of the observer
+ */
+int AppLibObservers::add (
+        Callback callback, int priority, Affinity affinity, QObject * context)
+{
+    Entry entry;
+    entry.id = next_id_.fetch_add (1, std::memory_order_relaxed);
+    entry.priority = priority;
+    entry.affinity = (context == NULL ? CallingThread : affinity);
+    entry.context = context;
+    entry.callback = callback;
+
+    std::lock_guard<std::mutex> lock (writer_mutex_);
+    const List * current = list_.load (std::memory_order_acquire);
+    List * fresh = new List ();
+    fresh->entries.reserve (current->entries.size () + 1);
+    bool inserted = false;
+    for (size_t i = 0; i < current->entries.size (); ++i) {
+        if (!inserted && (current->entries[i].priority < priority)) {
+            fresh->entries.push_back (entry);
+            inserted = true;
+        }
+        fresh->entries.push_back (current->entries[i]);
+    }
+    if (!inserted)
+        fresh->entries.push_back (entry);
+    publish (fresh);
+    return entry.id;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLibObservers::remove (int id)
+{
+    std::lock_guard<std::mutex> lock (writer_mutex_);
+    const List * current = list_.load (std::memory_order_acquire);
+    List * fresh = new List ();
+    bool found = false;
+    for (size_t i = 0; i < current->entries.size (); ++i) {
+        if (current->entries[i].id == id) {
+            found = true;
+        } else {
+            fresh->entries.push_back (current->entries[i]);
+        }
+    }
+    if (!found) {
+        delete fresh;
+        return false;
+    }
+    publish (fresh);
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int AppLibObservers::count () const
+{
+    const int token = enterRead ();
+    const int result = static_cast<int>(
+                list_.load (std::memory_order_seq_cst)->entries.size ());
+    leaveRead (token);
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibObservers::notify (AppLib * lib, Event event) const
+{
+    const int token = enterRead ();
+    const List * current = list_.load (std::memory_order_seq_cst);
+    const size_t count = current->entries.size ();
+    for (size_t i = 0; i < count; ++i) {
+        const Entry & entry = current->entries[i];
+        if (entry.affinity == CallingThread) {
+            entry.callback (lib, event);
+            continue;
+        }
+
+        QObject * context = entry.context.data ();
+        if (context == NULL)
+            continue;
+        if (context->thread () == QThread::currentThread ()) {
+            entry.callback (lib, event);
+        } else {
+            Callback callback = entry.callback;
+            QMetaObject::invokeMethod (context, [callback, lib, event] () {
+                callback (lib, event);
+            }, Qt::QueuedConnection);
+        }
+    }
+    leaveRead (token);
+}
+/* ========================================================================= */
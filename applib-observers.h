@@ -0,0 +1,141 @@
+/**
+ * @file applib-observers.h
+ * @brief Declarations for AppLibObservers class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_APPLIB_OBSERVERS_H_INCLUDE
+#define GUARD_APPLIB_OBSERVERS_H_INCLUDE
+
+#include <applib/applib-config.h>
+#include <QObject>
+#include <QPointer>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+class AppLib;
+
+//! Plain callables informed about the lifecycle of the library.
+class APPLIB_EXPORT AppLibObservers {
+
+public:
+
+    //! The lifecycle events; one for each signal of AppLib.
+    enum Event {
+        LibStarting,
+        LibStarted,
+        LibEnding,
+        LibEnded,
+        GuiStarting,
+        GuiStarted,
+        GuiEnding,
+        GuiEnded
+    };
+
+    //! Where the observer is called.
+    enum Affinity {
+        CallingThread, /**< directly, in the thread making the transition */
+        ContextThread /**< queued to the thread of the context object */
+    };
+
+    //! The signature of an observer.
+    typedef std::function<void (AppLib * lib, Event event)> Callback;
+
+    //! Default constructor.
+    AppLibObservers ();
+
+    //! Destructor.
+    ~AppLibObservers ();
+
+    //! Add an observer; returns an identifier for remove().
+    int
+    add (
+            Callback callback,
+            int priority = 0,
+            Affinity affinity = CallingThread,
+            QObject * context = NULL);
+
+    //! Remove an observer.
+    bool
+    remove (
+            int id);
+
+    //! Number of observers.
+    int
+    count () const;
+
+    //! Call the observers for an event.
+    void
+    notify (
+            AppLib * lib,
+            Event event) const;
+
+private:
+
+    //! One observer.
+    struct Entry {
+        int id; /**< the identifier returned by add() */
+        int priority; /**< higher values are called first */
+        Affinity affinity; /**< where to call it */
+        QPointer<QObject> context; /**< for queued calls */
+        Callback callback; /**< the observer */
+    };
+
+    //! An immutable snapshot of the observers.
+    struct List {
+        std::vector<Entry> entries; /**< sorted by priority */
+        List * retired_next; /**< chain of replaced lists */
+    };
+
+    //! Readers of the snapshots, by epoch parity; one cache line each.
+    struct alignas(64) ReaderShard {
+        std::atomic<int> readers[2]; /**< readers inside each epoch */
+    };
+
+    //! Number of reader shards.
+    enum {
+        ReaderShards = 16
+    };
+
+    //! Announce a reader; returns what leaveRead() needs.
+    int
+    enterRead () const;
+
+    //! A reader is done with the snapshot it loaded.
+    void
+    leaveRead (
+            int token) const;
+
+    //! Replace the current snapshot; the caller holds the writer mutex.
+    void
+    publish (
+            List * list);
+
+    //! Free the replaced snapshots no reader can see; never waits.
+    void
+    reclaim ();
+
+    //! Free a chain of replaced snapshots.
+    static void
+    freeChain (
+            List * list);
+
+    AppLibObservers (const AppLibObservers &);
+    AppLibObservers& operator=( const AppLibObservers& );
+
+private:
+    std::mutex writer_mutex_; /**< serializes add() and remove() */
+    std::atomic<List *> list_; /**< the current snapshot */
+    List * retired_[2]; /**< replaced snapshots by epoch parity (writer only) */
+    std::atomic<int> epoch_; /**< advanced by reclaim() */
+    mutable ReaderShard shards_[ReaderShards]; /**< announced readers */
+    std::atomic<int> next_id_; /**< source of identifiers */
+};
+
+#endif // GUARD_APPLIB_OBSERVERS_H_INCLUDE
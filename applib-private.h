@@ -12,27 +12,29 @@
 
 #include <applib/applib-config.h>
 #include "applib-util.h"
+#include "applib-log.h"
+#include "applib-trace.h"
 
-#if 0
-#    define APPLIB_DEBUGM printf
-#else
-#    define APPLIB_DEBUGM black_hole
-#endif
-
-#if 0
-#    define APPLIB_TRACE_ENTRY APPLIB_ENTRY("APPLIB")
-#else
-#    define APPLIB_TRACE_ENTRY
-#endif
+/**
+ * @def APPLIB_DEBUGM
+ * @brief Debug message in APPLIB category; arguments are evaluated
+ * only if the category is enabled at Debug level.
+ */
+#define APPLIB_DEBUGM(...) \
+    APPLIB_LOG (AppLibLog::AppLibCat, AppLibLog::Debug, __VA_ARGS__)
 
-#if 0
-#    define APPLIB_TRACE_EXIT APPLIB_EXIT("APPLIB")
-#else
-#    define APPLIB_TRACE_EXIT
-#endif
+/**
+ * @def APPLIB_TRACE_ENTRY
+ * @brief Trace the rest of the function as a zone in APPLIB category;
+ * recorded only while AppLibTrace is enabled.
+ */
+#define APPLIB_TRACE_ENTRY APPLIB_TRACE_FUNCTION("APPLIB")
 
+/**
+ * @def APPLIB_TRACE_EXIT
+ * @brief The zone started by APPLIB_TRACE_ENTRY ends with the scope.
+ */
+#define APPLIB_TRACE_EXIT
 
-static inline void black_hole (...)
-{}
 
 #endif // GUARD_APPLIB_PRIVATE_H_INCLUDE
@@ -0,0 +1,282 @@
+/**
+ * @file applib-profiler.cc
+ * @brief Definitions for AppLibProfiler class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include "applib-profiler.h"
+#include "applib-clock.h"
+#include "applib-private.h"
+
+#include <QFile>
+#include <QCoreApplication>
+
+#include <atomic>
+
+/**
+ * @class AppLibProfiler
+ *
+ * Spans are opened with begin() and closed with end(); the AppLibPhase
+ * class and the APPLIB_PHASE macro do this for a scope. A span opened
+ * while another span is open on the same thread becomes its child,
+ * so the result is a tree (or a forest, as each thread starts its own).
+ *
+ * Time is taken from a monotonic clock with nanosecond resolution.
+ * The intended use is for coarse phases (tens to thousands per run),
+ * so the spans are kept in a vector guarded by a mutex. The innermost
+ * open span of each thread is kept by the profiler as well, indexed by
+ * currentThread(), so several profilers can be used on the same thread
+ * without breaking each other's nesting.
+ */
+
+//! source for the small thread identifiers
+static std::atomic<int> thread_counter_ (0);
+
+/* ------------------------------------------------------------------------- */
+qint64 AppLibProfiler::Span::duration () const
+{
+    qint64 stop = (end_ns == -1 ? AppLibProfiler::nowNs () : end_ns);
+    return stop - begin_ns;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibProfiler::AppLibProfiler ()
+{
+    spans_.reserve (64);
+    open_spans_.reserve (8);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibProfiler::~AppLibProfiler ()
+{
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+qint64 AppLibProfiler::nowNs ()
+{
+    return AppLibClock::nowNs ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int AppLibProfiler::currentThread ()
+{
+    static thread_local int id = thread_counter_.fetch_add (1) + 1;
+    return id;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param name the name of the phase
+ * @return the index of the new span, to be passed to end()
+ */
+int AppLibProfiler::begin (const QString & name)
+{
+    Span span;
+    span.name = name;
+    span.thread = currentThread ();
+    span.end_ns = -1;
+
+    std::lock_guard<std::mutex> lock (mutex_);
+    const size_t slot = static_cast<size_t>(span.thread);
+    if (slot >= open_spans_.size ())
+        open_spans_.resize (slot + 1, -1);
+    span.parent = open_spans_[slot];
+    span.depth = (span.parent == -1 ? 0 : spans_[span.parent].depth + 1);
+    span.begin_ns = nowNs ();
+    spans_.push_back (span);
+    open_spans_[slot] = static_cast<int>(spans_.size () - 1);
+    return open_spans_[slot];
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibProfiler::end (int id)
+{
+    qint64 now = nowNs ();
+    std::lock_guard<std::mutex> lock (mutex_);
+    if ((id < 0) || (id >= static_cast<int>(spans_.size ())))
+        return;
+    Span & span = spans_[id];
+    if (span.end_ns == -1)
+        span.end_ns = now;
+    // the thread that opened it, which is not always the caller
+    int & open = open_spans_[static_cast<size_t>(span.thread)];
+    if (open == id)
+        open = span.parent;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+QList<AppLibProfiler::Span> AppLibProfiler::spans () const
+{
+    QList<Span> result;
+    std::lock_guard<std::mutex> lock (mutex_);
+    result.reserve (static_cast<int>(spans_.size ()));
+    for (size_t i = 0; i < spans_.size (); ++i) {
+        result.append (spans_[i]);
+    }
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+QList<int> AppLibProfiler::children (int parent) const
+{
+    QList<int> result;
+    std::lock_guard<std::mutex> lock (mutex_);
+    for (size_t i = 0; i < spans_.size (); ++i) {
+        if (spans_[i].parent == parent)
+            result.append (static_cast<int>(i));
+    }
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int AppLibProfiler::find (const QString & name) const
+{
+    std::lock_guard<std::mutex> lock (mutex_);
+    for (size_t i = 0; i < spans_.size (); ++i) {
+        if (spans_[i].name == name)
+            return static_cast<int>(i);
+    }
+    return -1;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static void treeAppend (
+        const QList<AppLibProfiler::Span> & all, int parent, QString & out)
+{
+    for (int i = 0; i < all.count (); ++i) {
+        const AppLibProfiler::Span & span = all.at (i);
+        if (span.parent != parent)
+            continue;
+        out += QString (span.depth * 2, QChar (' '));
+        out += QString (QLatin1String ("%1 %2 ms%3\n"))
+                .arg (span.name)
+                .arg (static_cast<double>(span.duration ()) / 1000000.0, 0, 'f', 3)
+                .arg (span.end_ns == -1 ?
+                          QString (QLatin1String (" (open)")) : QString ());
+        treeAppend (all, i, out);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Each line contains the name of the phase and its duration in
+ * milliseconds, indented two spaces for each enclosing phase.
+ */
+QString AppLibProfiler::toTreeString () const
+{
+    QString result;
+    treeAppend (spans (), -1, result);
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static void jsonEscape (const QString & s, QByteArray & out)
+{
+    QByteArray utf8 = s.toUtf8 ();
+    for (int i = 0; i < utf8.size (); ++i) {
+        char c = utf8.at (i);
+        switch (c) {
+        case '"': out.append ("\\\""); break;
+        case '\\': out.append ("\\\\"); break;
+        case '\n': out.append ("\\n"); break;
+        case '\t': out.append ("\\t"); break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                snprintf (buf, sizeof(buf), "\\u%04x", c);
+                out.append (buf);
+            } else {
+                out.append (c);
+            }
+        }
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Each span becomes a complete ("X") event with the times expressed in
+ * microseconds relative to the first span. The result can be loaded in
+ * chrome://tracing or in the Perfetto UI. Open spans extend to now.
+ */
+QByteArray AppLibProfiler::toChromeTrace () const
+{
+    QList<Span> all = spans ();
+    qint64 origin = (all.isEmpty () ? 0 : all.at (0).begin_ns);
+    qint64 pid = QCoreApplication::applicationPid ();
+
+    QByteArray result ("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (int i = 0; i < all.count (); ++i) {
+        const Span & span = all.at (i);
+        if (i > 0)
+            result.append (',');
+        result.append ("\n{\"name\":\"");
+        jsonEscape (span.name, result);
+        result.append ("\",\"cat\":\"applib\",\"ph\":\"X\",\"ts\":");
+        result.append (QByteArray::number (
+                           static_cast<double>(span.begin_ns - origin) / 1000.0,
+                           'f', 3));
+        result.append (",\"dur\":");
+        result.append (QByteArray::number (
+                           static_cast<double>(span.duration ()) / 1000.0,
+                           'f', 3));
+        result.append (",\"pid\":");
+        result.append (QByteArray::number (pid));
+        result.append (",\"tid\":");
+        result.append (QByteArray::number (span.thread));
+        result.append ('}');
+    }
+    result.append ("\n]}\n");
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLibProfiler::saveChromeTrace (const QString & file) const
+{
+    QFile f (file);
+    if (!f.open (QIODevice::WriteOnly | QIODevice::Truncate)) {
+        APPLIB_DEBUGM("Cannot write trace file %s\n", TMP_A(file));
+        return false;
+    }
+    QByteArray data = toChromeTrace ();
+    return f.write (data) == data.size ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Nothing is removed while a span is open, so that the phases in
+ * progress can still be closed and keep their parents.
+ */
+void AppLibProfiler::clear ()
+{
+    std::lock_guard<std::mutex> lock (mutex_);
+    bool any_open = false;
+    for (size_t i = 0; i < spans_.size (); ++i) {
+        if (spans_[i].end_ns == -1) {
+            any_open = true;
+            break;
+        }
+    }
+    if (!any_open) {
+        spans_.clear ();
+        open_spans_.clear ();
+    }
+}
+/* ========================================================================= */
@@ -0,0 +1,147 @@
+/**
+ * @file applib-profiler.h
+ * @brief Declarations for AppLibProfiler class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_APPLIB_PROFILER_H_INCLUDE
+#define GUARD_APPLIB_PROFILER_H_INCLUDE
+
+#include <applib/applib-config.h>
+#include <QString>
+#include <QByteArray>
+#include <QList>
+
+#include <mutex>
+#include <vector>
+
+//! Records nested, named phases (start-up, shut-down, ...).
+class APPLIB_EXPORT AppLibProfiler {
+
+public:
+
+    //! One recorded phase.
+    struct Span {
+        QString name; /**< the name of the phase */
+        int parent; /**< index of the enclosing span or -1 */
+        int depth; /**< number of enclosing spans */
+        int thread; /**< small integer identifying the thread */
+        qint64 begin_ns; /**< monotonic start time in nanoseconds */
+        qint64 end_ns; /**< monotonic end time or -1 while open */
+
+        //! Duration in nanoseconds (up to now for open spans).
+        qint64
+        duration () const;
+    };
+
+    //! Default constructor.
+    AppLibProfiler ();
+
+    //! Destructor.
+    ~AppLibProfiler ();
+
+    //! Open a span nested in the current span of this thread.
+    int
+    begin (
+            const QString & name);
+
+    //! Close a span opened by begin().
+    void
+    end (
+            int id);
+
+    //! A copy of all the spans recorded so far, in start order.
+    QList<Span>
+    spans () const;
+
+    //! Indexes of the spans directly enclosed by a span (-1 for roots).
+    QList<int>
+    children (
+            int parent) const;
+
+    //! Find the first span with this name; -1 if none.
+    int
+    find (
+            const QString & name) const;
+
+    //! Human readable tree of the spans with their durations.
+    QString
+    toTreeString () const;
+
+    //! The spans in Chrome / Perfetto trace event JSON format.
+    QByteArray
+    toChromeTrace () const;
+
+    //! Save the spans in Chrome / Perfetto trace event JSON format.
+    bool
+    saveChromeTrace (
+            const QString & file) const;
+
+    //! Forget all the spans if none of them is open.
+    void
+    clear ();
+
+    //! Monotonic time in nanoseconds (same as AppLibClock::nowNs()).
+    static qint64
+    nowNs ();
+
+    //! Small integer identifying the calling thread.
+    static int
+    currentThread ();
+
+private:
+
+    AppLibProfiler (const AppLibProfiler &);
+    AppLibProfiler& operator=( const AppLibProfiler& );
+
+private:
+    mutable std::mutex mutex_; /**< protects spans_ and open_spans_ */
+    std::vector<Span> spans_; /**< all recorded spans */
+    std::vector<int> open_spans_; /**< innermost open span by thread id */
+};
+
+
+//! Opens a span on construction and closes it on destruction.
+class APPLIB_EXPORT AppLibPhase {
+
+public:
+
+    //! Constructor; a NULL profiler makes this a no-op.
+    AppLibPhase (
+            AppLibProfiler * profiler,
+            const QString & name) :
+        profiler_ (profiler),
+        id_ (profiler == NULL ? -1 : profiler->begin (name))
+    {}
+
+    //! Destructor.
+    ~AppLibPhase () {
+        if (profiler_ != NULL)
+            profiler_->end (id_);
+    }
+
+private:
+
+    AppLibPhase (const AppLibPhase &);
+    AppLibPhase& operator=( const AppLibPhase& );
+
+    AppLibProfiler * profiler_; /**< where the span was recorded */
+    int id_; /**< the index of the span */
+};
+
+
+/**
+ * @def APPLIB_PHASE
+ * @brief Record the rest of the enclosing scope as a named phase
+ * in the profiler of the AppLib instance.
+ */
+#define APPLIB_PHASE(__name__) \
+    AppLibPhase APPLIB_PHASE_VAR(__LINE__) ( \
+        AppLib::profiler (), QLatin1String (__name__))
+#define APPLIB_PHASE_VAR(__l__) APPLIB_PHASE_VAR_HELPER(__l__)
+#define APPLIB_PHASE_VAR_HELPER(__l__) applib_phase_ ## __l__
+
+#endif // GUARD_APPLIB_PROFILER_H_INCLUDE
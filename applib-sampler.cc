@@ -0,0 +1,301 @@
+/**
+ * @file applib-sampler.cc
+ * @brief Definitions for AppLibSampler class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include "applib-sampler.h"
+#include "applib-profiler.h"
+#include "applib-private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#if defined(__linux__)
+#   include <dirent.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+/**
+ * @class AppLibSampler
+ *
+ * A thread wakes up every interval and reads the counters of the
+ * process (on Linux from /proc/self, without allocating). The values
+ * that only grow (CPU time, page faults) are turned into rates over
+ * the interval; the others are taken as they are.
+ *
+ * Each sample is added to the summary of the current phase and
+ * resource: the count, minimum, maximum, sum and a log-linear
+ * histogram with the buckets of AppLibMetrics::Histogram, so the
+ * memory used does not depend on how long the process runs. The
+ * owner decides what the phases are (AppLib uses its states) and
+ * pauses sampling with a phase of -1.
+ */
+
+//! number of summaries (the enums are not multiplied directly, C++20
+//! deprecates arithmetic between two different enumerations)
+static const int summary_count =
+        static_cast<int>(AppLibSampler::MaxPhases) *
+        static_cast<int>(AppLibSampler::ResourceCount);
+
+/* ------------------------------------------------------------------------- */
+quint64 AppLibSampler::Summary::percentile (double q) const
+{
+    if (count == 0)
+        return 0;
+    quint64 rank = static_cast<quint64>(q * static_cast<double>(count));
+    if (rank >= count)
+        rank = count - 1;
+    quint64 seen = 0;
+    for (int i = 0; i < AppLibMetrics::Histogram::Buckets; ++i) {
+        seen += buckets[i];
+        if (seen > rank)
+            return qMin (AppLibMetrics::Histogram::upperBound (i), max);
+    }
+    return max;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibSampler::AppLibSampler () :
+    mutex_ (),
+    summaries_ (new Summary[summary_count]),
+    phase_ (-1),
+    thread_mutex_ (),
+    thread_cv_ (),
+    thread_stop_ (false),
+    thread_ ()
+{
+    APPLIB_TRACE_ENTRY;
+    memset (summaries_, 0, sizeof(Summary) * summary_count);
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibSampler::~AppLibSampler ()
+{
+    APPLIB_TRACE_ENTRY;
+    stop ();
+    delete [] summaries_;
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The process is read once before starting the thread, so the first
+ * rates cover a full interval.
+ *
+ * @return false if the counters of the process can't be read here
+ */
+bool AppLibSampler::start (int interval_ms)
+{
+    stop ();
+    Reading probe;
+    if (!read (probe))
+        return false;
+    thread_stop_ = false;
+    thread_ = std::thread (&AppLibSampler::samplerLoop, this,
+                           qMax (interval_ms, 10));
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibSampler::stop ()
+{
+    if (!thread_.joinable ())
+        return;
+    {
+        std::lock_guard<std::mutex> lock (thread_mutex_);
+        thread_stop_ = true;
+    }
+    thread_cv_.notify_all ();
+    thread_.join ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibSampler::add (Summary & s, quint64 value)
+{
+    if ((s.count == 0) || (value < s.min))
+        s.min = value;
+    if (value > s.max)
+        s.max = value;
+    ++s.count;
+    s.sum += value;
+    ++s.buckets[AppLibMetrics::Histogram::bucketOf (value)];
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibSampler::samplerLoop (int interval_ms)
+{
+    Reading previous;
+    read (previous);
+    qint64 previous_ns = AppLibProfiler::nowNs ();
+
+    std::unique_lock<std::mutex> lock (thread_mutex_);
+    for (;;) {
+        if (thread_cv_.wait_for (lock, std::chrono::milliseconds (interval_ms),
+                                 [this] { return thread_stop_; }))
+            return;
+
+        Reading current;
+        if (!read (current))
+            continue;
+        const qint64 now_ns = AppLibProfiler::nowNs ();
+        const double seconds = static_cast<double>(
+                    qMax (now_ns - previous_ns, Q_INT64_C(1))) / 1e9;
+        const int phase = phase_.load (std::memory_order_relaxed);
+        if ((phase >= 0) && (phase < MaxPhases)) {
+            quint64 values[ResourceCount];
+            values[ResidentBytes] = current.resident_bytes;
+            values[CpuMsPerSecond] = static_cast<quint64>(
+                        (current.cpu_ms - previous.cpu_ms) / seconds);
+            values[MinorFaultsPerSecond] = static_cast<quint64>(
+                        (current.minor_faults - previous.minor_faults) /
+                        seconds);
+            values[MajorFaultsPerSecond] = static_cast<quint64>(
+                        (current.major_faults - previous.major_faults) /
+                        seconds);
+            values[Threads] = current.threads;
+            values[OpenFiles] = current.open_files;
+
+            std::lock_guard<std::mutex> summaries_lock (mutex_);
+            for (int r = 0; r < ResourceCount; ++r)
+                add (summaries_[phase * ResourceCount + r], values[r]);
+        }
+        previous = current;
+        previous_ns = now_ns;
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibSampler::Summary AppLibSampler::summary (
+        int phase, Resource resource) const
+{
+    Summary result;
+    memset (&result, 0, sizeof(result));
+    if ((phase < 0) || (phase >= MaxPhases) ||
+            (resource < 0) || (resource >= ResourceCount))
+        return result;
+    std::lock_guard<std::mutex> lock (mutex_);
+    result = summaries_[phase * ResourceCount + resource];
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param phase_names the names of the phases, by index
+ * @return one line per phase and resource: minimum, median, 95th
+ *      percentile and maximum
+ */
+QString AppLibSampler::report (const QStringList & phase_names) const
+{
+    static const char * resource_names[] = {
+        "rss (KiB)", "cpu (ms/s)", "minor faults/s", "major faults/s",
+        "threads", "open files"
+    };
+    QString result;
+    char line[160];
+    std::lock_guard<std::mutex> lock (mutex_);
+    for (int p = 0; p < MaxPhases; ++p) {
+        if (summaries_[p * ResourceCount].count == 0)
+            continue;
+        QByteArray phase = (p < phase_names.count () ?
+                                phase_names.at (p).toUtf8 () :
+                                QByteArray::number (p));
+        snprintf (line, sizeof(line), "%s: %llu samples\n",
+                  phase.constData (), static_cast<unsigned long long>(
+                      summaries_[p * ResourceCount].count));
+        result.append (QString::fromUtf8 (line));
+        for (int r = 0; r < ResourceCount; ++r) {
+            const Summary & s = summaries_[p * ResourceCount + r];
+            const quint64 div = (r == ResidentBytes ? 1024 : 1);
+            snprintf (line, sizeof(line),
+                      "    %-16s min %10llu  p50 %10llu  "
+                      "p95 %10llu  max %10llu\n",
+                      resource_names[r],
+                      static_cast<unsigned long long>(s.min / div),
+                      static_cast<unsigned long long>(s.percentile (0.5) / div),
+                      static_cast<unsigned long long>(s.percentile (0.95) / div),
+                      static_cast<unsigned long long>(s.max / div));
+            result.append (QString::fromLatin1 (line));
+        }
+    }
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Only Linux is supported for now; elsewhere the function returns false
+ * and start() refuses to run.
+ */
+bool AppLibSampler::read (Reading & out)
+{
+    memset (&out, 0, sizeof(out));
+#if defined(__linux__)
+    char buffer[1024];
+    int fd = ::open ("/proc/self/stat", O_RDONLY);
+    if (fd == -1)
+        return false;
+    ssize_t size = ::read (fd, buffer, sizeof(buffer) - 1);
+    ::close (fd);
+    if (size <= 0)
+        return false;
+    buffer[size] = 0;
+
+    // the name of the command may hold spaces and parentheses
+    const char * p = strrchr (buffer, ')');
+    if (p == NULL)
+        return false;
+    p += 2;
+    // skip the state (field 3)
+    while ((*p != ' ') && (*p != 0))
+        ++p;
+
+    // fields 4 to 24 of proc(5)
+    unsigned long long fields[21];
+    for (int i = 0; i < 21; ++i) {
+        char * end;
+        fields[i] = strtoull (p, &end, 10);
+        if (end == p)
+            return false;
+        p = end;
+    }
+    static const long ticks = sysconf (_SC_CLK_TCK);
+    static const long page = sysconf (_SC_PAGESIZE);
+    out.minor_faults = fields[10 - 4];
+    out.major_faults = fields[12 - 4];
+    out.cpu_ms = (fields[14 - 4] + fields[15 - 4]) * 1000 / ticks;
+    out.threads = fields[20 - 4];
+    out.resident_bytes = fields[24 - 4] * page;
+
+    DIR * dir = opendir ("/proc/self/fd");
+    if (dir != NULL) {
+        quint64 count = 0;
+        while (struct dirent * entry = readdir (dir)) {
+            if (entry->d_name[0] != '.')
+                ++count;
+        }
+        closedir (dir);
+        // the descriptor of the directory itself
+        out.open_files = (count > 0 ? count - 1 : 0);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+/* ========================================================================= */
@@ -0,0 +1,133 @@
+/**
+ * @file applib-sampler.h
+ * @brief Declarations for AppLibSampler class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_APPLIB_SAMPLER_H_INCLUDE
+#define GUARD_APPLIB_SAMPLER_H_INCLUDE
+
+#include <applib/applib-config.h>
+#include <applib/applib-metrics.h>
+#include <QString>
+#include <QStringList>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+//! Samples the resources used by the process in a background thread.
+class APPLIB_EXPORT AppLibSampler {
+
+public:
+
+    //! The values that are sampled.
+    enum Resource {
+        ResidentBytes = 0,
+        CpuMsPerSecond,
+        MinorFaultsPerSecond,
+        MajorFaultsPerSecond,
+        Threads,
+        OpenFiles,
+
+        ResourceCount
+    };
+
+    //! Maximum number of phases the samples are grouped by.
+    enum {
+        MaxPhases = 8
+    };
+
+    //! The raw counters of the process.
+    struct Reading {
+        quint64 resident_bytes; /**< resident set size */
+        quint64 cpu_ms; /**< user and system time */
+        quint64 minor_faults; /**< page faults without I/O */
+        quint64 major_faults; /**< page faults with I/O */
+        quint64 threads; /**< number of threads */
+        quint64 open_files; /**< number of file descriptors */
+    };
+
+    //! The distribution of a resource in a phase, in fixed memory.
+    struct Summary {
+        quint64 count; /**< number of samples */
+        quint64 min; /**< smallest sample */
+        quint64 max; /**< largest sample */
+        quint64 sum; /**< sum of the samples */
+        quint32 buckets[AppLibMetrics::Histogram::Buckets]; /**< samples */
+
+        //! Upper bound of the bucket that holds the q-th quantile.
+        quint64
+        percentile (
+                double q) const;
+    };
+
+    //! Default constructor.
+    AppLibSampler ();
+
+    //! Destructor; stops the thread.
+    ~AppLibSampler ();
+
+    //! Start sampling every interval_ms.
+    bool
+    start (
+            int interval_ms = 1000);
+
+    //! Stop sampling.
+    void
+    stop ();
+
+    //! The samples from now on belong to this phase; -1 pauses sampling.
+    void
+    setPhase (
+            int phase) {
+        phase_.store (phase, std::memory_order_relaxed);
+    }
+
+    //! The summary of a resource in a phase.
+    Summary
+    summary (
+            int phase,
+            Resource resource) const;
+
+    //! A table with the summaries of the phases that have samples.
+    QString
+    report (
+            const QStringList & phase_names) const;
+
+    //! Read the counters of the process (false where not supported).
+    static bool
+    read (
+            Reading & out);
+
+private:
+
+    //! Body of the sampling thread.
+    void
+    samplerLoop (
+            int interval_ms);
+
+    //! Add one sample to a summary; the mutex is held.
+    static void
+    add (
+            Summary & s,
+            quint64 value);
+
+    AppLibSampler (const AppLibSampler &);
+    AppLibSampler& operator=( const AppLibSampler& );
+
+private:
+    mutable std::mutex mutex_; /**< protects the summaries */
+    Summary * summaries_; /**< MaxPhases x ResourceCount */
+    std::atomic<int> phase_; /**< where the samples go; -1 for nowhere */
+    std::mutex thread_mutex_; /**< used by the thread */
+    std::condition_variable thread_cv_; /**< wakes the thread */
+    bool thread_stop_; /**< ask the thread to exit */
+    std::thread thread_; /**< takes the samples */
+};
+
+#endif // GUARD_APPLIB_SAMPLER_H_INCLUDE
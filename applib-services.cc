@@ -0,0 +1,153 @@
+/**
+ * @file applib-services.cc
+ * @brief Definitions for AppLibServices class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include "applib-services.h"
+#include "applib-private.h"
+
+#include <QByteArray>
+#include <QHash>
+
+/**
+ * @class AppLibServices
+ *
+ * The library registers a factory for each of its services while it
+ * initializes (AppLib seals the registry when it leaves
+ * InitializingState); nothing is created until get() asks for it.
+ *
+ * Each service type is interned once per process into a small integer
+ * key, so get() is an array access and an atomic load once the service
+ * exists. The first get() runs the factory under std::call_once:
+ * concurrent callers wait for that single construction.
+ *
+ * A factory may get() the services it depends on; those are finished
+ * first, so destroyAll(), which runs in the reverse order of creation,
+ * destroys a service before its dependencies. Factories must not
+ * depend on each other in a circle.
+ */
+
+//! protects interned_keys_
+static std::mutex interned_mutex_;
+
+//! the keys given to the names of the services
+static QHash<QByteArray, int> interned_keys_;
+
+/* ------------------------------------------------------------------------- */
+AppLibServices::AppLibServices () :
+    entries_ (new Entry[MaxServices]),
+    sealed_ (false),
+    mutex_ (),
+    created_ ()
+{
+    APPLIB_TRACE_ENTRY;
+    for (int i = 0; i < MaxServices; ++i)
+        entries_[i].instance.store (NULL, std::memory_order_relaxed);
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibServices::~AppLibServices ()
+{
+    APPLIB_TRACE_ENTRY;
+    destroyAll ();
+    delete [] entries_;
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int AppLibServices::internKey (const char * name)
+{
+    std::lock_guard<std::mutex> lock (interned_mutex_);
+    QByteArray key (name);
+    QHash<QByteArray, int>::const_iterator it = interned_keys_.constFind (key);
+    if (it != interned_keys_.constEnd ())
+        return it.value ();
+    if (interned_keys_.count () >= MaxServices) {
+        APPLIB_DEBUGM("Too many service types; %s ignored\n", name);
+        return -1;
+    }
+    const int result = interned_keys_.count ();
+    interned_keys_.insert (key, result);
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param key from keyOf() or internKey()
+ * @param factory creates the service
+ * @param deleter destroys what the factory created
+ * @return false if the registry is sealed or the service has a factory
+ */
+bool AppLibServices::registerFactory (
+        int key, Factory factory, Deleter deleter)
+{
+    if ((key < 0) || (key >= MaxServices) ||
+            sealed_.load (std::memory_order_acquire))
+        return false;
+    std::lock_guard<std::mutex> lock (mutex_);
+    Entry & e = entries_[key];
+    if (e.factory)
+        return false;
+    e.factory = factory;
+    e.deleter = deleter;
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void * AppLibServices::create (int key)
+{
+    Entry & e = entries_[key];
+    Factory factory;
+    {
+        std::lock_guard<std::mutex> lock (mutex_);
+        factory = e.factory;
+    }
+    if (!factory)
+        return NULL;
+
+    std::call_once (e.once, [this, &e, &factory, key] () {
+        void * p = factory ();
+        {
+            std::lock_guard<std::mutex> lock (mutex_);
+            created_.push_back (key);
+        }
+        e.instance.store (p, std::memory_order_release);
+    });
+    // NULL once destroyAll() ran; services are not created again
+    return e.instance.load (std::memory_order_acquire);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Must not race with get(); AppLib calls it after _end().
+ */
+void AppLibServices::destroyAll ()
+{
+    std::vector<int> order;
+    {
+        std::lock_guard<std::mutex> lock (mutex_);
+        order.swap (created_);
+    }
+    for (size_t i = order.size (); i > 0; --i) {
+        Entry & e = entries_[order[i - 1]];
+        void * p = e.instance.exchange (NULL, std::memory_order_acq_rel);
+        Deleter deleter;
+        {
+            std::lock_guard<std::mutex> lock (mutex_);
+            deleter = e.deleter;
+        }
+        if ((p != NULL) && deleter)
+            deleter (p);
+    }
+}
+/* ========================================================================= */
@@ -0,0 +1,122 @@
+/**
+ * @file applib-services.h
+ * @brief Declarations for AppLibServices class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_APPLIB_SERVICES_H_INCLUDE
+#define GUARD_APPLIB_SERVICES_H_INCLUDE
+
+#include <applib/applib-config.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <typeinfo>
+#include <vector>
+
+//! Services of a library, created when they are first needed.
+class APPLIB_EXPORT AppLibServices {
+
+public:
+
+    //! Creates a service.
+    typedef std::function<void * ()> Factory;
+
+    //! Destroys a service.
+    typedef std::function<void (void *)> Deleter;
+
+    //! Maximum number of service types in the process.
+    enum {
+        MaxServices = 256
+    };
+
+    //! Default constructor.
+    AppLibServices ();
+
+    //! Destructor; destroys the services that still exist.
+    ~AppLibServices ();
+
+    //! Register the factory of a service of type T.
+    template <typename T>
+    bool
+    provide (
+            std::function<T * ()> factory) {
+        return registerFactory (
+                    keyOf<T> (),
+                    [factory] () -> void * { return factory (); },
+                    [] (void * p) { delete static_cast<T *>(p); });
+    }
+
+    //! The service of type T, created on first use; NULL if not provided.
+    template <typename T>
+    T *
+    get () {
+        const int key = keyOf<T> ();
+        if (key < 0)
+            return NULL;
+        void * p = entries_[key].instance.load (std::memory_order_acquire);
+        if (p == NULL)
+            p = create (key);
+        return static_cast<T *>(p);
+    }
+
+    //! Register the factory of a service under an interned key.
+    bool
+    registerFactory (
+            int key,
+            Factory factory,
+            Deleter deleter);
+
+    //! No more factories are accepted.
+    void
+    seal () {
+        sealed_.store (true, std::memory_order_release);
+    }
+
+    //! Destroy the services, the last one created first.
+    void
+    destroyAll ();
+
+    //! The key of a service type (the same in all the registries).
+    template <typename T>
+    static int
+    keyOf () {
+        static const int key = internKey (typeid (T).name ());
+        return key;
+    }
+
+    //! The key of a name; -1 when the table is full.
+    static int
+    internKey (
+            const char * name);
+
+private:
+
+    //! A service.
+    struct Entry {
+        std::atomic<void *> instance; /**< NULL until created */
+        std::once_flag once; /**< guards the creation */
+        Factory factory; /**< creates the service */
+        Deleter deleter; /**< destroys the service */
+    };
+
+    //! Call the factory once (slow path of get()).
+    void *
+    create (
+            int key);
+
+    AppLibServices (const AppLibServices &);
+    AppLibServices& operator=( const AppLibServices& );
+
+private:
+    Entry * entries_; /**< MaxServices entries, indexed by key */
+    std::atomic<bool> sealed_; /**< registration is over */
+    std::mutex mutex_; /**< protects the factories and created_ */
+    std::vector<int> created_; /**< keys, in order of creation */
+};
+
+#endif // GUARD_APPLIB_SERVICES_H_INCLUDE
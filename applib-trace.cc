@@ -0,0 +1,250 @@
+/**
+ * @file applib-trace.cc
+ * @brief Definitions for AppLibTrace class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include "applib-trace.h"
+#include "applib-profiler.h"
+#include "applib-private.h"
+
+#include <QCoreApplication>
+#include <QFile>
+
+#include <stdio.h>
+#include <vector>
+
+/**
+ * @class AppLibTrace
+ *
+ * Zones are declared with APPLIB_TRACE_ZONE() or APPLIB_TRACE_FUNCTION();
+ * while tracing is disabled a zone only tests a relaxed atomic flag.
+ * While it is enabled the zone reads the monotonic clock twice and
+ * stores one Event in a ring owned by the calling thread, so recording
+ * takes no lock and the threads do not share cache lines. When a ring
+ * is full the oldest events are overwritten.
+ *
+ * The rings outlive their threads, so the zones of a worker that ended
+ * can still be exported. toChromeTrace() may be called while other
+ * threads record; events written during the export may be left out.
+ *
+ * The names and categories are stored as pointers, so they must be
+ * string literals or __func__.
+ */
+
+//! The events recorded by one thread.
+struct TraceBuffer {
+    AppLibTrace::Event * events; /**< the ring */
+    quint64 mask; /**< capacity - 1; capacity is a power of two */
+    std::atomic<quint64> head; /**< events written so far */
+    std::atomic<quint64> tail; /**< events before it were cleared */
+    int thread; /**< AppLibProfiler::currentThread() of the owner */
+    TraceBuffer * next; /**< the list of all buffers */
+};
+
+std::atomic<bool> AppLibTrace::enabled_ (false);
+
+//! all the buffers ever created (they are never released)
+static std::atomic<TraceBuffer *> trace_buffers_ (NULL);
+
+//! capacity of the buffers created from now on
+static std::atomic<int> trace_capacity_ (16384);
+
+//! the buffer of this thread
+static thread_local TraceBuffer * tls_trace_buffer_ = NULL;
+
+/* ------------------------------------------------------------------------- */
+static TraceBuffer * createBuffer ()
+{
+    quint64 capacity = 1;
+    const quint64 wanted = static_cast<quint64>(
+                qMax (trace_capacity_.load (std::memory_order_relaxed), 16));
+    while (capacity < wanted)
+        capacity <<= 1;
+
+    TraceBuffer * buffer = new TraceBuffer;
+    buffer->events = new AppLibTrace::Event[capacity];
+    buffer->mask = capacity - 1;
+    buffer->head.store (0, std::memory_order_relaxed);
+    buffer->tail.store (0, std::memory_order_relaxed);
+    buffer->thread = AppLibProfiler::currentThread ();
+
+    TraceBuffer * first = trace_buffers_.load (std::memory_order_relaxed);
+    do {
+        buffer->next = first;
+    } while (!trace_buffers_.compare_exchange_weak (
+                 first, buffer,
+                 std::memory_order_release, std::memory_order_relaxed));
+    return buffer;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibTrace::setEnabled (bool b_enabled)
+{
+    enabled_.store (b_enabled, std::memory_order_relaxed);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The value is rounded up to a power of two; threads that already
+ * recorded something keep their buffer.
+ */
+void AppLibTrace::setBufferSize (int events)
+{
+    trace_capacity_.store (events, std::memory_order_relaxed);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+qint64 AppLibTrace::now ()
+{
+    return AppLibProfiler::nowNs ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibTrace::record (
+        const char * category, const char * name,
+        qint64 begin_ns, qint64 end_ns)
+{
+    TraceBuffer * buffer = tls_trace_buffer_;
+    if (buffer == NULL) {
+        buffer = createBuffer ();
+        tls_trace_buffer_ = buffer;
+    }
+
+    // only this thread writes head
+    const quint64 head = buffer->head.load (std::memory_order_relaxed);
+    Event & ev = buffer->events[head & buffer->mask];
+    ev.category = category;
+    ev.name = name;
+    ev.begin_ns = begin_ns;
+    ev.end_ns = end_ns;
+    buffer->head.store (head + 1, std::memory_order_release);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static void jsonEscape (const char * s, QByteArray & out)
+{
+    for (; *s != 0; ++s) {
+        const char c = *s;
+        switch (c) {
+        case '"': out.append ("\\\""); break;
+        case '\\': out.append ("\\\\"); break;
+        case '\n': out.append ("\\n"); break;
+        case '\t': out.append ("\\t"); break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                snprintf (buf, sizeof(buf), "\\u%04x", c);
+                out.append (buf);
+            } else {
+                out.append (c);
+            }
+        }
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Each zone becomes a complete ("X") event with the times expressed in
+ * microseconds relative to the earliest zone. The thread identifiers
+ * are the ones used by AppLibProfiler, so both traces can be merged.
+ */
+QByteArray AppLibTrace::toChromeTrace ()
+{
+    struct Copy {
+        Event ev;
+        int thread;
+    };
+    std::vector<Copy> all;
+    for (TraceBuffer * buffer = trace_buffers_.load (std::memory_order_acquire);
+         buffer != NULL; buffer = buffer->next) {
+        const quint64 head = buffer->head.load (std::memory_order_acquire);
+        const quint64 capacity = buffer->mask + 1;
+        quint64 first = buffer->tail.load (std::memory_order_relaxed);
+        if (head - first > capacity)
+            first = head - capacity;
+        const size_t base = all.size ();
+        for (quint64 i = first; i < head; ++i) {
+            Copy c;
+            c.ev = buffer->events[i & buffer->mask];
+            c.thread = buffer->thread;
+            all.push_back (c);
+        }
+        // the owner may have reused some slots while we were copying; the
+        // write in progress at now_head is not published yet but already
+        // overwrites the slot of now_head - capacity
+        const quint64 now_head = buffer->head.load (std::memory_order_acquire);
+        if ((now_head + 1 > capacity) && (now_head + 1 - capacity > first)) {
+            const quint64 lost =
+                    qMin (now_head + 1 - capacity - first, head - first);
+            all.erase (all.begin () + base,
+                       all.begin () + base + static_cast<size_t>(lost));
+        }
+    }
+
+    qint64 origin = 0;
+    for (size_t i = 0; i < all.size (); ++i) {
+        if ((i == 0) || (all[i].ev.begin_ns < origin))
+            origin = all[i].ev.begin_ns;
+    }
+    qint64 pid = QCoreApplication::applicationPid ();
+
+    QByteArray result ("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (size_t i = 0; i < all.size (); ++i) {
+        const Event & ev = all[i].ev;
+        if (i > 0)
+            result.append (',');
+        result.append ("\n{\"name\":\"");
+        jsonEscape (ev.name, result);
+        result.append ("\",\"cat\":\"");
+        jsonEscape (ev.category, result);
+        result.append ("\",\"ph\":\"X\",\"ts\":");
+        result.append (QByteArray::number (
+                           static_cast<double>(ev.begin_ns - origin) / 1000.0,
+                           'f', 3));
+        result.append (",\"dur\":");
+        result.append (QByteArray::number (
+                           static_cast<double>(ev.end_ns - ev.begin_ns) / 1000.0,
+                           'f', 3));
+        result.append (",\"pid\":");
+        result.append (QByteArray::number (pid));
+        result.append (",\"tid\":");
+        result.append (QByteArray::number (all[i].thread));
+        result.append ('}');
+    }
+    result.append ("\n]}\n");
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLibTrace::saveChromeTrace (const QString & file)
+{
+    QFile f (file);
+    if (!f.open (QIODevice::WriteOnly | QIODevice::Truncate)) {
+        APPLIB_DEBUGM("Cannot write trace %s\n", TMP_A(file));
+        return false;
+    }
+    return f.write (toChromeTrace ()) != -1;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibTrace::clear ()
+{
+    for (TraceBuffer * buffer = trace_buffers_.load (std::memory_order_acquire);
+         buffer != NULL; buffer = buffer->next) {
+        buffer->tail.store (buffer->head.load (std::memory_order_acquire),
+                            std::memory_order_relaxed);
+    }
+}
+/* ========================================================================= */
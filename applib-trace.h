@@ -0,0 +1,127 @@
+/**
+ * @file applib-trace.h
+ * @brief Declarations for AppLibTrace class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_APPLIB_TRACE_H_INCLUDE
+#define GUARD_APPLIB_TRACE_H_INCLUDE
+
+#include <applib/applib-config.h>
+#include <QString>
+#include <QByteArray>
+
+#include <atomic>
+
+//! Process-wide recorder for the scoped trace zones.
+class APPLIB_EXPORT AppLibTrace {
+
+public:
+
+    //! One zone that ended.
+    struct Event {
+        const char * category; /**< static string */
+        const char * name; /**< static string */
+        qint64 begin_ns; /**< monotonic start time */
+        qint64 end_ns; /**< monotonic end time */
+    };
+
+    //! Are the zones being recorded?
+    static inline bool
+    isEnabled () {
+        return enabled_.load (std::memory_order_relaxed);
+    }
+
+    //! Start or stop recording.
+    static void
+    setEnabled (
+            bool b_enabled);
+
+    //! Number of events kept for each thread (for threads that start later).
+    static void
+    setBufferSize (
+            int events);
+
+    //! The time used for the zones, in nanoseconds.
+    static qint64
+    now ();
+
+    //! Store a zone in the buffer of the calling thread.
+    static void
+    record (
+            const char * category,
+            const char * name,
+            qint64 begin_ns,
+            qint64 end_ns);
+
+    //! The recorded zones in Chrome / Perfetto trace event JSON format.
+    static QByteArray
+    toChromeTrace ();
+
+    //! Save the recorded zones in Chrome / Perfetto trace event JSON format.
+    static bool
+    saveChromeTrace (
+            const QString & file);
+
+    //! Forget the zones recorded so far.
+    static void
+    clear ();
+
+private:
+    static std::atomic<bool> enabled_; /**< the runtime switch */
+};
+
+//! Records the time spent in a scope when tracing is enabled.
+class AppLibTraceZone {
+
+public:
+
+    //! Constructor; the strings must be static (literals, __func__).
+    inline
+    AppLibTraceZone (
+            const char * category,
+            const char * name) :
+        category_ (category),
+        name_ (name),
+        begin_ns_ (AppLibTrace::isEnabled () ? AppLibTrace::now () : -1)
+    {}
+
+    //! Destructor; records the zone.
+    inline
+    ~AppLibTraceZone () {
+        if (begin_ns_ != -1)
+            AppLibTrace::record (
+                        category_, name_, begin_ns_, AppLibTrace::now ());
+    }
+
+private:
+    AppLibTraceZone (const AppLibTraceZone &);
+    AppLibTraceZone& operator=( const AppLibTraceZone& );
+
+    const char * category_; /**< static string */
+    const char * name_; /**< static string */
+    qint64 begin_ns_; /**< -1 when tracing was off at the start */
+};
+
+#define APPLIB_TRACE_CONCAT_HELPER(__a__, __b__) __a__ ## __b__
+#define APPLIB_TRACE_CONCAT(__a__, __b__) APPLIB_TRACE_CONCAT_HELPER(__a__, __b__)
+
+/**
+ * @def APPLIB_TRACE_ZONE
+ * @brief Trace the rest of the enclosing scope under a name.
+ */
+#define APPLIB_TRACE_ZONE(__category__, __name__) \
+    AppLibTraceZone APPLIB_TRACE_CONCAT(applib_trace_zone_, __LINE__) ( \
+        __category__, __name__)
+
+/**
+ * @def APPLIB_TRACE_FUNCTION
+ * @brief Trace the rest of the enclosing function.
+ */
+#define APPLIB_TRACE_FUNCTION(__category__) \
+    APPLIB_TRACE_ZONE(__category__, __func__)
+
+#endif // GUARD_APPLIB_TRACE_H_INCLUDE
@@ -148,6 +148,8 @@
 /**
  * @def APPLIB_ENTRY
  * @brief Trace the function or method entry.
+ *
+ * Prints a line for each call; use APPLIB_TRACE_ZONE() on hot paths.
  * @internal
  */
 #define APPLIB_ENTRY(module) printf("-------{ %s ENTRY %s in %s[%d] }-----\n", module, __func__, __FILE__, __LINE__)
@@ -156,6 +158,8 @@
 /**
  * @def APPLIB_EXIT
  * @brief Trace the function or method exit.
+ *
+ * Prints a line for each call; use APPLIB_TRACE_ZONE() on hot paths.
  * @internal
  */
 #define APPLIB_EXIT(module) printf("-------{ %s EXIT %s in %s[%d] }-----\n", module, __func__, __FILE__, __LINE__)
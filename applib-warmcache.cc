@@ -0,0 +1,385 @@
+/**
+ * @file applib-warmcache.cc
+ * @brief Definitions for AppLibWarmCache class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include "applib-warmcache.h"
+#include "applib-private.h"
+
+#include <QFileInfo>
+#include <QDateTime>
+#include <QSaveFile>
+
+#include <limits.h>
+#include <string.h>
+
+/**
+ * @class AppLibWarmCache
+ *
+ * Artifacts are named blobs of bytes (parsed resources, lookup tables,
+ * ...) together with a fingerprint of the inputs they were built from.
+ * When an artifact is requested and the file holds one with the same
+ * name and fingerprint the caller receives a QByteArray that points
+ * straight into the mapping (no copy, no parsing); otherwise the
+ * serializer is called and the result is remembered for save().
+ *
+ * The whole file is keyed by APPLIB_VERSION, APPLIB_BUILD_TIME and a
+ * key given by the application (its own version, for example); a file
+ * with another key is ignored. save() writes only the artifacts used
+ * in the current run, so stale ones do not accumulate.
+ *
+ * The views are valid as long as the cache is open; copy the data
+ * (or deserialize it) if it must live longer.
+ */
+
+//! identifies the file format
+#define WARMCACHE_MAGIC "APWARMC1"
+
+//! alignment of the artifacts in the file
+#define WARMCACHE_ALIGN 16
+
+//! The header of the cache file.
+struct WarmCacheHeader {
+    char magic[8]; /**< WARMCACHE_MAGIC */
+    quint32 version; /**< APPLIB_VERSION of the writer */
+    quint32 count; /**< number of artifacts */
+    quint64 key; /**< build time and application key */
+};
+
+//! One artifact.
+struct WarmCacheEntry {
+    quint32 name_offset; /**< UTF-8 name */
+    quint32 name_length; /**< length of the name */
+    quint64 fingerprint; /**< of the inputs */
+    quint64 data_offset; /**< the bytes, aligned to WARMCACHE_ALIGN */
+    quint64 data_length; /**< number of bytes */
+};
+
+// file layout:
+//   WarmCacheHeader
+//   WarmCacheEntry [count]
+//   names
+//   artifacts (each aligned to WARMCACHE_ALIGN)
+
+/* ------------------------------------------------------------------------- */
+static quint64 fnv64 (const char * data, size_t size, quint64 hash)
+{
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<uchar>(data[i]);
+        hash *= Q_UINT64_C(1099511628211);
+    }
+    return hash;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibWarmCache::AppLibWarmCache () :
+    mutex_ (),
+    file_ (),
+    data_ (NULL),
+    size_ (0),
+    path_ (),
+    key_ (0),
+    used_ (),
+    dirty_ (false),
+    hits_ (0),
+    misses_ (0)
+{
+    APPLIB_TRACE_ENTRY;
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibWarmCache::~AppLibWarmCache ()
+{
+    APPLIB_TRACE_ENTRY;
+    close ();
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+quint64 AppLibWarmCache::fingerprint (const QByteArray & data, quint64 seed)
+{
+    quint64 hash = (seed == 0 ? Q_UINT64_C(14695981039346656037) : seed);
+    return fnv64 (data.constData (), data.size (), hash);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Missing files are part of the fingerprint too, so creating one
+ * changes it.
+ */
+quint64 AppLibWarmCache::fingerprintFiles (const QStringList & paths)
+{
+    quint64 hash = 0;
+    for (int i = 0; i < paths.count (); ++i) {
+        QFileInfo fi (paths.at (i));
+        hash = fingerprint (fi.absoluteFilePath ().toUtf8 (), hash);
+        qint64 stamp[2] = { -1, -1 };
+        if (fi.exists ()) {
+            stamp[0] = fi.size ();
+            stamp[1] = fi.lastModified ().toMSecsSinceEpoch ();
+        }
+        hash = fnv64 (reinterpret_cast<const char *>(stamp),
+                      sizeof(stamp), hash);
+    }
+    return hash;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param file where the cache is stored; it does not need to exist
+ * @param key identifies the application build; artifacts written with
+ *      another key are ignored
+ * @return true if a valid file was found and mapped
+ */
+bool AppLibWarmCache::open (const QString & file, const QByteArray & key)
+{
+    close ();
+    std::lock_guard<std::mutex> lock (mutex_);
+    path_ = file;
+    key_ = fingerprint (key, fingerprint (QByteArray (APPLIB_BUILD_TIME)));
+
+    file_.setFileName (file);
+    if (!file_.open (QIODevice::ReadOnly))
+        return false;
+    size_ = file_.size ();
+    if (size_ >= static_cast<qint64>(sizeof(WarmCacheHeader)))
+        data_ = file_.map (0, size_);
+    if (data_ == NULL) {
+        file_.close ();
+        return false;
+    }
+
+    const WarmCacheHeader * hdr =
+            reinterpret_cast<const WarmCacheHeader *>(data_);
+    bool b_ok = (memcmp (hdr->magic, WARMCACHE_MAGIC, 8) == 0) &&
+            (hdr->version == APPLIB_VERSION) &&
+            (hdr->key == key_) &&
+            (sizeof(WarmCacheHeader) + hdr->count * sizeof(WarmCacheEntry) <=
+             static_cast<quint64>(size_));
+    if (b_ok) {
+        const WarmCacheEntry * entries =
+                reinterpret_cast<const WarmCacheEntry *>(hdr + 1);
+        // offsets first, then lengths against what is left, so a
+        // corrupt entry can't wrap the sum around
+        const quint64 size = static_cast<quint64>(size_);
+        for (quint32 i = 0; i < hdr->count; ++i) {
+            const WarmCacheEntry & e = entries[i];
+            if ((e.name_offset > size) ||
+                    (e.name_length > size - e.name_offset) ||
+                    (e.data_offset > size) ||
+                    (e.data_length > size - e.data_offset) ||
+                    (e.data_length > static_cast<quint64>(INT_MAX))) {
+                b_ok = false;
+                break;
+            }
+        }
+    }
+    if (!b_ok) {
+        APPLIB_DEBUGM("Warm start cache %s is stale\n", TMP_A(file));
+        file_.unmap (const_cast<uchar *>(data_));
+        data_ = NULL;
+        file_.close ();
+        return false;
+    }
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibWarmCache::close ()
+{
+    std::lock_guard<std::mutex> lock (mutex_);
+    used_.clear ();
+    if (data_ != NULL) {
+        file_.unmap (const_cast<uchar *>(data_));
+        data_ = NULL;
+    }
+    file_.close ();
+    size_ = 0;
+    dirty_ = false;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLibWarmCache::lookup (
+        const QByteArray & name, quint64 fingerprint, QByteArray & data) const
+{
+    if (data_ == NULL)
+        return false;
+    const WarmCacheHeader * hdr =
+            reinterpret_cast<const WarmCacheHeader *>(data_);
+    const WarmCacheEntry * entries =
+            reinterpret_cast<const WarmCacheEntry *>(hdr + 1);
+    for (quint32 i = 0; i < hdr->count; ++i) {
+        const WarmCacheEntry & e = entries[i];
+        if ((e.fingerprint != fingerprint) ||
+                (e.name_length != static_cast<quint32>(name.size ())) ||
+                (memcmp (data_ + e.name_offset, name.constData (),
+                         e.name_length) != 0))
+            continue;
+        data = QByteArray::fromRawData (
+                    reinterpret_cast<const char *>(data_ + e.data_offset),
+                    static_cast<int>(e.data_length));
+        return true;
+    }
+    return false;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLibWarmCache::contains (const QString & name, quint64 fingerprint) const
+{
+    std::lock_guard<std::mutex> lock (mutex_);
+    QByteArray data;
+    return lookup (name.toUtf8 (), fingerprint, data);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The serializer is called without holding any lock, so artifacts may
+ * be requested from parallel init tasks.
+ *
+ * @param name identifies the artifact
+ * @param fingerprint of the inputs the artifact is built from
+ * @param serializer builds the artifact when it is not in the cache
+ * @return the bytes of the artifact; a view in the cache file on a hit
+ */
+QByteArray AppLibWarmCache::artifact (
+        const QString & name, quint64 fingerprint, Serializer serializer)
+{
+    Artifact a;
+    a.name = name.toUtf8 ();
+    a.fingerprint = fingerprint;
+    {
+        std::lock_guard<std::mutex> lock (mutex_);
+        if (lookup (a.name, fingerprint, a.data)) {
+            ++hits_;
+            remember (a);
+            return a.data;
+        }
+    }
+
+    a.data = serializer ();
+    std::lock_guard<std::mutex> lock (mutex_);
+    ++misses_;
+    dirty_ = true;
+    remember (a);
+    return a.data;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Must be called with the mutex held. An artifact requested again
+ * (possibly with another fingerprint) is saved only once, as last seen.
+ */
+void AppLibWarmCache::remember (const Artifact & a)
+{
+    for (size_t i = 0; i < used_.size (); ++i) {
+        if (used_[i].name == a.name) {
+            used_[i] = a;
+            return;
+        }
+    }
+    used_.push_back (a);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLibWarmCache::isDirty () const
+{
+    std::lock_guard<std::mutex> lock (mutex_);
+    return dirty_;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The file is replaced atomically; the current mapping (and the
+ * views in it) stay valid until close().
+ */
+bool AppLibWarmCache::save ()
+{
+    std::lock_guard<std::mutex> lock (mutex_);
+    if (path_.isEmpty ())
+        return false;
+
+    WarmCacheHeader hdr;
+    memset (&hdr, 0, sizeof(hdr));
+    memcpy (hdr.magic, WARMCACHE_MAGIC, 8);
+    hdr.version = APPLIB_VERSION;
+    hdr.count = static_cast<quint32>(used_.size ());
+    hdr.key = key_;
+
+    std::vector<WarmCacheEntry> entries (used_.size ());
+    quint64 offset = sizeof(WarmCacheHeader) +
+            used_.size () * sizeof(WarmCacheEntry);
+    for (size_t i = 0; i < used_.size (); ++i) {
+        entries[i].name_offset = static_cast<quint32>(offset);
+        entries[i].name_length = static_cast<quint32>(used_[i].name.size ());
+        offset += used_[i].name.size ();
+    }
+    for (size_t i = 0; i < used_.size (); ++i) {
+        offset = (offset + WARMCACHE_ALIGN - 1) & ~static_cast<quint64>(
+                    WARMCACHE_ALIGN - 1);
+        entries[i].fingerprint = used_[i].fingerprint;
+        entries[i].data_offset = offset;
+        entries[i].data_length = static_cast<quint64>(used_[i].data.size ());
+        offset += used_[i].data.size ();
+    }
+
+    QSaveFile out (path_);
+    if (!out.open (QIODevice::WriteOnly)) {
+        APPLIB_DEBUGM("Cannot write warm start cache %s\n", TMP_A(path_));
+        return false;
+    }
+    out.write (reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+    if (!entries.empty ())
+        out.write (reinterpret_cast<const char *>(&entries[0]),
+                   entries.size () * sizeof(WarmCacheEntry));
+    quint64 written = sizeof(WarmCacheHeader) +
+            entries.size () * sizeof(WarmCacheEntry);
+    for (size_t i = 0; i < used_.size (); ++i) {
+        out.write (used_[i].name);
+        written += used_[i].name.size ();
+    }
+    static const char padding[WARMCACHE_ALIGN] = { 0 };
+    for (size_t i = 0; i < used_.size (); ++i) {
+        out.write (padding, static_cast<qint64>(
+                       entries[i].data_offset - written));
+        out.write (used_[i].data);
+        written = entries[i].data_offset + entries[i].data_length;
+    }
+    if (!out.commit ())
+        return false;
+    dirty_ = false;
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int AppLibWarmCache::hits () const
+{
+    std::lock_guard<std::mutex> lock (mutex_);
+    return hits_;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int AppLibWarmCache::misses () const
+{
+    std::lock_guard<std::mutex> lock (mutex_);
+    return misses_;
+}
+/* ========================================================================= */
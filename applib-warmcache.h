@@ -0,0 +1,124 @@
+/**
+ * @file applib-warmcache.h
+ * @brief Declarations for AppLibWarmCache class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_APPLIB_WARMCACHE_H_INCLUDE
+#define GUARD_APPLIB_WARMCACHE_H_INCLUDE
+
+#include <applib/applib-config.h>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QFile>
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+//! Keeps the results of expensive, deterministic initialization on disk.
+class APPLIB_EXPORT AppLibWarmCache {
+
+public:
+
+    //! Produces the serialized form of an artifact.
+    typedef std::function<QByteArray ()> Serializer;
+
+    //! Default constructor.
+    AppLibWarmCache ();
+
+    //! Destructor; the views handed out become invalid.
+    ~AppLibWarmCache ();
+
+    //! Map the cache file if it was written by this build with this key.
+    bool
+    open (
+            const QString & file,
+            const QByteArray & key = QByteArray ());
+
+    //! Release the file; the views handed out become invalid.
+    void
+    close ();
+
+    //! The cached bytes of an artifact, or the output of the serializer.
+    QByteArray
+    artifact (
+            const QString & name,
+            quint64 fingerprint,
+            Serializer serializer);
+
+    //! Is there a cached artifact with this name and fingerprint?
+    bool
+    contains (
+            const QString & name,
+            quint64 fingerprint) const;
+
+    //! Were artifacts produced that are not in the file?
+    bool
+    isDirty () const;
+
+    //! Write the artifacts used in this run to the file.
+    bool
+    save ();
+
+    //! Number of artifacts found in the file.
+    int
+    hits () const;
+
+    //! Number of artifacts that had to be produced.
+    int
+    misses () const;
+
+    //! Fingerprint of some input data.
+    static quint64
+    fingerprint (
+            const QByteArray & data,
+            quint64 seed = 0);
+
+    //! Fingerprint of some files: their paths, sizes and modification times.
+    static quint64
+    fingerprintFiles (
+            const QStringList & paths);
+
+private:
+
+    //! An artifact used in this run.
+    struct Artifact {
+        QByteArray name; /**< UTF-8 name */
+        quint64 fingerprint; /**< of the inputs */
+        QByteArray data; /**< a view in the mapping or produced bytes */
+    };
+
+    //! Find an artifact in the mapped file; the mutex is held.
+    bool
+    lookup (
+            const QByteArray & name,
+            quint64 fingerprint,
+            QByteArray & data) const;
+
+    //! Add an artifact to used_, replacing one with the same name.
+    void
+    remember (
+            const Artifact & a);
+
+    AppLibWarmCache (const AppLibWarmCache &);
+    AppLibWarmCache& operator=( const AppLibWarmCache& );
+
+private:
+    mutable std::mutex mutex_; /**< protects everything below */
+    QFile file_; /**< the cache file */
+    const uchar * data_; /**< the mapping; NULL if nothing valid was found */
+    qint64 size_; /**< size of the mapping */
+    QString path_; /**< where the cache is saved */
+    quint64 key_; /**< build and application key */
+    std::vector<Artifact> used_; /**< artifacts of this run */
+    bool dirty_; /**< some artifact was produced */
+    int hits_; /**< artifacts found in the file */
+    int misses_; /**< artifacts produced */
+};
+
+#endif // GUARD_APPLIB_WARMCACHE_H_INCLUDE
@@ -9,13 +9,28 @@
 
 #include "applib.h"
 #include "applib-private.h"
+#include "applib-executor.h"
+#include "applib-langindex.h"
+#include "applib-binlog.h"
+#include "applib-msgfilter.h"
+#include "applib-flightrec.h"
 #include "assert.h"
 
 #include <QTranslator>
+#include <QLibraryInfo>
 #include <QLocale>
-#include <QWidget>
 #include <QCoreApplication>
 #include <QDateTime>
+#include <QThread>
+#include <QFile>
+#include <QLoggingCategory>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <thread>
 
 #include <translate/translang.h>
 #include <translate/translate.h>
@@ -27,20 +42,21 @@
 /* ------------------------------------------------------------------------- */
 class TimeInterval {
 
-    QDateTime t1_;
-    QDateTime t2_;
+    qint64 t1_;
+    qint64 t2_;
     int secs_in_min_;
     int hours_run_;
     int min_in_hour_;
 
 public:
 
+    //! The times come from AppLibClock::nowNs().
     TimeInterval (
-            const QDateTime & t1,
-            const QDateTime & t2 = QDateTime::currentDateTime ()):
+            qint64 t1,
+            qint64 t2 = AppLibClock::nowNs ()):
         t1_(t1), t2_(t2)
     {
-        qint64 secs_run = t1_.secsTo (t2_);
+        qint64 secs_run = seconds ();
         qint64 min_run = secs_run / 60;
         secs_in_min_ = static_cast<int> (secs_run - min_run * 60);
         hours_run_ = static_cast<int> (min_run / 60);
@@ -65,22 +81,22 @@ public:
         return QLatin1String ("%1:%2:%3");
     }
 
-    const QDateTime &
+    QDateTime
     start () const {
-        return t1_; }
+        return AppLibClock::toDateTime (t1_); }
 
-    const QDateTime &
+    QDateTime
     end () const {
-        return t2_; }
+        return AppLibClock::toDateTime (t2_); }
 
     int
     miliseconds () const {
-        return static_cast<int>(t1_.msecsTo (t2_));
+        return static_cast<int>((t2_ - t1_) / 1000000);
     }
 
     int
     seconds () const {
-        return static_cast<int>(t1_.secsTo (t2_));
+        return static_cast<int>((t2_ - t1_) / 1000000000);
     }
 
 };
@@ -94,24 +110,180 @@ public:
 
 AppLib * AppLib::singleton_ = NULL;
 
+//! protects lib_instances_
+static std::mutex lib_instances_mutex_;
+
+//! all the instances, default and scoped
+static QList<AppLib *> lib_instances_;
+
+//! the instance set by AppLibScope in this thread
+static thread_local AppLib * tls_current_lib_ = NULL;
+
+//! the background writer for Qt messages, if one was ever requested
+static std::atomic<AppLibMsgSink *> msg_sink_ (NULL);
+
+//! are Qt messages routed through msg_sink_?
+static std::atomic<bool> msg_async_ (false);
+
+//! suppresses repeated Qt messages, if one was ever requested
+static std::atomic<AppLibMsgThrottle *> msg_throttle_ (NULL);
+
+//! are Qt messages passed through msg_throttle_?
+static std::atomic<bool> msg_throttled_ (false);
+
+//! the binary log for Qt messages, if one was ever requested
+static std::atomic<AppLibBinLog *> msg_binlog_ (NULL);
+
+//! are Qt messages written to msg_binlog_ instead of as text?
+static std::atomic<bool> msg_binary_ (false);
+
+//! records the recent history of the process, if one was ever requested
+static std::atomic<AppLibFlightRecorder *> flight_recorder_ (NULL);
+
+/* ------------------------------------------------------------------------- */
+//! Messages from Qt by type; never freed, the handler may run at exit.
+static AppLibMetrics::Counter * qtMsgCounters ()
+{
+    static AppLibMetrics::Counter * counters = new AppLibMetrics::Counter[5];
+    return counters;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! The filter used by echoQtMessages(); never destroyed, as messages
+//! may arrive while the static objects are being destroyed.
+static AppLibMsgFilter & qtMsgFilter ()
+{
+    static AppLibMsgFilter * filter = new AppLibMsgFilter ();
+    return *filter;
+}
+/* ========================================================================= */
+
+std::mutex AppLib::hooks_mutex_;
+std::vector<AppLib::ShutdownHookEntry> AppLib::hooks_;
+int AppLib::next_hook_id_ = 1;
+QStringList AppLib::overrun_hooks_;
+std::atomic<bool> AppLib::fast_exit_ (false);
+std::atomic<int> AppLib::fast_exit_deadline_ (2000);
+std::atomic<int> AppLib::fast_exit_code_ (0);
+
 /* ------------------------------------------------------------------------- */
 /**
- * Detailed description for constructor.
+ * The default instance is the one the static API works with and the
+ * only one that configures the process (logging, flight recorder,
+ * tracing, exporters and samplers started from the environment).
+ *
+ * Scoped instances have their own state, signals, observers, metrics
+ * and message filter, and share the rest of the process with the
+ * default instance (the Qt message handler and the translators
+ * installed in QCoreApplication, for example). The static API reaches
+ * them inside an AppLibScope.
+ *
+ * @param mode DefaultInstance (at most one) or ScopedInstance
  */
-AppLib::AppLib() : QObject (),
-    app_start_moment_ (QDateTime::currentDateTime ()),
+AppLib::AppLib (InstanceMode mode) : QObject (),
+    app_start_ns_ (AppLibClock::nowNs ()),
     gui_mode_ (false),
     mw_ (NULL),
     state_ (InitialState),
-    fqmsg_ (NoFilter)
+    state_waiters_ (NULL),
+    fqmsg_ (NoFilter),
+    msg_mask_ (0),
+    scoped_ (mode == ScopedInstance),
+    finishing_ (false),
+    profiler_ (),
+    init_span_ (-1),
+    term_span_ (-1),
+    init_graph_ (),
+    executor_ (NULL),
+    executor_mutex_ (),
+    executor_drain_ms_ (5000),
+    translation_busy_ (false),
+    translation_job_ (),
+    lang_index_ (NULL),
+    warm_cache_ (NULL),
+    observers_ (),
+    metrics_ (),
+    transition_metric_ (NULL),
+    gui_start_metric_ (NULL),
+    state_since_ns_ (AppLibProfiler::nowNs ()),
+    sampler_ (NULL),
+    sampler_mutex_ (),
+    services_ ()
 {
     APPLIB_TRACE_ENTRY;
+    setupMetrics ();
+    {
+        std::lock_guard<std::mutex> lock (lib_instances_mutex_);
+        lib_instances_.append (this);
+    }
+    if (scoped_) {
+        APPLIB_TRACE_EXIT;
+        return;
+    }
+
     Q_ASSERT (singleton_ == NULL);
     singleton_ = this;
+    AppLibLog::configureFromEnv ();
+    int tick_us = qgetenv ("APPLIB_CLOCK_TICK").toInt ();
+    if (tick_us > 0)
+        AppLibClock::startTicker (tick_us);
+    QByteArray recorder_file = qgetenv ("APPLIB_FLIGHT_RECORDER");
+    if (!recorder_file.isEmpty ())
+        startFlightRecorder (QFile::decodeName (recorder_file));
+    if (!qgetenv ("APPLIB_TRACE").isEmpty ())
+        AppLibTrace::setEnabled (true);
+    QByteArray metrics_file = qgetenv ("APPLIB_METRICS");
+    if (!metrics_file.isEmpty ())
+        metrics_.startExporter (QFile::decodeName (metrics_file));
+    int sampler_ms = qgetenv ("APPLIB_SAMPLER").toInt ();
+    if (sampler_ms > 0)
+        startSampler (sampler_ms);
     APPLIB_TRACE_EXIT;
 }
 /* ========================================================================= */
 
+/* ------------------------------------------------------------------------- */
+/**
+ * The names follow the Prometheus conventions; the time spent in each
+ * state is updated on every transition, so the current state is not
+ * counted until it is left.
+ */
+void AppLib::setupMetrics ()
+{
+    static const char * type_names[] = {
+        "debug", "warning", "critical", "fatal", "info"
+    };
+    // the handler counts for the process; the default instance exports it
+    for (int i = 0; (i < 5) && !scoped_; ++i) {
+        metrics_.addCounter (
+                    QLatin1String ("applib_qt_messages_total"),
+                    QLatin1String ("Messages from Qt that passed the filters."),
+                    QString (QLatin1String ("type=\"%1\""))
+                    .arg (QLatin1String (type_names[i])),
+                    &qtMsgCounters ()[i]);
+    }
+    static const char * state_names[] = {
+        "initial", "initializing", "running", "running_gui",
+        "terminating", "terminated"
+    };
+    for (int i = 0; i < 6; ++i) {
+        state_metrics_[i] = metrics_.gauge (
+                    QLatin1String ("applib_state_seconds"),
+                    QLatin1String ("Time spent in each state of the library."),
+                    QString (QLatin1String ("state=\"%1\""))
+                    .arg (QLatin1String (state_names[i])));
+    }
+    transition_metric_ = metrics_.counter (
+                QLatin1String ("applib_state_transitions_total"),
+                QLatin1String ("Changes of the state of the library."));
+    gui_start_metric_ = metrics_.histogram (
+                QLatin1String ("applib_gui_start_seconds"),
+                QLatin1String ("Time taken by startGui()."),
+                QString (), 1e-9);
+}
+/* ========================================================================= */
+
 /* ------------------------------------------------------------------------- */
 /**
  * Detailed description for destructor.
@@ -119,104 +291,656 @@ AppLib::AppLib() : QObject (),
 AppLib::~AppLib()
 {
     APPLIB_TRACE_ENTRY;
-    assert(state_ == TerminatedState);
+    assert(state () == TerminatedState);
+    if ((fqmsg_ != NoFilter) && !scoped_)
+        qtMsgFilter ().setDefaultMask (0);
+    {
+        std::lock_guard<std::mutex> lock (lib_instances_mutex_);
+        lib_instances_.removeAll (this);
+    }
+    if (singleton_ == this)
+        singleton_ = NULL;
+    // waits for the background jobs that still use this instance
+    delete executor_.exchange (NULL);
+    NULLIFY(lang_index_);
+    NULLIFY(warm_cache_);
+    delete sampler_.exchange (NULL);
     APPLIB_TRACE_EXIT;
 }
 /* ========================================================================= */
 
 /* ------------------------------------------------------------------------- */
+/**
+ * When APPLIB_TRACE holds the path of a file the zones recorded since
+ * the library was created are saved there.
+ */
+static void saveTraceFromEnv ()
+{
+    QByteArray trace_file = qgetenv ("APPLIB_TRACE");
+    if (!trace_file.isEmpty ())
+        AppLibTrace::saveChromeTrace (QFile::decodeName (trace_file));
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Ends the current instance: the default one, unless the calling
+ * thread is inside an AppLibScope.
+ */
 void AppLib::end ()
 {
-    if (singleton_ != NULL) {
-        singleton_->changeState (TerminatingState);
-        singleton_->_end ();
-        singleton_->changeState (TerminatedState);
-        singleton_->deleteLater();
+    AppLib * lib = current ();
+    if (lib != NULL)
+        lib->finish ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The fast exit (setFastExit()) and the shutdown hooks concern the
+ * process, so they are used only when the default instance ends.
+ * The instance is deleted later, from the event loop.
+ *
+ * A library that is already in TerminatingState (a failed init task,
+ * or the application changed the state) is torn down the same way.
+ */
+void AppLib::finish ()
+{
+    State current = state ();
+    if ((current == TerminatedState) || finishing_)
+        return;
+    finishing_ = true;
+    // a failed init task or the application may have started terminating
+    if (current != TerminatingState)
+        changeState (TerminatingState);
+    if (!scoped_ && fast_exit_.load ()) {
+        // only the flush-critical hooks run, under a deadline
+        QStringList overrun = runShutdownHooks (
+                    fast_exit_deadline_.load ());
+        if (!overrun.isEmpty ()) {
+            fprintf (stderr, "APPLIB: shutdown hooks overran the "
+                             "%d ms deadline: %s\n",
+                     fast_exit_deadline_.load (),
+                     TMP_A(overrun.join (QLatin1String (", "))));
+        }
+        changeState (TerminatedState);
+        saveTraceFromEnv ();
+        flushQtMessages ();
+        fflush (stderr);
+#if defined(__APPLE__)
+        _Exit (fast_exit_code_.load ());
+#else
+        std::quick_exit (fast_exit_code_.load ());
+#endif
+    }
+    drainExecutor ();
+    {
+        AppLibPhase phase (&profiler_, QLatin1String ("_end"));
+        _end ();
+        services_.destroyAll ();
+    }
+    if (!scoped_) {
+        runShutdownHooks (-1);
+    }
+    changeState (TerminatedState);
+    if (!scoped_) {
+        saveTraceFromEnv ();
         singleton_ = NULL;
     }
+    deleteLater();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Runs in TerminatingState, before _end(), so the background tasks do
+ * not outlive what the subclass tears down. The tasks that did not
+ * start before the deadline are dropped.
+ */
+void AppLib::drainExecutor ()
+{
+    AppLibExecutor * pool = executor_.load (std::memory_order_acquire);
+    if (pool == NULL)
+        return;
+    AppLibPhase phase (&profiler_, QLatin1String ("drainExecutor"));
+    if (!pool->drain (executor_drain_ms_.load ())) {
+        APPLIB_DEBUGM("Executor was not drained in %d ms\n",
+                      executor_drain_ms_.load ());
+    }
+    AppLibExecutor::Stats st = pool->stats ();
+    APPLIB_DEBUGM("Executor: %d workers, %llu tasks done (%llu stolen), "
+                  "%llu rejected, %llu dropped, %.1f%% busy\n",
+                  st.workers,
+                  static_cast<unsigned long long>(st.completed),
+                  static_cast<unsigned long long>(st.stolen),
+                  static_cast<unsigned long long>(st.rejected),
+                  static_cast<unsigned long long>(st.dropped),
+                  st.utilisation () * 100.0);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The hooks are independent of each other and are all started at the
+ * same time, each on its own thread. The hooks that did not finish in
+ * time are left running; the process is about to exit anyway.
+ *
+ * @param deadline_ms how long to wait for the hooks; negative is forever
+ * @return the names of the hooks that overran the deadline
+ */
+QStringList AppLib::runShutdownHooks (int deadline_ms)
+{
+    std::vector<ShutdownHookEntry> hooks;
+    {
+        std::lock_guard<std::mutex> lock (hooks_mutex_);
+        hooks = hooks_;
+    }
+    QStringList result;
+    if (hooks.empty ())
+        return result;
+
+    // shared with the threads as the late ones outlive this call
+    struct ShutdownRun {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<bool> done;
+        size_t remaining;
+    };
+    std::shared_ptr<ShutdownRun> run = std::make_shared<ShutdownRun> ();
+    run->done.assign (hooks.size (), false);
+    run->remaining = hooks.size ();
+
+    qint64 start = AppLibProfiler::nowNs ();
+    for (size_t i = 0; i < hooks.size (); ++i) {
+        ShutdownHook hook = hooks[i].hook;
+        std::thread ([run, hook, i] () {
+            hook ();
+            std::lock_guard<std::mutex> lock (run->mutex);
+            run->done[i] = true;
+            --run->remaining;
+            run->cv.notify_all ();
+        }).detach ();
+    }
+
+    std::unique_lock<std::mutex> lock (run->mutex);
+    if (deadline_ms < 0) {
+        run->cv.wait (lock, [&run] () { return run->remaining == 0; });
+    } else {
+        run->cv.wait_for (lock, std::chrono::milliseconds (deadline_ms),
+                          [&run] () { return run->remaining == 0; });
+    }
+    for (size_t i = 0; i < hooks.size (); ++i) {
+        if (!run->done[i])
+            result.append (hooks[i].name);
+    }
+    lock.unlock ();
+
+    APPLIB_DEBUGM("shutdown hooks took %lld ns\n",
+                  static_cast<long long>(AppLibProfiler::nowNs () - start));
+    std::lock_guard<std::mutex> hooks_lock (hooks_mutex_);
+    overrun_hooks_ = result;
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Shutdown hooks are meant for the work that must not be lost when
+ * the process goes away: flushing files, committing transactions,
+ * releasing locks held by other processes. They are run by end() in
+ * parallel; in fast exit mode they are the only thing that runs.
+ *
+ * @param name a name used when reporting hooks that overran
+ * @param hook the function to run
+ * @return an identifier for removeShutdownHook()
+ */
+int AppLib::addShutdownHook (const QString & name, ShutdownHook hook)
+{
+    std::lock_guard<std::mutex> lock (hooks_mutex_);
+    ShutdownHookEntry entry;
+    entry.id = next_hook_id_++;
+    entry.name = name;
+    entry.hook = hook;
+    hooks_.push_back (entry);
+    return entry.id;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLib::removeShutdownHook (int id)
+{
+    std::lock_guard<std::mutex> lock (hooks_mutex_);
+    for (size_t i = 0; i < hooks_.size (); ++i) {
+        if (hooks_[i].id == id) {
+            hooks_.erase (hooks_.begin () + i);
+            return true;
+        }
+    }
+    return false;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * In fast exit mode end() moves the library to TerminatingState, runs the
+ * shutdown hooks in parallel and waits for them at most the deadline.
+ * It then reports the hooks that overran to stderr, moves to
+ * TerminatedState, writes pending Qt messages and leaves the process
+ * through quick_exit(). _end(), the destructors of static objects and
+ * the atexit() handlers are skipped.
+ *
+ * @param b_fast enable or disable the fast exit
+ * @param deadline_ms how long the shutdown hooks may take
+ * @param exit_code the exit code of the process
+ */
+void AppLib::setFastExit (bool b_fast, int deadline_ms, int exit_code)
+{
+    fast_exit_deadline_.store (deadline_ms);
+    fast_exit_code_.store (exit_code);
+    fast_exit_.store (b_fast);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+QStringList AppLib::overrunShutdownHooks ()
+{
+    std::lock_guard<std::mutex> lock (hooks_mutex_);
+    return overrun_hooks_;
 }
 /* ========================================================================= */
 
 /* ------------------------------------------------------------------------- */
 bool AppLib::startGui ()
 {
-    Q_ASSERT(singleton_ != NULL);
-    singleton_->changeState (RunningGuiState);
-    singleton_->mw_ = singleton_->_startGui ();
-    if (singleton_->mw_ == NULL)
-        return NULL;
-    singleton_->connect (singleton_->mw_, SIGNAL(guiEnding ()),
-             singleton_, SIGNAL(guiEnding ()));
-    singleton_->connect (singleton_->mw_, SIGNAL(guiEnded ()),
-             singleton_, SIGNAL(guiEnded ()));
-    emit singleton_->guiStarted();
-    return singleton_->mw_ != NULL;
+    AppLib * lib = current ();
+    Q_ASSERT(lib != NULL);
+    if (!lib->beginGui ())
+        return false;
+    lib->guiPresented ();
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Used by startGui() and by extensions that show the GUI later
+ * (AppLibGui::startGuiAsync()); those call guiPresented() themselves.
+ */
+bool AppLib::beginGui ()
+{
+    qint64 start_ns = AppLibProfiler::nowNs ();
+    changeState (RunningGuiState);
+    {
+        AppLibPhase phase (&profiler_, QLatin1String ("_startGui"));
+        mw_ = _startGui ();
+    }
+    gui_start_metric_->record (
+                static_cast<quint64>(AppLibProfiler::nowNs () - start_ns));
+    if (mw_ == NULL)
+        return false;
+    connect (mw_, SIGNAL(guiEnding ()),
+             this, SLOT(mainGuiEnding ()));
+    connect (mw_, SIGNAL(guiEnded ()),
+             this, SLOT(mainGuiEnded ()));
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLib::guiPresented ()
+{
+    observers_.notify (this, AppLibObservers::GuiStarted);
+    emit guiStarted();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The default instance sizes the pool from the APPLIB_EXECUTOR_THREADS
+ * environment variable and pins the workers to the processors listed
+ * (comma separated) in APPLIB_EXECUTOR_CPUS.
+ *
+ * The pool accepts tasks from InitializingState until the library
+ * starts terminating; submit() returns false outside that window.
+ */
+AppLibExecutor * AppLib::executor ()
+{
+    AppLibExecutor * result = executor_.load (std::memory_order_acquire);
+    if (result != NULL)
+        return result;
+
+    std::lock_guard<std::mutex> lock (executor_mutex_);
+    result = executor_.load (std::memory_order_relaxed);
+    if (result != NULL)
+        return result;
+
+    int workers = 0;
+    std::vector<int> cpus;
+    if (!scoped_) {
+        workers = qgetenv ("APPLIB_EXECUTOR_THREADS").toInt ();
+        QList<QByteArray> cpu_list = qgetenv ("APPLIB_EXECUTOR_CPUS").split (',');
+        for (int i = 0; i < cpu_list.count (); ++i) {
+            bool b_ok;
+            int value = cpu_list.at (i).trimmed ().toInt (&b_ok);
+            if (b_ok && (value >= 0))
+                cpus.push_back (value);
+        }
+    }
+    result = new AppLibExecutor (workers);
+    if (!cpus.empty () && !result->setAffinity (cpus)) {
+        APPLIB_DEBUGM("Executor affinity could not be set\n");
+    }
+    State current = state ();
+    result->setAccepting (
+                (current >= InitializingState) && (current < TerminatingState));
+    executor_.store (result, std::memory_order_release);
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLib::mainGuiEnding ()
+{
+    observers_.notify (this, AppLibObservers::GuiEnding);
+    emit guiEnding ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLib::mainGuiEnded ()
+{
+    observers_.notify (this, AppLibObservers::GuiEnded);
+    emit guiEnded ();
 }
 /* ========================================================================= */
 
 /* ------------------------------------------------------------------------- */
 AppLib * AppLib::uniqAppLib ()
 {
-    assert (singleton_ != NULL);
-    return singleton_;
+    AppLib * lib = current ();
+    assert (lib != NULL);
+    return lib;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLib * AppLib::current ()
+{
+    AppLib * lib = tls_current_lib_;
+    return lib != NULL ? lib : singleton_;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+QList<AppLib *> AppLib::instances ()
+{
+    std::lock_guard<std::mutex> lock (lib_instances_mutex_);
+    return lib_instances_;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @class AppLibScope
+ *
+ * While the scope lives the static API of AppLib (uniqAppLib(),
+ * profiler(), isGUI(), end(), ...) and the Qt messages produced by
+ * the thread refer to the given instance. Scopes nest; a NULL
+ * instance selects the default one. Worker threads that run tasks
+ * for a scoped instance open their own scope.
+ */
+AppLibScope::AppLibScope (AppLib * lib) :
+    previous_ (tls_current_lib_)
+{
+    tls_current_lib_ = lib;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibScope::~AppLibScope ()
+{
+    tls_current_lib_ = previous_;
 }
 /* ========================================================================= */
 
 /* ------------------------------------------------------------------------- */
 AppLib::BuildType AppLib::buildType()
 {
-    assert (singleton_ != NULL);
-    return singleton_->_buildType ();
+    AppLib * lib = current ();
+    assert (lib != NULL);
+    return lib->_buildType ();
 }
 /* ========================================================================= */
 
 /* ------------------------------------------------------------------------- */
 void AppLib::setGUI (bool b_gui)
 {
-    assert (singleton_ != NULL);
-    singleton_->gui_mode_ = b_gui;
+    AppLib * lib = current ();
+    assert (lib != NULL);
+    lib->gui_mode_ = b_gui;
 }
 /* ========================================================================= */
 
 /* ------------------------------------------------------------------------- */
 bool AppLib::isGUI ()
 {
-    assert (singleton_ != NULL);
-    return singleton_->gui_mode_;
+    AppLib * lib = current ();
+    assert (lib != NULL);
+    return lib->gui_mode_;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! The resources are sampled only while running.
+static int samplerPhase (int state)
+{
+    return ((state == AppLib::RunningState) ||
+            (state == AppLib::RunningGuiState)) ? state : -1;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The samples are taken in RunningState and RunningGuiState and are
+ * summarized separately for each; the summaries are logged when the
+ * library reaches TerminatedState. A running sampler is restarted
+ * with the new interval and keeps its summaries.
+ *
+ * @param interval_ms time between samples
+ * @return false if there's no current instance or the platform is not
+ *      supported
+ */
+bool AppLib::startResourceSampler (int interval_ms)
+{
+    AppLib * lib = current ();
+    return lib == NULL ? false : lib->startSampler (interval_ms);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLib::startSampler (int interval_ms)
+{
+    std::lock_guard<std::mutex> lock (sampler_mutex_);
+    AppLibSampler * sampler = sampler_.load (std::memory_order_relaxed);
+    if (sampler == NULL) {
+        sampler = new AppLibSampler ();
+        sampler_.store (sampler, std::memory_order_release);
+    }
+    sampler->setPhase (samplerPhase (state ()));
+    return sampler->start (interval_ms);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! A wait for value is over: reached, or only later states can follow.
+static bool stateSettles (int current, int value)
+{
+    return AppLib::isStateReached (static_cast<AppLib::State>(current),
+                                   static_cast<AppLib::State>(value)) ||
+            (current > value);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The new value is published with release semantics, so a thread that
+ * observes it through state() or waitForState() also observes everything
+ * done before the transition. Waiting threads are woken up.
+ */
+void AppLib::setState (State value)
+{
+    int previous = state_.exchange (value, std::memory_order_acq_rel);
+    qint64 now = AppLibProfiler::nowNs ();
+    qint64 since = state_since_ns_.exchange (now, std::memory_order_relaxed);
+    if ((previous >= InitialState) && (previous <= TerminatedState))
+        state_metrics_[previous]->add (static_cast<double>(now - since) / 1e9);
+    transition_metric_->add ();
+    if (previous == InitializingState)
+        services_.seal ();
+    if ((value == InitializingState) || (value >= TerminatingState)) {
+        // closed before _end() and on the fast exit path as well
+        std::lock_guard<std::mutex> executor_lock (executor_mutex_);
+        AppLibExecutor * pool = executor_.load (std::memory_order_relaxed);
+        if (pool != NULL)
+            pool->setAccepting (value == InitializingState);
+    }
+    AppLibSampler * sampler = sampler_.load (std::memory_order_acquire);
+    if (sampler != NULL)
+        sampler->setPhase (samplerPhase (value));
+    AppLibFlightRecorder * recorder =
+            flight_recorder_.load (std::memory_order_acquire);
+    if (recorder != NULL)
+        recorder->transition (previous, value);
+    StateWaiter * woken = NULL;
+    {
+        std::lock_guard<std::mutex> lock (state_mutex_);
+        StateWaiter ** link = &state_waiters_;
+        while (*link != NULL) {
+            StateWaiter * waiter = *link;
+            if (stateSettles (value, waiter->state)) {
+                *link = waiter->next;
+                waiter->next = woken;
+                woken = waiter;
+            } else {
+                link = &waiter->next;
+            }
+        }
+        state_cv_.notify_all ();
+    }
+    // the waiters were registered newest first; the list is now reversed
+    while (woken != NULL) {
+        StateWaiter * waiter = woken;
+        woken = waiter->next;
+        waiter->wake (waiter, isStateReached (value, waiter->state));
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The states only move forward (Initial, Initializing, Running or
+ * Running with GUI, Terminating, Terminated), except that the library
+ * may go back and forth between Running and Running with GUI.
+ * Therefore:
+ * - a wait for RunningState means "started" and is satisfied by
+ *   RunningGuiState as well; a wait for RunningGuiState needs the GUI
+ *   and goes on while the library is in RunningState;
+ * - a wait for any other state is satisfied only by that state;
+ * - a state that comes before the current one can no longer be reached
+ *   and the wait ends at once with false (this includes the states
+ *   skipped when the initialization fails and the library goes straight
+ *   to termination).
+ *
+ * Must not be called from the thread that changes the state
+ * (usually the main thread), as that would never return.
+ *
+ * @param value the state to wait for
+ * @param timeout_ms how long to wait; negative means forever
+ * @return true if the library is in the requested state
+ */
+bool AppLib::waitForState (State value, int timeout_ms) const
+{
+    State current = state ();
+    if (isStateReached (current, value))
+        return true;
+
+    std::unique_lock<std::mutex> lock (state_mutex_);
+    auto reached = [this, value, &current] () {
+        current = state ();
+        return stateSettles (current, value);
+    };
+    if (timeout_ms < 0) {
+        state_cv_.wait (lock, reached);
+    } else {
+        state_cv_.wait_for (
+                    lock, std::chrono::milliseconds (timeout_ms), reached);
+    }
+    return isStateReached (current, value);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Does not block: the waiter is called by the thread that changes the
+ * state, after the change is visible and without holding any lock, so
+ * it should only hand the work to someone else (see applib-coro.h).
+ * The waiter must stay alive until it is called; every waiter is called
+ * before the library reaches TerminatedState.
+ *
+ * @param waiter the state to wait for and the function to call
+ * @return false, without registering the waiter, if the state was
+ *      already reached or can no longer be reached (same rules as
+ *      waitForState())
+ */
+bool AppLib::addStateWaiter (StateWaiter * waiter)
+{
+    std::lock_guard<std::mutex> lock (state_mutex_);
+    if (stateSettles (state (), waiter->state))
+        return false;
+    waiter->next = state_waiters_;
+    state_waiters_ = waiter;
+    return true;
 }
 /* ========================================================================= */
 
 /* ------------------------------------------------------------------------- */
 bool AppLib::changeState (AppLib::State value)
 {
+    APPLIB_TRACE_FUNCTION("APPLIB");
     bool b_ret = false;
-    switch (state_) {
+    switch (state ()) {
     case InitialState: {
         if (value != InitializingState) {
             APPLIB_DEBUGM("The only valid state while in Initial is Initializing "
                           "(%d)\n", value);
             break;
         }
-        APPLIB_DEBUGM("APPLIB: ==========================================\n");
-        APPLIB_DEBUGM("APPLIB: lib %s is being initialized\n", TMP_A(appUserName ()));
-        APPLIB_DEBUGM("APPLIB: %s\n", TMP_A(app_start_moment_.toString ()));
-        APPLIB_DEBUGM("APPLIB: ==========================================\n");
+        APPLIB_DEBUGM("==========================================\n");
+        APPLIB_DEBUGM("lib %s is being initialized\n", TMP_A(appUserName ()));
+        APPLIB_DEBUGM("%s\n", TMP_A(
+                          AppLibClock::toDateTime (app_start_ns_).toString ()));
+        APPLIB_DEBUGM("==========================================\n");
 
         switch (buildType ()) {
         case ReleaseWithDebugBuild: {
-            qsrand (QDateTime::currentDateTime().toTime_t());
-            APPLIB_DEBUGM ("LIBMAKEINST: Release version with debug information\n");
+            qsrand (static_cast<uint>(AppLibClock::wallNs () / 1000000000));
+            APPLIB_LOG (AppLibLog::LibMakeInstCat, AppLibLog::Debug,
+                        "Release version with debug information\n");
             break; }
         case DebugBuild: {
-            qsrand (QDateTime::currentDateTime().toTime_t());
-            APPLIB_DEBUGM ("LIBMAKEINST: Debug version\n");
+            qsrand (static_cast<uint>(AppLibClock::wallNs () / 1000000000));
+            APPLIB_LOG (AppLibLog::LibMakeInstCat, AppLibLog::Debug,
+                        "Debug version\n");
             break; }
         case ReleaseBuild: {
-            APPLIB_DEBUGM ("LIBMAKEINST: Release version\n");
+            APPLIB_LOG (AppLibLog::LibMakeInstCat, AppLibLog::Debug,
+                        "Release version\n");
             break; }
         }
 
-        state_ = value;
+        setState (value);
+        init_span_ = profiler_.begin (QLatin1String ("initializing"));
+        observers_.notify (this, AppLibObservers::LibStarting);
         emit libStarting ();
         break;
     }
@@ -229,14 +953,39 @@ bool AppLib::changeState (AppLib::State value)
                           "only to Running or Terminating (%d)\n", value);
             break;
         }
-        TimeInterval ti (app_start_moment_);
-        APPLIB_DEBUGM("APPLIB: ==========================================\n");
-        APPLIB_DEBUGM("APPLIB: %s\n", TMP_A(ti.start ().toString ()));
-        APPLIB_DEBUGM("APPLIB: lib %s was started in %d miliseconds\n",
+        bool b_init_ok = true;
+        if ((value != TerminatingState) && init_graph_.hasPending ()) {
+            QString s_error;
+            b_init_ok = init_graph_.run (executor (), &profiler_, &s_error);
+            if (!b_init_ok) {
+                APPLIB_DEBUGM("%s\n", TMP_A(s_error));
+            }
+        }
+        if (b_init_ok && (warm_cache_ != NULL) && warm_cache_->isDirty ()) {
+            AppLibPhase phase (&profiler_, QLatin1String ("saveWarmCache"));
+            warm_cache_->save ();
+        }
+
+        profiler_.end (init_span_);
+        TimeInterval ti (app_start_ns_);
+        APPLIB_DEBUGM("==========================================\n");
+        APPLIB_DEBUGM("%s\n", TMP_A(ti.start ().toString ()));
+        APPLIB_DEBUGM("lib %s was started in %d miliseconds\n",
                       TMP_A(appUserName ()), ti.miliseconds ());
-        APPLIB_DEBUGM("APPLIB: ==========================================\n");
+        APPLIB_DEBUGM("%s", TMP_A(profiler_.toTreeString ()));
+        APPLIB_DEBUGM("==========================================\n");
+
+        if (!b_init_ok) {
+            // a failed init task takes us to termination instead
+            setState (TerminatingState);
+            term_span_ = profiler_.begin (QLatin1String ("terminating"));
+            observers_.notify (this, AppLibObservers::LibEnding);
+            emit libEnding ();
+            break;
+        }
 
-        emit libStarted();
+        observers_.notify (this, AppLibObservers::LibStarted);
+        emit libStarted ();
         b_ret = true;
         break;
     }
@@ -252,13 +1001,16 @@ bool AppLib::changeState (AppLib::State value)
         }
 
         if (value == TerminatingState) {
-            APPLIB_DEBUGM("APPLIB: ==========================================\n");
-            APPLIB_DEBUGM("APPLIB: lib %s is being terminated\n",
+            APPLIB_DEBUGM("==========================================\n");
+            APPLIB_DEBUGM("lib %s is being terminated\n",
                           TMP_A(appUserName ()));
-            APPLIB_DEBUGM("APPLIB: ==========================================\n");
+            APPLIB_DEBUGM("==========================================\n");
+            term_span_ = profiler_.begin (QLatin1String ("terminating"));
+            observers_.notify (this, AppLibObservers::LibEnding);
             emit libEnding ();
         } else {
-            APPLIB_DEBUGM("APPLIB: %s GUI is starting\n", TMP_A(appUserName ()));
+            APPLIB_DEBUGM("%s GUI is starting\n", TMP_A(appUserName ()));
+            observers_.notify (this, AppLibObservers::GuiStarting);
             emit guiStarting ();
         }
 
@@ -277,13 +1029,16 @@ bool AppLib::changeState (AppLib::State value)
         }
 
         if (value == TerminatingState) {
-            APPLIB_DEBUGM("APPLIB: ==========================================\n");
-            APPLIB_DEBUGM("APPLIB: lib %s is being terminated\n",
+            APPLIB_DEBUGM("==========================================\n");
+            APPLIB_DEBUGM("lib %s is being terminated\n",
                           TMP_A(appUserName ()));
-            APPLIB_DEBUGM("APPLIB: ==========================================\n");
+            APPLIB_DEBUGM("==========================================\n");
+            term_span_ = profiler_.begin (QLatin1String ("terminating"));
+            observers_.notify (this, AppLibObservers::LibEnding);
             emit libEnding ();
         } else {
-            APPLIB_DEBUGM("APPLIB: %s lost its GUI\n", TMP_A(appUserName ()));
+            APPLIB_DEBUGM("%s lost its GUI\n", TMP_A(appUserName ()));
+            observers_.notify (this, AppLibObservers::GuiEnded);
             emit guiEnded ();
         }
 
@@ -298,13 +1053,28 @@ bool AppLib::changeState (AppLib::State value)
             break;
         }
 
-        TimeInterval ti (app_start_moment_);
-        APPLIB_DEBUGM("APPLIB: ==========================================\n");
-        APPLIB_DEBUGM("APPLIB: %s\n", TMP_A(ti.start ().toString ()));
-        APPLIB_DEBUGM("APPLIB: lib %s has run %s\n",
+        profiler_.end (term_span_);
+        TimeInterval ti (app_start_ns_);
+        APPLIB_DEBUGM("==========================================\n");
+        APPLIB_DEBUGM("%s\n", TMP_A(ti.start ().toString ()));
+        APPLIB_DEBUGM("lib %s has run %s\n",
                       TMP_A(appUserName ()), TMP_A(ti.toString ()));
-        APPLIB_DEBUGM("APPLIB: ==========================================\n");
-        emit libEnded();
+        APPLIB_DEBUGM("%s", TMP_A(profiler_.toTreeString ()));
+        AppLibSampler * sampler = sampler_.load (std::memory_order_acquire);
+        if (sampler != NULL) {
+            static const char * state_names[] = {
+                "initial", "initializing", "running", "running gui",
+                "terminating", "terminated"
+            };
+            QStringList names;
+            for (int i = 0; i < 6; ++i)
+                names.append (QLatin1String (state_names[i]));
+            sampler->stop ();
+            APPLIB_DEBUGM("resources:\n%s", TMP_A(sampler->report (names)));
+        }
+        APPLIB_DEBUGM("==========================================\n");
+        observers_.notify (this, AppLibObservers::LibEnded);
+        emit libEnded ();
 
         b_ret = true;
         break;
@@ -316,7 +1086,7 @@ bool AppLib::changeState (AppLib::State value)
     }
 
     if (b_ret) {
-        state_ = value;
+        setState (value);
     }
 
     return b_ret;
@@ -325,117 +1095,875 @@ bool AppLib::changeState (AppLib::State value)
 
 /* ------------------------------------------------------------------------- */
 /**
- * The method must be explicitly called by the implementation, maybe inside
- * _init() implementation.
+ * The tasks are run when the library is asked to go from
+ * InitializingState to RunningState (or RunningGuiState), before libStarted()
+ * is emitted. Tasks with AnyThread affinity run in parallel on a pool
+ * of worker threads, while the MainThread ones run on the thread that
+ * calls changeState(). If any of them fails the library goes to
+ * TerminatingState instead (libEnding() is emitted) and changeState()
+ * returns false.
  *
  * Example:
  * @code
- * QString locale = APP_STGS->valueS (
- *     STG_LANGUAGE, QLocale::system().name());
- * if (startTranslation (locale)) {
- *     APP_STGS->setValue (STG_LANGUAGE, locale);
- * }
+ * addInitTask ("settings", QStringList (),
+ *              AppLibInitGraph::AnyThread, loadSettings);
+ * addInitTask ("models", QStringList () << "settings",
+ *              AppLibInitGraph::AnyThread, buildModels);
+ * addInitTask ("actions", QStringList () << "settings",
+ *              AppLibInitGraph::MainThread, createActions);
  * @endcode
  *
- * @param locale (in/out) The name of the locale to use;
- *      save the resulted value to settings.
+ * @param name unique name of the task
+ * @param depends_on names of the tasks that must succeed first
+ * @param affinity where may the task run
+ * @param fn the work; returns false and sets the error to fail
+ * @return false if the name is in use or the library is past initialization
+ */
+bool AppLib::addInitTask (
+        const QString & name, const QStringList & depends_on,
+        AppLibInitGraph::Affinity affinity, AppLibInitGraph::Function fn)
+{
+    State current = state ();
+    if ((current != InitialState) && (current != InitializingState)) {
+        APPLIB_DEBUGM("Init task %s added after initialization\n",
+                      TMP_A(name));
+        return false;
+    }
+    return init_graph_.addTask (name, depends_on, affinity, fn);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The method must be explicitly called by the implementation, maybe inside
+ * _init() implementation.
+ *
+ * Example:
+ * @code
+ * QString locale = APP_STGS->valueS (
+ *     STG_LANGUAGE, QLocale::system().name());
+ * if (startTranslation (locale)) {
+ *     APP_STGS->setValue (STG_LANGUAGE, locale);
+ * }
+ * @endcode
+ *
+ * @param locale (in/out) The name of the locale to use;
+ *      save the resulted value to settings.
  * @param env_var_path (in) The name of the environment variable that
  *      overrides path search mechanism for translations.
  * @return true if we were able to load the language
  */
 bool AppLib::startTranslation (QString & locale, const char * env_var_path)
 {
+    AppLibPhase phase (&profiler_, QLatin1String ("startTranslation"));
+    TranslationJob job;
+    job.locale = locale;
+    job.index = lang_index_;
+    if (!loadTranslation (job, env_var_path, &profiler_)) {
+        return false;
+    }
+    locale = job.locale;
+    return installTranslation (job);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Finds the language and gets its translators without touching the
+ * application object, so that it can run on any thread.
+ *
+ * The translators are loaded by QTranslator from the .qm files, which
+ * maps the file in memory (read-only) where the platform allows it;
+ * the pages are then shared by all the processes using the catalog.
+ *
+ * @param job (in/out) the locale to look for; receives the results
+ * @param env_var_path the name of the environment variable that
+ *      overrides path search mechanism for translations.
+ * @param profiler records the phases (may be NULL)
+ * @return true if the application translator was found
+ */
+bool AppLib::loadTranslation (
+        TranslationJob & job, const char * env_var_path,
+        AppLibProfiler * profiler)
+{
+    APPLIB_TRACE_FUNCTION("APPLIB");
+    job.lang = -1;
+    job.qt_translator = NULL;
+    job.translator = NULL;
+    job.owned = false;
+    if ((job.index != NULL) && job.index->isValid ()) {
+        return loadIndexedTranslation (job, profiler);
+    }
+
     // each language has its own directory that contains
     // a compiled translation file (.qm), a metadata file
     // loadable by QSettings (metadata.ini) and an icon.png file.
     QString s_error;
-    if (!Translate::init (env_var_path, &s_error)) {
+    bool b_init;
+    {
+        AppLibPhase phase_init (profiler, QLatin1String ("Translate::init"));
+        b_init = Translate::init (env_var_path, &s_error);
+    }
+    if (!b_init) {
         APPLIB_DEBUGM("%s\n", TMP_A(s_error));
         return false;
     }
     if (Translate::count () <= 0) {
-        APPLIB_DEBUGM("No available translations");
+        APPLIB_DEBUGM("No available translations\n");
         return false;
     }
 
     // Name of the language or default
-    if (locale.isEmpty ()) {
-        APPLIB_DEBUGM("No default language");
+    if (job.locale.isEmpty ()) {
+        APPLIB_DEBUGM("No default language\n");
         return false;
     }
 
     // see if we have this language
-    int lang = Translate::itemIndex (locale);
+    int lang = Translate::itemIndex (job.locale);
     if (lang == -1) {
         lang = Translate::itemIndexFromLocale (QLocale::system().name());
         if (lang == -1) {
-            APPLIB_DEBUGM("Locale %s not available", TMP_A(locale));
+            APPLIB_DEBUGM("Locale %s not available\n", TMP_A(job.locale));
             return false;
         }
-        locale = Translate::item (lang).langName();
+        job.locale = Translate::item (lang).langName();
     }
+    job.lang = lang;
 
-    QTranslator * translator;
-    // order is important when installing translators
-    translator = Translate::qtTranslator (lang);
-    if (translator == NULL) {
-        APPLIB_DEBUGM("No qt translation for locale %s\n", TMP_A(locale));
+    AppLibPhase phase_load (profiler, QLatin1String ("loadTranslators"));
+    job.qt_translator = Translate::qtTranslator (lang);
+    if (job.qt_translator == NULL) {
+        APPLIB_DEBUGM("No qt translation for locale %s\n", TMP_A(job.locale));
+    }
+    job.translator = Translate::translator (lang);
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The language is resolved through the index, without initializing
+ * the Translate pile, and the translators are created by us: the one
+ * for the application from the indexed .qm file and the one for Qt
+ * from the translations that come with Qt.
+ *
+ * @param job (in/out) the locale to look for; receives the results
+ * @param profiler records the phases (may be NULL)
+ * @return true if the language was found
+ */
+bool AppLib::loadIndexedTranslation (
+        TranslationJob & job, AppLibProfiler * profiler)
+{
+    APPLIB_TRACE_FUNCTION("APPLIB");
+    AppLibPhase phase (profiler, QLatin1String ("loadIndexedTranslation"));
+    const AppLibLangIndex * index = job.index;
+
+    int lang = -1;
+    if (!job.locale.isEmpty ())
+        lang = index->findLocale (job.locale);
+    if (lang == -1) {
+        lang = index->findLocale (QLocale::system().name());
+        if (lang == -1) {
+            APPLIB_DEBUGM("Locale %s not available\n", TMP_A(job.locale));
+            return false;
+        }
+        job.locale = index->name (lang);
+    }
+    job.owned = true;
+
+    QTranslator * translator = new QTranslator ();
+    if (translator->load (QLatin1String ("qt_") + job.locale,
+                          QLibraryInfo::location (
+                              QLibraryInfo::TranslationsPath))) {
+        job.qt_translator = translator;
+    } else {
+        APPLIB_DEBUGM("No qt translation for locale %s\n", TMP_A(job.locale));
+        delete translator;
+    }
+
+    translator = new QTranslator ();
+    if (translator->load (index->qmFile (lang))) {
+        job.translator = translator;
     } else {
-        qApp->installTranslator (translator);
+        delete translator;
     }
+    return true;
+}
+/* ========================================================================= */
 
-    translator = Translate::translator (lang);
-    if (translator == NULL) {
-        APPLIB_DEBUGM("Failed to load existing locale %s\n", TMP_A(locale));
+/* ------------------------------------------------------------------------- */
+/**
+ * Once an index is set, startTranslation() and startTranslationAsync()
+ * find the language with a hashed lookup in the mapped index and load
+ * the .qm file directly, without scanning the translation tree. The
+ * Translate pile is not initialized on this path.
+ *
+ * The index is rebuilt only when it was written by another version
+ * of the library or when one of the directories changed.
+ *
+ * @param index_file where to keep the index (a cache location)
+ * @param roots the directories that contain one directory per language
+ * @return true if the index is usable
+ */
+bool AppLib::setTranslationIndex (
+        const QString & index_file, const QStringList & roots)
+{
+    {
+        std::lock_guard<std::mutex> lock (translation_mutex_);
+        if (translation_busy_)
+            return false;
+    }
+    AppLibPhase phase (&profiler_, QLatin1String ("setTranslationIndex"));
+    if (lang_index_ == NULL)
+        lang_index_ = new AppLibLangIndex ();
+    if (!lang_index_->open (index_file, roots)) {
+        NULLIFY(lang_index_);
         return false;
     }
-    qApp->installTranslator (translator);
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Call it from _init() (or before) and then get the expensive,
+ * deterministic parts of the initialization through warmArtifact().
+ * The artifacts that had to be produced are written to the file when
+ * the library leaves InitializingState, so the next start finds them.
+ *
+ * @param file where to keep the cache (a cache location)
+ * @param key identifies the build of the application; a file written
+ *      with another key (or by another build of AppLib) is ignored
+ * @return true if a valid cache file was found
+ */
+bool AppLib::setWarmCache (const QString & file, const QByteArray & key)
+{
+    AppLibPhase phase (&profiler_, QLatin1String ("setWarmCache"));
+    if (warm_cache_ == NULL)
+        warm_cache_ = new AppLibWarmCache ();
+    return warm_cache_->open (file, key);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Without a cache (see setWarmCache()) the serializer is simply called.
+ * The bytes returned for a cached artifact point in the mapped cache
+ * file and are valid for the life of the library.
+ *
+ * @code
+ * QByteArray table = warmArtifact (
+ *         "keywords",
+ *         AppLibWarmCache::fingerprintFiles (QStringList () << src),
+ *         [src] () { return buildKeywordTable (src); });
+ * @endcode
+ *
+ * @param name identifies the artifact
+ * @param fingerprint of the inputs, see AppLibWarmCache::fingerprintFiles()
+ * @param serializer builds the serialized artifact
+ * @return the bytes of the artifact
+ */
+QByteArray AppLib::warmArtifact (
+        const QString & name, quint64 fingerprint,
+        AppLibWarmCache::Serializer serializer)
+{
+    APPLIB_TRACE_FUNCTION("APPLIB");
+    if (warm_cache_ == NULL)
+        return serializer ();
+    return warm_cache_->artifact (name, fingerprint, serializer);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Must be called on the thread of the application object.
+ *
+ * @param job the results of loadTranslation()
+ * @return true if the application translator was installed
+ */
+bool AppLib::installTranslation (TranslationJob & job)
+{
+    AppLibPhase phase_install (&profiler_, QLatin1String ("installTranslators"));
+    if (job.owned) {
+        if (job.qt_translator != NULL)
+            job.qt_translator->setParent (this);
+        if (job.translator != NULL)
+            job.translator->setParent (this);
+    }
+
+    // order is important when installing translators
+    if (job.qt_translator != NULL) {
+        qApp->installTranslator (job.qt_translator);
+    }
+
+    if (job.translator == NULL) {
+        APPLIB_DEBUGM("Failed to load existing locale %s\n", TMP_A(job.locale));
+        return false;
+    }
+    qApp->installTranslator (job.translator);
 
     // save this in case it was default value
-    Translate::setCurrent (lang);
+    if (job.lang != -1)
+        Translate::setCurrent (job.lang);
 
     return true;
 }
 /* ========================================================================= */
 
-
 /* ------------------------------------------------------------------------- */
 /**
+ * The search for the language and the loading of the .qm files happen
+ * on a worker thread; the translators are installed on the thread of
+ * this object once they are ready and then translationReady() is emitted.
+ * The Translate pile should not be used until then.
  *
- * Use it in your initialization code:
+ * Example:
  * @code
- * qInstallMessageHandler (AppLib::echoQtMessages);
+ * connect (this, SIGNAL(translationReady(bool,QString)),
+ *          this, SLOT(languageLoaded(bool,QString)));
+ * startTranslationAsync (APP_STGS->valueS (
+ *     STG_LANGUAGE, QLocale::system().name()));
  * @endcode
  *
+ * @param locale the name of the locale to use
+ * @param env_var_path (in) The name of the environment variable that
+ *      overrides path search mechanism for translations.
+ * @return false if a translation is already being loaded or the
+ *      executor does not accept work
  */
-void AppLib::echoQtMessages (
-        QtMsgType type, const QMessageLogContext &/*context*/,
-        const QString &msg)
+bool AppLib::startTranslationAsync (
+        const QString & locale, const char * env_var_path)
+{
+    {
+        std::lock_guard<std::mutex> lock (translation_mutex_);
+        if (translation_busy_)
+            return false;
+        translation_busy_ = true;
+    }
+    QByteArray env_var (env_var_path == NULL ? "" : env_var_path);
+    QThread * target = thread ();
+    const AppLibLangIndex * index = lang_index_;
+    bool b_queued = executor ()->submit (
+                [this, locale, env_var, target, index] () {
+        TranslationJob job;
+        job.locale = locale;
+        job.index = index;
+        AppLibPhase phase (&profiler_, QLatin1String ("startTranslationAsync"));
+        job.ok = loadTranslation (
+                    job, env_var.isEmpty () ? NULL : env_var.constData (),
+                    &profiler_);
+
+        // the translators must live in the thread that uses them
+        QObject * translators[2] = { job.qt_translator, job.translator };
+        for (int i = 0; i < 2; ++i) {
+            if ((translators[i] != NULL) &&
+                    (translators[i]->thread () == QThread::currentThread ()))
+                translators[i]->moveToThread (target);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock (translation_mutex_);
+            translation_job_ = job;
+        }
+        QMetaObject::invokeMethod (
+                    this, "translationLoaded", Qt::QueuedConnection);
+    });
+    if (!b_queued) {
+        // the executor only accepts work while the library is alive
+        std::lock_guard<std::mutex> lock (translation_mutex_);
+        translation_busy_ = false;
+    }
+    return b_queued;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLib::translationLoaded ()
+{
+    TranslationJob job;
+    {
+        std::lock_guard<std::mutex> lock (translation_mutex_);
+        job = translation_job_;
+    }
+
+    bool b_ok = job.ok && installTranslation (job);
+
+    {
+        std::lock_guard<std::mutex> lock (translation_mutex_);
+        translation_busy_ = false;
+    }
+    emit translationReady (b_ok, job.locale);
+}
+/* ========================================================================= */
+
+
+/* ------------------------------------------------------------------------- */
+//! Convert a combination of FilterQtMsg flags to a mask of types.
+static int typeMaskFromFlags (int flags)
+{
+    int mask = 0;
+    if ((flags & AppLib::ExcludeDebug) != 0)
+        mask |= AppLibMsgFilter::typeBit (QtDebugMsg);
+    if ((flags & AppLib::ExcludeWarning) != 0)
+        mask |= AppLibMsgFilter::typeBit (QtWarningMsg);
+    if ((flags & AppLib::ExcludeError) != 0)
+        mask |= AppLibMsgFilter::typeBit (QtCriticalMsg);
+    if ((flags & AppLib::ExcludeFatal) != 0)
+        mask |= AppLibMsgFilter::typeBit (QtFatalMsg);
+    return mask;
+}
+/* ========================================================================= */
+
+//! the category filter that was installed before ours
+static QLoggingCategory::CategoryFilter previous_category_filter_ = NULL;
+
+//! has our category filter been installed?
+static bool category_filter_installed_ = false;
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Called by Qt once for each category when it is created and for all
+ * of them when the filter is installed. The categories learn which types
+ * are disabled, so the messages they reject are not even formatted.
+ */
+static void applyCategoryFilter (QLoggingCategory * category)
+{
+    if (previous_category_filter_ != NULL)
+        previous_category_filter_ (category);
+
+    AppLibMsgFilter & filter = qtMsgFilter ();
+    filter.registerCategory (category->categoryName ());
+    int mask = filter.rejectedMask (category->categoryName ());
+    const QtMsgType types[] = {
+        QtDebugMsg,
+#if QT_VERSION >= 0x050500
+        QtInfoMsg,
+#endif
+        QtWarningMsg,
+        QtCriticalMsg
+    };
+    for (unsigned i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+        if ((mask & AppLibMsgFilter::typeBit (types[i])) != 0)
+            category->setEnabled (types[i], false);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! (Re)install the category filter so that all categories see the rules.
+static void refreshCategoryFilter ()
+{
+    static std::mutex install_mutex;
+    std::lock_guard<std::mutex> lock (install_mutex);
+    QLoggingCategory::CategoryFilter previous =
+            QLoggingCategory::installFilter (applyCategoryFilter);
+    if (!category_filter_installed_) {
+        previous_category_filter_ = previous;
+        category_filter_installed_ = true;
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static const char * qtMsgPrefix (QtMsgType type)
 {
     switch (type) {
     case QtDebugMsg:
-        if (uniqAppLib ()->isQtMsgFilterSet (ExcludeDebug))
-            break;
-        printf("Q T   D E B U G: %s\n", TMP_A(msg));
-        break;
+        return "Q T   D E B U G: ";
     case QtWarningMsg:
-        if (uniqAppLib ()->isQtMsgFilterSet (ExcludeWarning))
-            break;
-        printf("Q T   W A R N I N G: %s\n", TMP_A(msg));
-        break;
+        return "Q T   W A R N I N G: ";
     case QtCriticalMsg:
-        if (uniqAppLib ()->isQtMsgFilterSet (ExcludeError))
-            break;
-        printf("Q T   E R R O R: %s\n", TMP_A(msg));
-        break;
+        return "Q T   E R R O R: ";
     case QtFatalMsg:
-        if (uniqAppLib ()->isQtMsgFilterSet (ExcludeFatal))
-            break;
-        printf("Q T   F A T A L ERROR: %s\n", TMP_A(msg));
-        exit(-1);
+        return "Q T   F A T A L ERROR: ";
     default:
-        printf("Q T: %s\n", TMP_A(msg));
+        return "Q T: ";
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static void writeQtMessage (
+        QtMsgType type, const QMessageLogContext & context,
+        const QString & msg)
+{
+    AppLibBinLog * binlog = msg_binlog_.load (std::memory_order_acquire);
+    if ((binlog != NULL) && msg_binary_.load (std::memory_order_relaxed)) {
+        binlog->append (type, context, msg);
+        return;
+    }
+
+    const char * prefix = qtMsgPrefix (type);
+    AppLibMsgSink * sink = msg_sink_.load (std::memory_order_acquire);
+    if ((sink != NULL) && msg_async_.load (std::memory_order_relaxed)) {
+        sink->post (prefix, msg);
+    } else {
+        printf("%s%s\n", prefix, TMP_A(msg));
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static void writeQtSummaries (const QList<AppLibMsgThrottle::Summary> & list)
+{
+    QMessageLogContext context;
+    for (int i = 0; i < list.count (); ++i) {
+        writeQtMessage (list.at (i).type, context, list.at (i).text);
     }
 }
 /* ========================================================================= */
 
+/* ------------------------------------------------------------------------- */
+/**
+ *
+ * Use it in your initialization code:
+ * @code
+ * qInstallMessageHandler (AppLib::echoQtMessages);
+ * @endcode
+ *
+ * By default the message is written to standard output from the thread
+ * that generated it. After a call to setAsyncQtMessages() the handler only
+ * copies the message in a ring buffer and a background thread does the
+ * formatting and the writing.
+ *
+ * setQtMsgThrottle() puts a limit on how often the same message
+ * is written; the copies that are dropped are reported in summaries.
+ *
+ * setBinaryQtLog() replaces the text output with binary records,
+ * context included, in a memory-mapped file.
+ */
+void AppLib::echoQtMessages (
+        QtMsgType type, const QMessageLogContext & context,
+        const QString &msg)
+{
+    if (!qtMsgFilter ().accepts (context.category, type))
+        return;
+    APPLIB_TRACE_FUNCTION("APPLIB");
+    // the default instance is covered by qtMsgFilter (); a scoped one
+    // is kept alive by the AppLibScope of this thread
+    AppLib * scoped = tls_current_lib_;
+    if ((scoped != NULL) && ((scoped->msg_mask_.load (
+                                  std::memory_order_relaxed) &
+                              AppLibMsgFilter::typeBit (type)) != 0))
+        return;
+    if ((type >= 0) && (type < 5))
+        qtMsgCounters ()[type].add ();
+
+    AppLibFlightRecorder * recorder =
+            flight_recorder_.load (std::memory_order_acquire);
+    if (recorder != NULL)
+        recorder->message (type, msg);
+
+    AppLibMsgThrottle * throttle = msg_throttle_.load (std::memory_order_acquire);
+    if ((throttle != NULL) && (type != QtFatalMsg) &&
+            msg_throttled_.load (std::memory_order_relaxed)) {
+        QList<AppLibMsgThrottle::Summary> summaries;
+        bool b_admit = throttle->admit (type, context, msg, summaries);
+        writeQtSummaries (summaries);
+        if (!b_admit)
+            return;
+    }
+
+    writeQtMessage (type, context, msg);
+    if (type == QtFatalMsg) {
+        flushQtMessages ();
+        exit(-1);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Other threads and later static destructors may still hold the sink,
+ * so it is never destroyed; the pending messages are written and later
+ * ones go straight to the output.
+ */
+static void flushQtMessageSink ()
+{
+    AppLibMsgSink * sink = msg_sink_.load (std::memory_order_acquire);
+    msg_async_.store (false, std::memory_order_release);
+    if (sink != NULL)
+        sink->flush ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The sink is created on first use and is kept until the process exits,
+ * so the capacity is only used by the first call that enables it.
+ * Disabling the mode writes pending messages and returns to the
+ * synchronous output.
+ *
+ * @param b_async enable or disable the background writer
+ * @param capacity number of messages that can be waiting in the buffer
+ * @param policy what to do with new messages when the buffer is full
+ */
+void AppLib::setAsyncQtMessages (
+        bool b_async, int capacity, AppLibMsgSink::OverflowPolicy policy)
+{
+    static std::mutex config_mutex;
+    std::lock_guard<std::mutex> lock (config_mutex);
+
+    AppLibMsgSink * sink = msg_sink_.load (std::memory_order_acquire);
+    if (b_async) {
+        if (sink == NULL) {
+            fflush (stdout);
+            sink = new AppLibMsgSink (capacity, policy, stdout);
+            msg_sink_.store (sink, std::memory_order_release);
+            atexit (flushQtMessageSink);
+        } else {
+            sink->setOverflowPolicy (policy);
+        }
+        msg_async_.store (true, std::memory_order_release);
+    } else if (sink != NULL) {
+        msg_async_.store (false, std::memory_order_release);
+        sink->flush ();
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The flags apply to all the categories that have no rule of their own
+ * (see setQtCategoryFilter()) and are kept until the library is
+ * destroyed.
+ */
+void AppLib::setQtMsgFilter (int flag)
+{
+    fqmsg_ = (FilterQtMsg)(fqmsg_ | flag);
+    msg_mask_.store (typeMaskFromFlags (fqmsg_), std::memory_order_relaxed);
+    if (scoped_)
+        return;
+    qtMsgFilter ().setDefaultMask (typeMaskFromFlags (fqmsg_));
+    if (category_filter_installed_)
+        refreshCategoryFilter ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The rule replaces the flags set with setQtMsgFilter() for this
+ * category. The rules are applied to the QLoggingCategory objects, so
+ * qCDebug() and friends skip the rejected messages before formatting
+ * them, and again in echoQtMessages().
+ *
+ * @param category the name of the logging category
+ * @param flags the FilterQtMsg flags for the category
+ */
+void AppLib::setQtCategoryFilter (const QString & category, int flags)
+{
+    qtMsgFilter ().setRule (category.toUtf8 (), typeMaskFromFlags (flags));
+    refreshCategoryFilter ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLib::removeQtCategoryFilter (const QString & category)
+{
+    if (!qtMsgFilter ().removeRule (category.toUtf8 ()))
+        return false;
+    refreshCategoryFilter ();
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLib::isAsyncQtMessages ()
+{
+    return msg_async_.load (std::memory_order_relaxed);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLib::flushQtMessages ()
+{
+    AppLibMsgThrottle * throttle = msg_throttle_.load (std::memory_order_acquire);
+    if (throttle != NULL) {
+        QList<AppLibMsgThrottle::Summary> summaries;
+        throttle->collect (summaries);
+        writeQtSummaries (summaries);
+    }
+    AppLibMsgSink * sink = msg_sink_.load (std::memory_order_acquire);
+    if (sink != NULL)
+        sink->flush ();
+    AppLibBinLog * binlog = msg_binlog_.load (std::memory_order_acquire);
+    if (binlog != NULL)
+        binlog->sync ();
+    AppLibFlightRecorder * recorder =
+            flight_recorder_.load (std::memory_order_acquire);
+    if (recorder != NULL)
+        recorder->sync ();
+    fflush (stdout);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Other threads and later static destructors may still be recording,
+ * so the mapping is never released; the OS unmaps it with the process.
+ */
+static void syncFlightRecorder ()
+{
+    AppLibFlightRecorder * recorder =
+            flight_recorder_.load (std::memory_order_acquire);
+    if (recorder != NULL)
+        recorder->sync ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The recorder keeps the last @a records Qt messages, state transitions
+ * and breadcrumbs (see addBreadcrumb()) in a memory-mapped file, so they
+ * can be read after a crash with applib-logdump. The file is synced on
+ * fatal Qt messages and when the process receives a fatal signal.
+ *
+ * The recorder is started by the constructor when the APPLIB_FLIGHT_RECORDER
+ * environment variable holds the path of the file. Only the first call
+ * has any effect; the recorder is kept until the process exits (it is
+ * only synced at exit, never closed).
+ *
+ * @param file the path of the file; it is truncated
+ * @param records the number of records to keep
+ * @return true if the recorder is running
+ */
+bool AppLib::startFlightRecorder (const QString & file, int records)
+{
+    static std::mutex config_mutex;
+    std::lock_guard<std::mutex> lock (config_mutex);
+
+    if (flight_recorder_.load (std::memory_order_acquire) != NULL)
+        return true;
+    AppLibFlightRecorder * recorder = new AppLibFlightRecorder ();
+    if (!recorder->open (file, records)) {
+        delete recorder;
+        return false;
+    }
+    recorder->installCrashHandlers ();
+    flight_recorder_.store (recorder, std::memory_order_release);
+    atexit (syncFlightRecorder);
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Breadcrumbs are short notes about what the application was doing;
+ * they are only stored by the flight recorder (see startFlightRecorder()).
+ * Long texts are truncated.
+ */
+void AppLib::addBreadcrumb (const QString & text)
+{
+    AppLibFlightRecorder * recorder =
+            flight_recorder_.load (std::memory_order_acquire);
+    if (recorder != NULL)
+        recorder->breadcrumb (text);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Other threads may still be appending, so the log is never closed
+ * here; the header holds the end of the records and the mapping is
+ * only synced. The OS unmaps it with the process.
+ */
+static void syncQtMessageBinLog ()
+{
+    AppLibBinLog * binlog = msg_binlog_.load (std::memory_order_acquire);
+    if (binlog != NULL)
+        binlog->sync ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The messages are stored as binary records with their context
+ * (time, thread, category, file, line and function) in a memory-mapped
+ * file; applib-logdump converts the file to text or JSON.
+ *
+ * The log object is kept until the process exits and is only synced
+ * at exit. Switching to a new file closes the old one; an empty path
+ * returns to the text output and closes the file.
+ *
+ * @param file the path of the log; it is truncated
+ * @return false if the file could not be created
+ */
+bool AppLib::setBinaryQtLog (const QString & file)
+{
+    static std::mutex config_mutex;
+    std::lock_guard<std::mutex> lock (config_mutex);
+
+    AppLibBinLog * binlog = msg_binlog_.load (std::memory_order_acquire);
+    msg_binary_.store (false, std::memory_order_release);
+    if (file.isEmpty ()) {
+        if (binlog != NULL)
+            binlog->close ();
+        return true;
+    }
+
+    if (binlog == NULL) {
+        binlog = new AppLibBinLog ();
+        msg_binlog_.store (binlog, std::memory_order_release);
+        atexit (syncQtMessageBinLog);
+    }
+    if (!binlog->open (file))
+        return false;
+    msg_binary_.store (true, std::memory_order_release);
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * admit() may still run on other threads, so the throttle is never
+ * destroyed; only the pending summaries are written.
+ */
+static void flushQtMessageThrottle ()
+{
+    AppLibMsgThrottle * throttle = msg_throttle_.load (std::memory_order_acquire);
+    if (throttle != NULL) {
+        QList<AppLibMsgThrottle::Summary> summaries;
+        throttle->collect (summaries);
+        writeQtSummaries (summaries);
+        fflush (stdout);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Identical messages (same type, text and source location) are written
+ * at most @a burst times in a row and then at most @a per_second times
+ * each second. The copies that are dropped are counted and a summary
+ * is written every @a summary_ms milliseconds, when the message is no
+ * longer tracked and by flushQtMessages(). Fatal messages are never
+ * suppressed.
+ *
+ * @param b_throttle enable or disable the suppression
+ * @param burst identical messages that may be written back to back
+ * @param per_second identical messages written each second after the burst
+ * @param summary_ms how often the summaries are written
+ */
+void AppLib::setQtMsgThrottle (
+        bool b_throttle, int burst, int per_second, int summary_ms)
+{
+    static std::mutex config_mutex;
+    std::lock_guard<std::mutex> lock (config_mutex);
+
+    if (b_throttle) {
+        AppLibMsgThrottle * throttle =
+                msg_throttle_.load (std::memory_order_acquire);
+        if (throttle == NULL) {
+            throttle = new AppLibMsgThrottle (burst, per_second, summary_ms);
+            msg_throttle_.store (throttle, std::memory_order_release);
+            atexit (flushQtMessageThrottle);
+        } else {
+            throttle->configure (burst, per_second, summary_ms);
+        }
+        msg_throttled_.store (true, std::memory_order_release);
+    } else {
+        msg_throttled_.store (false, std::memory_order_release);
+    }
+}
+/* ========================================================================= */
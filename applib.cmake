@@ -19,13 +19,47 @@ macro    (applibInit
     # compose the list of headers and sources
     set(APPLIB_HEADERS
         "applib-util.h"
+        "applib-log.h"
+        "applib-clock.h"
+        "applib-trace.h"
+        "applib-msgsink.h"
+        "applib-msgthrottle.h"
+        "applib-binlog.h"
+        "applib-msgfilter.h"
+        "applib-flightrec.h"
+        "applib-warmcache.h"
+        "applib-profiler.h"
+        "applib-metrics.h"
+        "applib-sampler.h"
+        "applib-services.h"
+        "applib-executor.h"
+        "applib-coro.h"
+        "applib-initgraph.h"
+        "applib-langindex.h"
+        "applib-observers.h"
         "applib.h")
     set(APPLIB_SOURCES
+        "applib-log.cc"
+        "applib-clock.cc"
+        "applib-trace.cc"
+        "applib-msgsink.cc"
+        "applib-msgthrottle.cc"
+        "applib-binlog.cc"
+        "applib-msgfilter.cc"
+        "applib-flightrec.cc"
+        "applib-warmcache.cc"
+        "applib-profiler.cc"
+        "applib-metrics.cc"
+        "applib-sampler.cc"
+        "applib-services.cc"
+        "applib-executor.cc"
+        "applib-initgraph.cc"
+        "applib-langindex.cc"
+        "applib-observers.cc"
         "applib.cc")
+    # widgets live in the AppLibGui pile (applibgui.cmake)
     set(APPLIB_QT_MODS
-        "Core"
-        "Widgets"
-        "Gui")
+        "Core")
 
     pileSetSources(
         "${APPLIB_INIT_NAME}"
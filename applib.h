@@ -11,8 +11,26 @@
 #define GUARD_APPLIB_H_INCLUDE
 
 #include <applib/applib-config.h>
+#include <applib/applib-clock.h>
+#include <applib/applib-msgsink.h>
+#include <applib/applib-msgthrottle.h>
+#include <applib/applib-warmcache.h>
+#include <applib/applib-profiler.h>
+#include <applib/applib-metrics.h>
+#include <applib/applib-sampler.h>
+#include <applib/applib-services.h>
+#include <applib/applib-initgraph.h>
+#include <applib/applib-observers.h>
 #include <QObject>
-#include <QDateTime>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+class QTranslator;
+class AppLibLangIndex;
 
 //! Base class for application's main library.
 class APPLIB_EXPORT AppLib : public QObject {
@@ -49,10 +67,17 @@ public:
 
     };
 
+    //! How an instance relates to the static API.
+    enum InstanceMode {
+        DefaultInstance, /**< the one used by the static API */
+        ScopedInstance /**< used through AppLibScope or directly */
+    };
+
 protected:
 
-    //! Default constructor.
-    AppLib ();
+    //! Constructor; only one DefaultInstance may exist at a time.
+    explicit AppLib (
+            InstanceMode mode = DefaultInstance);
 
     //! Destructor.
     virtual ~AppLib();
@@ -72,6 +97,49 @@ public:
     static void
     end ();
 
+    //! End this instance (end() ends the current one).
+    void
+    finish ();
+
+    //! The instance of this thread's AppLibScope or the default one.
+    static AppLib *
+    current ();
+
+    //! All the instances that exist.
+    static QList<AppLib *>
+    instances ();
+
+    //! Is this an instance created in ScopedInstance mode?
+    bool
+    isScoped () const {
+        return scoped_;
+    }
+
+    //! A function that must run when the library ends, even on fast exit.
+    typedef std::function<void ()> ShutdownHook;
+
+    //! Register a flush-critical function to be run by end().
+    static int
+    addShutdownHook (
+            const QString & name,
+            ShutdownHook hook);
+
+    //! Remove a function registered with addShutdownHook().
+    static bool
+    removeShutdownHook (
+            int id);
+
+    //! Make end() run only the shutdown hooks, then quick_exit().
+    static void
+    setFastExit (
+            bool b_fast,
+            int deadline_ms = 2000,
+            int exit_code = 0);
+
+    //! The hooks that did not finish in time during the last end().
+    static QStringList
+    overrunShutdownHooks ();
+
     //! GUI or console mode
     ///
     static  bool
@@ -87,26 +155,99 @@ public:
     static bool
     startGui ();
 
-    //! The main gui.
-    static QWidget *
+    //! The object behind the user interface (see AppLibGui::mainWidget()).
+    static QObject *
     mainGui () {
-        return singleton_->mw_;
+        AppLib * lib = current ();
+        return lib == NULL ? NULL : lib->mw_;
     }
 
-    //! The unique instance of the class.
+    //! The current instance (see current()); asserts there is one.
     static AppLib *
     uniqAppLib ();
 
-    //! Has the unique instance been created yet?
+    //! Has the default instance been created yet?
     static bool
     hasUniqAppLib () {
         return singleton_ != NULL;
     }
 
+    //! The profiler that records the phases of the library (NULL if none).
+    static AppLibProfiler *
+    profiler () {
+        AppLib * lib = current ();
+        return lib == NULL ? NULL : &lib->profiler_;
+    }
+
+    //! The metrics of the library (NULL if none).
+    static AppLibMetrics *
+    metrics () {
+        AppLib * lib = current ();
+        return lib == NULL ? NULL : &lib->metrics_;
+    }
+
+    //! Sample the resources of the process while running.
+    static bool
+    startResourceSampler (
+            int interval_ms = 1000);
+
+    //! The sampler started by startResourceSampler() or NULL.
+    static AppLibSampler *
+    resourceSampler () {
+        AppLib * lib = current ();
+        return lib == NULL ? NULL :
+                             lib->sampler_.load (std::memory_order_acquire);
+    }
+
     //! The type of build (debug, release).
     static BuildType
     buildType ();
 
+    //! The state of the library; may be called from any thread.
+    State
+    state () const {
+        return static_cast<State>(state_.load (std::memory_order_acquire));
+    }
+
+    //! Direct-call observers of the lifecycle (alongside the signals).
+    AppLibObservers &
+    observers () {
+        return observers_;
+    }
+
+    //! The services of the library, created on first use.
+    AppLibServices &
+    services () {
+        return services_;
+    }
+
+    //! Does being in current satisfy a wait for value (see waitForState())?
+    static bool
+    isStateReached (
+            State current,
+            State value) {
+        return (current == value) ||
+                ((value == RunningState) && (current == RunningGuiState));
+    }
+
+    //! Block until the library reaches a state (or it can't anymore).
+    bool
+    waitForState (
+            State value,
+            int timeout_ms = -1) const;
+
+    //! Someone waiting for a state without blocking (see addStateWaiter()).
+    struct StateWaiter {
+        State state; /**< the state to wait for */
+        void (*wake) (StateWaiter * waiter, bool b_reached); /**< called once */
+        StateWaiter * next; /**< used by the library while registered */
+    };
+
+    //! Call the waiter when the state is reached (or it can't be anymore).
+    bool
+    addStateWaiter (
+            StateWaiter * waiter);
+
     //! Handler function for Qt messages.
     static void
     echoQtMessages (
@@ -114,6 +255,46 @@ public:
             const QMessageLogContext & context,
             const QString &msg);
 
+    //! Route echoQtMessages() output through a background writer thread.
+    static void
+    setAsyncQtMessages (
+            bool b_async,
+            int capacity = 1024,
+            AppLibMsgSink::OverflowPolicy policy =
+                AppLibMsgSink::CountOnOverflow);
+
+    //! Are the messages from Qt written by a background thread?
+    static bool
+    isAsyncQtMessages ();
+
+    //! Write all pending messages from Qt before returning.
+    static void
+    flushQtMessages ();
+
+    //! Write the messages from Qt as binary records to a file.
+    static bool
+    setBinaryQtLog (
+            const QString & file);
+
+    //! Keep the recent history of the process in a crash-proof file.
+    static bool
+    startFlightRecorder (
+            const QString & file,
+            int records = 4096);
+
+    //! Leave a note in the flight recorder.
+    static void
+    addBreadcrumb (
+            const QString & text);
+
+    //! Limit how often the same message from Qt is written.
+    static void
+    setQtMsgThrottle (
+            bool b_throttle,
+            int burst = 10,
+            int per_second = 2,
+            int summary_ms = 5000);
+
     //! Tell if a flag or combination of flags are set.
     bool
     isQtMsgFilterSet (
@@ -124,8 +305,42 @@ public:
     //! Set a flag.
     void
     setQtMsgFilter (
-            int flag) {
-        fqmsg_ = (FilterQtMsg)(fqmsg_ | flag);
+            int flag);
+
+    //! Filter the messages of a logging category.
+    static void
+    setQtCategoryFilter (
+            const QString & category,
+            int flags);
+
+    //! Remove the filter of a logging category.
+    static bool
+    removeQtCategoryFilter (
+            const QString & category);
+
+    //! Add a task to be run before the library leaves InitializingState.
+    bool
+    addInitTask (
+            const QString & name,
+            const QStringList & depends_on,
+            AppLibInitGraph::Affinity affinity,
+            AppLibInitGraph::Function fn);
+
+    //! Status and timing of the init tasks.
+    QList<AppLibInitGraph::TaskInfo>
+    initTasks () const {
+        return init_graph_.tasks ();
+    }
+
+    //! The pool shared by the library and its plug-ins (created on first use).
+    AppLibExecutor *
+    executor ();
+
+    //! How long finish() waits for the pool before dropping its tasks.
+    void
+    setExecutorDrainDeadline (
+            int deadline_ms) {
+        executor_drain_ms_.store (deadline_ms);
     }
 
 protected:
@@ -140,8 +355,8 @@ protected:
     virtual void
     _end () {}
 
-    //! Subclass implements this to start the GUI.
-    virtual QWidget *
+    //! Subclass implements this to start the GUI (AppLibGui does).
+    virtual QObject *
     _startGui () {
         return NULL; }
 
@@ -159,6 +374,11 @@ protected:
     appUnixName () = 0;
 
 
+    //! Publish a new state and wake the threads waiting for it.
+    void
+    setState (
+            State value);
+
     //! Checks the transition, changes the state and generates proper signals.
     bool
     changeState (
@@ -170,6 +390,120 @@ protected:
             QString & locale,
             const char * env_var_path=NULL);
 
+    //! Initializes the translation system in the background.
+    bool
+    startTranslationAsync (
+            const QString & locale,
+            const char * env_var_path=NULL);
+
+    //! Resolve languages through an on-disk index of the translations.
+    bool
+    setTranslationIndex (
+            const QString & index_file,
+            const QStringList & roots);
+
+    //! Keep the initialization artifacts in a warm start cache file.
+    bool
+    setWarmCache (
+            const QString & file,
+            const QByteArray & key = QByteArray ());
+
+    //! An initialization artifact, from the warm start cache if possible.
+    QByteArray
+    warmArtifact (
+            const QString & name,
+            quint64 fingerprint,
+            AppLibWarmCache::Serializer serializer);
+
+    //! Enter RunningGuiState and create the GUI; false if there's none.
+    bool
+    beginGui ();
+
+    //! The GUI is visible; informs the observers and emits guiStarted().
+    void
+    guiPresented ();
+
+    //! The warm start cache or NULL.
+    AppLibWarmCache *
+    warmCache () const {
+        return warm_cache_;
+    }
+
+private:
+
+    //! Create the metrics the library updates itself.
+    void
+    setupMetrics ();
+
+    //! Start or restart the sampler of this instance.
+    bool
+    startSampler (
+            int interval_ms);
+
+    //! Stop the pool from accepting work and wait for it, under a deadline.
+    void
+    drainExecutor ();
+
+    //! The state of a translation being loaded.
+    struct TranslationJob {
+        QString locale; /**< the name of the locale */
+        int lang; /**< index in Translate */
+        QTranslator * qt_translator; /**< translator for Qt strings */
+        QTranslator * translator; /**< translator for our strings */
+        bool ok; /**< was the search successful */
+        const AppLibLangIndex * index; /**< the index to use or NULL */
+        bool owned; /**< the translators were created by us */
+
+        TranslationJob () :
+            lang (-1), qt_translator (NULL), translator (NULL), ok (false),
+            index (NULL), owned (false)
+        {}
+    };
+
+    //! Find the language and load its translators (any thread).
+    static bool
+    loadTranslation (
+            TranslationJob & job,
+            const char * env_var_path,
+            AppLibProfiler * profiler);
+
+    //! A registered shutdown hook.
+    struct ShutdownHookEntry {
+        int id; /**< identifier returned by addShutdownHook() */
+        QString name; /**< used in reports */
+        ShutdownHook hook; /**< the function */
+    };
+
+    //! Run the shutdown hooks in parallel; returns the ones that overran.
+    static QStringList
+    runShutdownHooks (
+            int deadline_ms);
+
+    //! Find the language in the index and load its translators.
+    static bool
+    loadIndexedTranslation (
+            TranslationJob & job,
+            AppLibProfiler * profiler);
+
+    //! Install the translators (main thread).
+    bool
+    installTranslation (
+            TranslationJob & job);
+
+private slots:
+
+    //! Install the translators loaded by startTranslationAsync().
+    void
+    translationLoaded ();
+
+    //! The main GUI is ending.
+    void
+    mainGuiEnding ();
+
+    //! The main GUI has ended.
+    void
+    mainGuiEnded ();
+
 signals:
 
     //! library is starting
@@ -204,14 +538,74 @@ signals:
     void
     guiEnded ();
 
+    //! the translation started by startTranslationAsync() is done
+    void
+    translationReady (
+            bool b_ok,
+            const QString & locale);
+
 private:
-    QDateTime app_start_moment_; /**< when was the application started ?*/
+    qint64 app_start_ns_; /**< when was the application started (monotonic) */
     bool gui_mode_; /**< is this a GUI application or not */
-    QWidget * mw_; /**< main GUI object */
-    State state_; /**< the state of the application */
+    QObject * mw_; /**< main GUI object */
+    std::atomic<int> state_; /**< the state of the application */
+    mutable std::mutex state_mutex_; /**< used by waitForState() */
+    mutable std::condition_variable state_cv_; /**< wakes waitForState() */
+    StateWaiter * state_waiters_; /**< guarded by state_mutex_ */
     FilterQtMsg fqmsg_; /**< how to filter the messages from Qt */
+    std::atomic<int> msg_mask_; /**< types rejected by fqmsg_ */
+    bool scoped_; /**< created in ScopedInstance mode */
+    bool finishing_; /**< finish() is running or ran */
+    AppLibProfiler profiler_; /**< start-up and shut-down phases */
+    int init_span_; /**< the span covering InitializingState */
+    int term_span_; /**< the span covering TerminatingState */
+    AppLibInitGraph init_graph_; /**< tasks run while initializing */
+    std::atomic<AppLibExecutor *> executor_; /**< shared pool or NULL */
+    std::mutex executor_mutex_; /**< guards the creation of executor_ */
+    std::atomic<int> executor_drain_ms_; /**< drain deadline; -1 waits */
+    std::mutex translation_mutex_; /**< guards the async translation */
+    bool translation_busy_; /**< startTranslationAsync() in progress */
+    TranslationJob translation_job_; /**< result of the async translation */
+    AppLibLangIndex * lang_index_; /**< index of the translations or NULL */
+    AppLibWarmCache * warm_cache_; /**< initialization artifacts or NULL */
+    AppLibObservers observers_; /**< direct-call lifecycle observers */
+    AppLibMetrics metrics_; /**< counters, gauges and histograms */
+    AppLibMetrics::Gauge * state_metrics_[6]; /**< seconds in each state */
+    AppLibMetrics::Counter * transition_metric_; /**< state changes */
+    AppLibMetrics::Histogram * gui_start_metric_; /**< startGui() latency */
+    std::atomic<qint64> state_since_ns_; /**< when the state was entered */
+    std::atomic<AppLibSampler *> sampler_; /**< resources or NULL */
+    std::mutex sampler_mutex_; /**< serializes startSampler() */
+    AppLibServices services_; /**< lazily created services */
 
     static AppLib * singleton_;
+
+    static std::mutex hooks_mutex_; /**< protects the hooks */
+    static std::vector<ShutdownHookEntry> hooks_; /**< shutdown hooks */
+    static int next_hook_id_; /**< source of hook identifiers */
+    static QStringList overrun_hooks_; /**< overran during last end() */
+    static std::atomic<bool> fast_exit_; /**< is fast exit enabled */
+    static std::atomic<int> fast_exit_deadline_; /**< in milliseconds */
+    static std::atomic<int> fast_exit_code_; /**< exit code on fast exit */
+};
+
+//! Makes an instance the current one for the calling thread.
+class APPLIB_EXPORT AppLibScope {
+
+public:
+
+    //! Constructor; the instance is current until the scope ends.
+    explicit AppLibScope (
+            AppLib * lib);
+
+    //! Destructor; restores the previous instance.
+    ~AppLibScope ();
+
+private:
+    AppLibScope (const AppLibScope &);
+    AppLibScope& operator=( const AppLibScope& );
+
+    AppLib * previous_; /**< current before this scope */
 };
 
 #endif // GUARD_APPLIB_H_INCLUDE
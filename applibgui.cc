@@ -0,0 +1,254 @@
+/**
+ * @file applibgui.cc
+ * @brief Definitions for AppLibGui class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include "applibgui.h"
+#include "applib-executor.h"
+#include "applib-private.h"
+
+#include <QApplication>
+#include <QWidget>
+#include <QEvent>
+
+/**
+ * @class AppLibGui
+ *
+ * AppLib itself depends only on QtCore, so console applications and
+ * servers do not load the GUI libraries. Applications with widgets
+ * derive from this class instead (and link the AppLibGui pile): it
+ * makes sure a QApplication exists before RunningGuiState creates
+ * the main window, shows the window and exposes it as a QWidget.
+ *
+ * The main window is expected to have guiEnding() and guiEnded()
+ * signals, which AppLib forwards as its own.
+ *
+ * startGuiAsync() lowers the time until the user sees something:
+ * the splash from _createSplash() is shown at once, the Prepare part
+ * of each piece registered with addGuiPrewarm() runs on the worker
+ * threads of the library and its Build part runs on the main thread
+ * as soon as that preparation ends. When all are built the main
+ * window is created and shown; guiStarted() is emitted only after it
+ * was painted for the first time, and that delay is reported as
+ * timeToFirstPaint(), in the profiler and in the
+ * applib_gui_first_paint_seconds metric.
+ */
+
+/* ------------------------------------------------------------------------- */
+AppLibGui::AppLibGui () : AppLib (),
+    prewarms_ (),
+    prewarm_mutex_ (),
+    prewarm_ready_ (),
+    prewarm_pending_ (-1),
+    splash_ (NULL),
+    gui_start_ns_ (0),
+    first_paint_ns_ (-1),
+    paint_span_ (-1)
+{
+    APPLIB_TRACE_ENTRY;
+    setGUI (hasGuiApplication ());
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+AppLibGui::~AppLibGui ()
+{
+    APPLIB_TRACE_ENTRY;
+    APPLIB_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+QWidget * AppLibGui::mainWidget ()
+{
+    return qobject_cast<QWidget *>(mainGui ());
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool AppLibGui::hasGuiApplication ()
+{
+    return qobject_cast<QApplication *>(QCoreApplication::instance ()) != NULL;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * A QCoreApplication (console mode) gets no window; the library stays
+ * in RunningGuiState only if the window could be created.
+ */
+QWidget * AppLibGui::_startGui ()
+{
+    if (!hasGuiApplication ()) {
+        APPLIB_DEBUGM("A QApplication is required to start the GUI\n");
+        return NULL;
+    }
+    QWidget * result = _createMainWindow ();
+    if (result != NULL)
+        result->show ();
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Must be called before startGuiAsync(), usually from _init(). The
+ * functions share their data through what they capture; nothing
+ * may be shared with the main thread until Build runs.
+ *
+ * @param name identifies the work in the profiler
+ * @param prepare runs on a worker thread; must not create widgets
+ * @param build runs on the main thread after prepare
+ */
+void AppLibGui::addGuiPrewarm (
+        const QString & name, Prepare prepare, Build build)
+{
+    Q_ASSERT(prewarm_pending_ == -1);
+    Prewarm p;
+    p.name = name;
+    p.prepare = prepare;
+    p.build = build;
+    prewarms_.push_back (p);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Returns at once; the library enters RunningGuiState later, from the
+ * event loop, so the loop must be running (QApplication::exec()).
+ *
+ * @return false if there's no AppLibGui, no QApplication or an
+ *      asynchronous start is already in progress
+ */
+bool AppLibGui::startGuiAsync ()
+{
+    AppLibGui * self = qobject_cast<AppLibGui *>(current ());
+    if ((self == NULL) || !hasGuiApplication () ||
+            (self->prewarm_pending_ != -1))
+        return false;
+
+    self->gui_start_ns_ = AppLibProfiler::nowNs ();
+    self->first_paint_ns_ = -1;
+    self->paint_span_ = profiler ()->begin (QLatin1String ("first paint"));
+    self->splash_ = self->_createSplash ();
+    if (self->splash_ != NULL)
+        self->splash_->show ();
+
+    self->prewarm_pending_ = static_cast<int>(self->prewarms_.size ());
+    if (self->prewarm_pending_ == 0) {
+        QMetaObject::invokeMethod (self, "prewarmDone", Qt::QueuedConnection);
+        return true;
+    }
+    AppLibExecutor * pool = self->executor ();
+    for (size_t i = 0; i < self->prewarms_.size (); ++i) {
+        AppLibExecutor::Task task = [self, i] () {
+            const Prewarm & p = self->prewarms_[i];
+            if (p.prepare) {
+                AppLibPhase phase (profiler (), p.name);
+                p.prepare ();
+            }
+            {
+                std::lock_guard<std::mutex> lock (self->prewarm_mutex_);
+                self->prewarm_ready_.push_back (static_cast<int>(i));
+            }
+            QMetaObject::invokeMethod (
+                        self, "prewarmDone", Qt::QueuedConnection);
+        };
+        if (!pool->submit (task))
+            task ();
+    }
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibGui::prewarmDone ()
+{
+    // the first call may build what later calls were queued for
+    if (prewarm_pending_ < 0)
+        return;
+    std::vector<int> ready;
+    {
+        std::lock_guard<std::mutex> lock (prewarm_mutex_);
+        ready.swap (prewarm_ready_);
+    }
+    for (size_t i = 0; i < ready.size (); ++i) {
+        const Prewarm & p = prewarms_[ready[i]];
+        if (p.build) {
+            AppLibPhase phase (profiler (), p.name);
+            p.build ();
+        }
+    }
+    prewarm_pending_ -= static_cast<int>(ready.size ());
+    if (prewarm_pending_ == 0)
+        finishGui ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibGui::finishGui ()
+{
+    prewarm_pending_ = -1;
+    if (!beginGui ()) {
+        profiler ()->end (paint_span_);
+        if (splash_ != NULL) {
+            splash_->close ();
+            splash_->deleteLater ();
+            splash_ = NULL;
+        }
+        return;
+    }
+    QWidget * window = mainWidget ();
+    if (window == NULL) {
+        // not a widget; nothing to wait for
+        firstPaintDone ();
+    } else {
+        window->installEventFilter (this);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The filter sees the paint event before the window handles it, so the
+ * rest is done from the event loop, after the window was painted.
+ */
+bool AppLibGui::eventFilter (QObject * watched, QEvent * event)
+{
+    if ((event->type () == QEvent::Paint) && (watched == mainGui ())) {
+        watched->removeEventFilter (this);
+        QMetaObject::invokeMethod (this, "firstPaintDone", Qt::QueuedConnection);
+    }
+    return AppLib::eventFilter (watched, event);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void AppLibGui::firstPaintDone ()
+{
+    first_paint_ns_ = AppLibProfiler::nowNs () - gui_start_ns_;
+    profiler ()->end (paint_span_);
+    AppLibMetrics::Histogram * metric = metrics ()->histogram (
+                QLatin1String ("applib_gui_first_paint_seconds"),
+                QLatin1String ("Time from startGuiAsync() to the first "
+                               "paint of the main window."),
+                QString (), 1e-9);
+    if (metric != NULL)
+        metric->record (static_cast<quint64>(first_paint_ns_));
+    APPLIB_DEBUGM("%s painted its main window after %lld ms\n",
+                  TMP_A(appUserName ()),
+                  static_cast<long long>(first_paint_ns_ / 1000000));
+
+    if (splash_ != NULL) {
+        splash_->close ();
+        splash_->deleteLater ();
+        splash_ = NULL;
+    }
+    guiPresented ();
+}
+/* ========================================================================= */
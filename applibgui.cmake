@@ -0,0 +1,44 @@
+
+# enable/disable cmake debug messages related to this pile
+set (APPLIBGUI_DEBUG_MSG OFF)
+
+# make sure support code is present; no harm
+# in including it twice; the user, however, should have used
+# pileInclude() from pile_support.cmake module.
+include(pile_support)
+
+# initialize this module; the widget part of AppLib, so
+# that console applications only need QtCore
+macro    (applibguiInit
+          ref_cnt_use_mode)
+
+    # default name
+    if (NOT APPLIBGUI_INIT_NAME)
+        set(APPLIBGUI_INIT_NAME "AppLibGui")
+    endif ()
+
+    # compose the list of headers and sources
+    set(APPLIBGUI_HEADERS
+        "applibgui.h")
+    set(APPLIBGUI_SOURCES
+        "applibgui.cc")
+    set(APPLIBGUI_QT_MODS
+        "Core"
+        "Widgets"
+        "Gui")
+
+    pileSetSources(
+        "${APPLIBGUI_INIT_NAME}"
+        "${APPLIBGUI_HEADERS}"
+        "${APPLIBGUI_SOURCES}")
+
+    pileSetCommon(
+        "${APPLIBGUI_INIT_NAME}"
+        "0;0;1;d"
+        "ON"
+        "${ref_cnt_use_mode}"
+        "AppLib"
+        "category1"
+        "tag1;tag2")
+
+endmacro ()
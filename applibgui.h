@@ -0,0 +1,126 @@
+/**
+ * @file applibgui.h
+ * @brief Declarations for AppLibGui class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_APPLIBGUI_H_INCLUDE
+#define GUARD_APPLIBGUI_H_INCLUDE
+
+#include <applibgui/applibgui-config.h>
+#include <applib/applib.h>
+#include <QWidget>
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+//! Base class for the main library of applications with a widget GUI.
+class APPLIBGUI_EXPORT AppLibGui : public AppLib {
+    Q_OBJECT
+protected:
+
+    //! Default constructor.
+    AppLibGui ();
+
+    //! Destructor.
+    virtual ~AppLibGui();
+
+public:
+
+    //! The main window (NULL before startGui() or in console mode).
+    static QWidget *
+    mainWidget ();
+
+    //! Is there a QApplication (widgets can be created)?
+    static bool
+    hasGuiApplication ();
+
+    //! Prepare the GUI in the background and show it when ready.
+    static bool
+    startGuiAsync ();
+
+    //! Nanoseconds from startGuiAsync() to the first paint (-1 if none).
+    qint64
+    timeToFirstPaint () const {
+        return first_paint_ns_;
+    }
+
+    //! Work done off the main thread (models, icons, style sheets, strings).
+    typedef std::function<void ()> Prepare;
+
+    //! Work done on the main thread with the prepared data (widgets).
+    typedef std::function<void ()> Build;
+
+protected:
+
+    //! Add a piece of work to be done by startGuiAsync().
+    void
+    addGuiPrewarm (
+            const QString & name,
+            Prepare prepare,
+            Build build = Build ());
+
+    //! Subclass implements this to show something while the GUI is prepared.
+    virtual QWidget *
+    _createSplash () {
+        return NULL;
+    }
+
+    //! Watches the main window for its first paint.
+    virtual bool
+    eventFilter (
+            QObject * watched,
+            QEvent * event);
+
+    //! Creates and shows the main window in RunningGuiState.
+    virtual QWidget *
+    _startGui ();
+
+    //! Subclass implements this to create the main window.
+    virtual QWidget *
+    _createMainWindow () {
+        return NULL;
+    }
+
+private slots:
+
+    //! Build the widgets whose preparation ended (main thread).
+    void
+    prewarmDone ();
+
+    //! The main window was painted once.
+    void
+    firstPaintDone ();
+
+private:
+
+    //! A piece of work done by startGuiAsync().
+    struct Prewarm {
+        QString name; /**< used for profiling */
+        Prepare prepare; /**< off the main thread */
+        Build build; /**< on the main thread */
+    };
+
+    //! All the preparations ended; create and show the main window.
+    void
+    finishGui ();
+
+    AppLibGui (const AppLibGui &);
+    AppLibGui& operator=( const AppLibGui& );
+
+private:
+    std::vector<Prewarm> prewarms_; /**< the work of startGuiAsync() */
+    std::mutex prewarm_mutex_; /**< protects prewarm_ready_ */
+    std::vector<int> prewarm_ready_; /**< prepared, not yet built */
+    int prewarm_pending_; /**< not yet built; -1 when not started */
+    QWidget * splash_; /**< shown while preparing */
+    qint64 gui_start_ns_; /**< when startGuiAsync() was called */
+    qint64 first_paint_ns_; /**< time to the first paint */
+    int paint_span_; /**< profiler span up to the first paint */
+};
+
+#endif // GUARD_APPLIBGUI_H_INCLUDE
@@ -0,0 +1,265 @@
+/**
+ * @file bench_applib.cc
+ * @brief Hot paths of the AppLib class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include <applib/applib.h>
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include <stdio.h>
+#ifdef Q_OS_UNIX
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+//! how many times a single, non-repeatable operation is timed
+#define BENCH_SAMPLES 200
+
+//! languages in the synthetic catalog
+#define BENCH_LANGUAGES 16
+
+//! environment variable that points Translate to the synthetic catalog
+#define BENCH_ENV_VAR "APPLIB_BENCH_TRANSLATIONS"
+
+/* ------------------------------------------------------------------------- */
+class BenchLib : public AppLib {
+public:
+    BenchLib () : AppLib () {}
+
+    using AppLib::changeState;
+    using AppLib::echoQtMessages;
+    using AppLib::startTranslation;
+    using AppLib::setTranslationIndex;
+
+    QString appUserName () {
+        return QLatin1String ("Bench Library");
+    }
+    QString appUnixName () {
+        return QLatin1String ("benchlib");
+    }
+};
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Sends the standard output to the null device while in scope.
+class MuteStdout {
+#ifdef Q_OS_UNIX
+    int saved_;
+public:
+    MuteStdout () {
+        fflush (stdout);
+        saved_ = dup (1);
+        int null_fd = open ("/dev/null", O_WRONLY);
+        dup2 (null_fd, 1);
+        ::close (null_fd);
+    }
+    ~MuteStdout () {
+        fflush (stdout);
+        dup2 (saved_, 1);
+        ::close (saved_);
+    }
+#endif
+};
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+class BenchAppLib : public QObject {
+    Q_OBJECT
+
+    QTemporaryDir catalog_;
+
+    //! Separate from catalog_, so writing the index does not change the root.
+    QTemporaryDir index_dir_;
+
+    //! Create a library and take it to the state.
+    static BenchLib * startLib (AppLib::State target) {
+        BenchLib * lib = new BenchLib ();
+        const AppLib::State path[] = {
+            AppLib::InitializingState,
+            AppLib::RunningState,
+            AppLib::TerminatingState,
+            AppLib::TerminatedState
+        };
+        for (unsigned i = 0; i < sizeof(path) / sizeof(path[0]); ++i) {
+            if (lib->state () == target)
+                break;
+            lib->changeState (path[i]);
+        }
+        return lib;
+    }
+
+    //! End the library, whatever its state.
+    static void endLib (BenchLib * lib) {
+        if (lib->state () == AppLib::TerminatedState) {
+            // taken there by hand; end() has nothing left to do
+            delete lib;
+        } else {
+            AppLib::end ();
+            QCoreApplication::sendPostedEvents (NULL, QEvent::DeferredDelete);
+        }
+    }
+
+    //! Report the average of the samples as the result of the benchmark.
+    static void report (qint64 total_ns) {
+        QTest::setBenchmarkResult (
+                    static_cast<qreal>(total_ns) / BENCH_SAMPLES,
+                    QTest::WalltimeNanoseconds);
+    }
+
+private slots:
+
+    /**
+     * Each language of the catalog gets its own directory with a
+     * translation that only has the header of a .qm file.
+     */
+    void initTestCase () {
+        QVERIFY(catalog_.isValid ());
+        static const uchar qm_magic[] = {
+            0x3C, 0xB8, 0x64, 0x18, 0xCA, 0xEF, 0x9C, 0x95,
+            0xCD, 0x21, 0x1C, 0xBF, 0x60, 0xA1, 0xBD, 0xDD
+        };
+        QDir root (catalog_.path ());
+        for (int i = 0; i < BENCH_LANGUAGES; ++i) {
+            QString name = QString (QLatin1String ("l%1_L%1")).arg (i);
+            QVERIFY(root.mkpath (name));
+            QDir lang_dir (root.absoluteFilePath (name));
+
+            QFile qm (lang_dir.absoluteFilePath (name + QLatin1String (".qm")));
+            QVERIFY(qm.open (QIODevice::WriteOnly));
+            qm.write (reinterpret_cast<const char*>(qm_magic), sizeof(qm_magic));
+            qm.close ();
+
+            QFile ini (lang_dir.absoluteFilePath (QLatin1String ("metadata.ini")));
+            QVERIFY(ini.open (QIODevice::WriteOnly));
+            ini.write ("[General]\nname=" + name.toLatin1 () + "\n");
+            ini.close ();
+        }
+        qputenv (BENCH_ENV_VAR, QFile::encodeName (catalog_.path ()));
+    }
+
+    void echoQtMessages_data () {
+        QTest::addColumn<int>("type");
+        QTest::addColumn<bool>("filtered");
+        QTest::newRow ("debug") << int(QtDebugMsg) << false;
+        QTest::newRow ("debug-filtered") << int(QtDebugMsg) << true;
+        QTest::newRow ("warning") << int(QtWarningMsg) << false;
+        QTest::newRow ("warning-filtered") << int(QtWarningMsg) << true;
+        QTest::newRow ("critical") << int(QtCriticalMsg) << false;
+        QTest::newRow ("critical-filtered") << int(QtCriticalMsg) << true;
+    }
+
+    void echoQtMessages () {
+        QFETCH(int, type);
+        QFETCH(bool, filtered);
+        BenchLib * lib = startLib (AppLib::RunningState);
+        if (filtered)
+            lib->setQtMsgFilter (AppLib::ExcludeAll);
+
+        QMessageLogContext context ("bench_applib.cc", 1, "echoQtMessages", "bench");
+        QString msg (QLatin1String ("a message of ordinary length from Qt"));
+        {
+            MuteStdout mute;
+            QBENCHMARK {
+                BenchLib::echoQtMessages (
+                            static_cast<QtMsgType>(type), context, msg);
+            }
+        }
+        endLib (lib);
+    }
+
+    void changeState_data () {
+        QTest::addColumn<int>("from");
+        QTest::addColumn<int>("to");
+        QTest::newRow ("initial-initializing")
+                << int(AppLib::InitialState) << int(AppLib::InitializingState);
+        QTest::newRow ("initializing-running")
+                << int(AppLib::InitializingState) << int(AppLib::RunningState);
+        QTest::newRow ("running-terminating")
+                << int(AppLib::RunningState) << int(AppLib::TerminatingState);
+        QTest::newRow ("terminating-terminated")
+                << int(AppLib::TerminatingState) << int(AppLib::TerminatedState);
+    }
+
+    /**
+     * A transition can only be made once by a library, so the
+     * libraries are prepared outside of the measured interval.
+     * The state is checked rather than the result because
+     * changeState() reports false for Initial to Initializing.
+     */
+    void changeState () {
+        QFETCH(int, from);
+        QFETCH(int, to);
+        qint64 total = 0;
+        for (int i = 0; i < BENCH_SAMPLES; ++i) {
+            BenchLib * lib = startLib (static_cast<AppLib::State>(from));
+            qint64 start = AppLibProfiler::nowNs ();
+            lib->changeState (static_cast<AppLib::State>(to));
+            total += AppLibProfiler::nowNs () - start;
+            bool b_ok = (lib->state () == static_cast<AppLib::State>(to));
+            endLib (lib);
+            QVERIFY(b_ok);
+        }
+        report (total);
+    }
+
+    void changeStateCycle () {
+        QBENCHMARK {
+            BenchLib * lib = new BenchLib ();
+            lib->changeState (AppLib::InitializingState);
+            lib->changeState (AppLib::RunningState);
+            lib->changeState (AppLib::TerminatingState);
+            lib->changeState (AppLib::TerminatedState);
+            endLib (lib);
+        }
+    }
+
+    void startTranslation_data () {
+        QTest::addColumn<bool>("indexed");
+        QTest::newRow ("translate") << false;
+        QTest::newRow ("indexed") << true;
+    }
+
+    /**
+     * The translators are owned by the library, so a new library is
+     * used for each sample to keep the application from accumulating them.
+     */
+    void startTranslation () {
+        QFETCH(bool, indexed);
+        QVERIFY(index_dir_.isValid ());
+        QString index_file = QDir (index_dir_.path ()).absoluteFilePath (
+                    QLatin1String ("bench.langindex"));
+        qint64 total = 0;
+        for (int i = 0; i < BENCH_SAMPLES; ++i) {
+            BenchLib * lib = startLib (AppLib::RunningState);
+            if (indexed) {
+                QVERIFY(lib->setTranslationIndex (
+                            index_file, QStringList (catalog_.path ())));
+            }
+            QString locale (QLatin1String ("l7_L7"));
+            qint64 start = AppLibProfiler::nowNs ();
+            lib->startTranslation (locale, BENCH_ENV_VAR);
+            total += AppLibProfiler::nowNs () - start;
+            endLib (lib);
+        }
+        report (total);
+    }
+
+    //! From nothing to a running library and back.
+    void coldStart () {
+        QBENCHMARK {
+            BenchLib * lib = new BenchLib ();
+            lib->changeState (AppLib::InitializingState);
+            lib->changeState (AppLib::RunningState);
+            endLib (lib);
+        }
+    }
+};
+/* ========================================================================= */
+
+QTEST_GUILESS_MAIN(BenchAppLib)
+#include "bench_applib.moc"
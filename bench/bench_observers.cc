@@ -0,0 +1,108 @@
+/**
+ * @file bench_observers.cc
+ * @brief Lifecycle observers compared with the Qt signals.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include <applib/applib.h>
+#include <QtTest>
+
+/* ------------------------------------------------------------------------- */
+class BenchLib : public AppLib {
+public:
+    BenchLib () : AppLib () {}
+
+    using AppLib::changeState;
+
+    QString appUserName () {
+        return QLatin1String ("Bench Library");
+    }
+    QString appUnixName () {
+        return QLatin1String ("benchlib");
+    }
+};
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+class Receiver : public QObject {
+    Q_OBJECT
+public:
+    Receiver () : QObject (), hits (0) {}
+    int hits;
+public slots:
+    void onStarted () {
+        ++hits;
+    }
+};
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+class BenchObservers : public QObject {
+    Q_OBJECT
+
+    BenchLib * lib_;
+
+private slots:
+
+    void initTestCase () {
+        lib_ = new BenchLib ();
+    }
+
+    void cleanupTestCase () {
+        lib_->changeState (AppLib::InitializingState);
+        lib_->changeState (AppLib::RunningState);
+        AppLib::end ();
+        QCoreApplication::sendPostedEvents (NULL, QEvent::DeferredDelete);
+    }
+
+    void signalDispatch_data () {
+        QTest::addColumn<int>("receivers");
+        QTest::newRow ("1") << 1;
+        QTest::newRow ("8") << 8;
+    }
+
+    void signalDispatch () {
+        QFETCH(int, receivers);
+        QList<Receiver*> list;
+        for (int i = 0; i < receivers; ++i) {
+            Receiver * r = new Receiver ();
+            QObject::connect (lib_, SIGNAL(libStarted()),
+                              r, SLOT(onStarted()), Qt::DirectConnection);
+            list.append (r);
+        }
+        QBENCHMARK {
+            emit lib_->libStarted ();
+        }
+        qDeleteAll (list);
+    }
+
+    void observerDispatch_data () {
+        signalDispatch_data ();
+    }
+
+    void observerDispatch () {
+        QFETCH(int, receivers);
+        int hits = 0;
+        QList<int> ids;
+        for (int i = 0; i < receivers; ++i) {
+            ids.append (lib_->observers ().add (
+                            [&hits] (AppLib *, AppLibObservers::Event) {
+                ++hits;
+            }));
+        }
+        QBENCHMARK {
+            lib_->observers ().notify (lib_, AppLibObservers::LibStarted);
+        }
+        foreach (int id, ids) {
+            lib_->observers ().remove (id);
+        }
+        QVERIFY(hits > 0);
+    }
+};
+/* ========================================================================= */
+
+QTEST_GUILESS_MAIN(BenchObservers)
+#include "bench_observers.moc"
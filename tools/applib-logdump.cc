@@ -0,0 +1,289 @@
+/**
+ * @file applib-logdump.cc
+ * @brief Converts the binary logs and flight recorder files of AppLib
+ * to text or JSON.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#include <applib/applib-binlog.h>
+#include <applib/applib-flightrec.h>
+
+#include <QFile>
+#include <QDateTime>
+#include <QByteArray>
+#include <QHash>
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+/* ------------------------------------------------------------------------- */
+static const char * typeName (quint16 type)
+{
+    switch (type) {
+    case QtDebugMsg:
+        return "debug";
+    case QtWarningMsg:
+        return "warning";
+    case QtCriticalMsg:
+        return "critical";
+    case QtFatalMsg:
+        return "fatal";
+    default:
+        return "info";
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static void printJsonString (const QByteArray & value)
+{
+    putchar ('"');
+    for (int i = 0; i < value.size (); ++i) {
+        const uchar c = static_cast<uchar>(value.at (i));
+        switch (c) {
+        case '"':
+            fputs ("\\\"", stdout);
+            break;
+        case '\\':
+            fputs ("\\\\", stdout);
+            break;
+        case '\n':
+            fputs ("\\n", stdout);
+            break;
+        case '\r':
+            fputs ("\\r", stdout);
+            break;
+        case '\t':
+            fputs ("\\t", stdout);
+            break;
+        default:
+            if (c < 0x20) {
+                printf ("\\u%04x", c);
+            } else {
+                putchar (c);
+            }
+        }
+    }
+    putchar ('"');
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static QByteArray timeStamp (qint64 start_ms, qint64 time_ns)
+{
+    return QDateTime::fromMSecsSinceEpoch (start_ms + time_ns / 1000000)
+            .toString (QLatin1String ("yyyy-MM-dd hh:mm:ss.zzz"))
+            .toLatin1 ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int dumpBinLog (
+        const char * path, const uchar * data, quint64 file_size, bool b_json)
+{
+    if (file_size < sizeof(AppLibBinLogHeader)) {
+        fprintf (stderr, "%s is not a binary log\n", path);
+        return 2;
+    }
+    const AppLibBinLogHeader * header =
+            reinterpret_cast<const AppLibBinLogHeader *>(data);
+    if ((memcmp (header->magic, APPLIB_BINLOG_MAGIC,
+                 sizeof(header->magic)) != 0) ||
+            (header->version != APPLIB_BINLOG_VERSION)) {
+        fprintf (stderr, "%s is not a binary log of a known version\n", path);
+        return 2;
+    }
+
+    // a log left behind by a crash may claim more than was written
+    const quint64 end = qMin (header->end, file_size);
+    QHash<quint32, QByteArray> strings;
+    quint64 pos = header->header_size;
+    while (pos + sizeof(AppLibBinLogRecord) <= end) {
+        const AppLibBinLogRecord * rec =
+                reinterpret_cast<const AppLibBinLogRecord *>(data + pos);
+        if ((rec->size < sizeof(AppLibBinLogRecord)) ||
+                (pos + rec->size > end) ||
+                (sizeof(AppLibBinLogRecord) + rec->length > rec->size)) {
+            fprintf (stderr, "Truncated record at offset %llu\n",
+                     static_cast<unsigned long long>(pos));
+            break;
+        }
+        QByteArray payload (reinterpret_cast<const char *>(rec + 1),
+                            static_cast<int>(rec->length));
+        pos += rec->size;
+
+        if (rec->kind == AppLibBinLog::StringRecord) {
+            strings.insert (rec->category, payload);
+            continue;
+        } else if (rec->kind != AppLibBinLog::MessageRecord) {
+            continue;
+        }
+
+        const QByteArray stamp = timeStamp (header->start_ms, rec->time_ns);
+        const QByteArray category = strings.value (rec->category);
+        const QByteArray source = strings.value (rec->file);
+        const QByteArray function = strings.value (rec->function);
+
+        if (b_json) {
+            printf ("{\"time\":\"%s\",\"ns\":%lld,\"thread\":%u,\"type\":\"%s\",",
+                    stamp.constData (),
+                    static_cast<long long>(rec->time_ns),
+                    rec->thread, typeName (rec->type));
+            fputs ("\"category\":", stdout);
+            printJsonString (category);
+            fputs (",\"file\":", stdout);
+            printJsonString (source);
+            printf (",\"line\":%u,\"function\":", rec->line);
+            printJsonString (function);
+            fputs (",\"message\":", stdout);
+            printJsonString (payload);
+            fputs ("}\n", stdout);
+        } else {
+            printf ("%s T%u %-8s", stamp.constData (), rec->thread,
+                    typeName (rec->type));
+            if (!category.isEmpty ())
+                printf (" [%s]", category.constData ());
+            if (!source.isEmpty ())
+                printf (" %s:%u", source.constData (), rec->line);
+            printf (": %s\n", payload.constData ());
+        }
+    }
+    return 0;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static bool earlierRecord (
+        const AppLibFlightRecord * a, const AppLibFlightRecord * b)
+{
+    return a->seq < b->seq;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The records are in a ring, so they are sorted by their sequence
+ * numbers; the ones that were not complete have a zero sequence.
+ */
+static int dumpFlightRecorder (
+        const char * path, const uchar * data, quint64 file_size, bool b_json)
+{
+    const AppLibFlightHeader * header =
+            reinterpret_cast<const AppLibFlightHeader *>(data);
+    if ((header->version != APPLIB_FLIGHTREC_VERSION) ||
+            (header->record_size != sizeof(AppLibFlightRecord)) ||
+            (header->header_size + static_cast<quint64>(header->record_count) *
+             header->record_size > file_size)) {
+        fprintf (stderr, "%s is not a flight recorder of a known version\n",
+                 path);
+        return 2;
+    }
+
+    const AppLibFlightRecord * records =
+            reinterpret_cast<const AppLibFlightRecord *>(
+                data + header->header_size);
+    std::vector<const AppLibFlightRecord *> order;
+    order.reserve (header->record_count);
+    for (quint32 i = 0; i < header->record_count; ++i) {
+        if ((records[i].seq != 0) &&
+                (records[i].length <= sizeof(records[i].text)))
+            order.push_back (&records[i]);
+    }
+    std::sort (order.begin (), order.end (), earlierRecord);
+
+    for (size_t i = 0; i < order.size (); ++i) {
+        const AppLibFlightRecord * rec = order[i];
+        const QByteArray stamp = timeStamp (header->start_ms, rec->time_ns);
+        const QByteArray text (rec->text, static_cast<int>(rec->length));
+        const char * kind;
+        switch (rec->kind) {
+        case AppLibFlightRecorder::MessageRecord:
+            kind = typeName (rec->type);
+            break;
+        case AppLibFlightRecorder::TransitionRecord:
+            kind = "state";
+            break;
+        default:
+            kind = "breadcrumb";
+        }
+
+        if (b_json) {
+            printf ("{\"seq\":%llu,\"time\":\"%s\",\"ns\":%lld,"
+                    "\"thread\":%u,\"kind\":\"%s\"",
+                    static_cast<unsigned long long>(rec->seq - 1),
+                    stamp.constData (),
+                    static_cast<long long>(rec->time_ns),
+                    rec->thread, kind);
+            if (rec->kind == AppLibFlightRecorder::TransitionRecord) {
+                printf (",\"from\":%d,\"to\":%d}\n", rec->from, rec->to);
+            } else {
+                fputs (",\"message\":", stdout);
+                printJsonString (text);
+                fputs ("}\n", stdout);
+            }
+        } else if (rec->kind == AppLibFlightRecorder::TransitionRecord) {
+            printf ("%s T%u %-10s %d -> %d\n", stamp.constData (),
+                    rec->thread, kind, rec->from, rec->to);
+        } else {
+            printf ("%s T%u %-10s %s\n", stamp.constData (),
+                    rec->thread, kind, text.constData ());
+        }
+    }
+    return 0;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static void usage ()
+{
+    fprintf (stderr,
+             "Usage: applib-logdump [--json] FILE\n"
+             "Converts a binary log or a flight recorder file written "
+             "by AppLib to text (default) or to JSON lines.\n");
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int main (int argc, char *argv[])
+{
+    bool b_json = false;
+    const char * path = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp (argv[i], "--json") == 0) {
+            b_json = true;
+        } else if ((argv[i][0] == '-') || (path != NULL)) {
+            usage ();
+            return 1;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (path == NULL) {
+        usage ();
+        return 1;
+    }
+
+    QFile file (QFile::decodeName (path));
+    if (!file.open (QIODevice::ReadOnly)) {
+        fprintf (stderr, "Unable to open %s\n", path);
+        return 2;
+    }
+    const quint64 file_size = static_cast<quint64>(file.size ());
+    const uchar * data = file.map (0, file.size ());
+    if ((data == NULL) || (file_size < 8)) {
+        fprintf (stderr, "%s is not a binary log\n", path);
+        return 2;
+    }
+
+    if ((file_size >= sizeof(AppLibFlightHeader)) &&
+            (memcmp (data, APPLIB_FLIGHTREC_MAGIC, 8) == 0)) {
+        return dumpFlightRecorder (path, data, file_size, b_json);
+    }
+    return dumpBinLog (path, data, file_size, b_json);
+}
+/* ========================================================================= */